@@ -88,6 +88,30 @@ $(eval $(call TestHostCommand,perl-thread-queue, \
 	Please install the Perl Thread::Queue module, \
 	perl -MThread::Queue -e 1))
 
+$(eval $(call TestHostCommand,perl-storable, \
+	Please install the Perl Storable module, \
+	perl -MStorable -e 1))
+
+$(eval $(call TestHostCommand,perl-digest-sha, \
+	Please install the Perl Digest::SHA module, \
+	perl -MDigest::SHA -e 1))
+
+$(eval $(call TestHostCommand,perl-digest-md5, \
+	Please install the Perl Digest::MD5 module, \
+	perl -MDigest::MD5 -e 1))
+
+$(eval $(call TestHostCommand,perl-io-uncompress-gunzip, \
+	Please install the Perl IO::Uncompress::Gunzip module, \
+	perl -MIO::Uncompress::Gunzip -e 1))
+
+$(eval $(call TestHostCommand,perl-time-hires, \
+	Please install the Perl Time::HiRes module, \
+	perl -MTime::HiRes -e 1))
+
+$(eval $(call TestHostCommand,perl-file-temp, \
+	Please install the Perl File::Temp module, \
+	perl -MFile::Temp -e 1))
+
 $(eval $(call SetupHostCommand,tar,Please install GNU 'tar', \
 	gtar --version 2>&1 | grep GNU, \
 	gnutar --version 2>&1 | grep GNU, \
@@ -204,7 +228,7 @@ $(eval $(call SetupHostCommand,which,Please install 'which', \
 
 $(STAGING_DIR_HOST)/bin/mkhash: $(SCRIPT_DIR)/mkhash.c
 	mkdir -p $(dir $@)
-	$(CC) -O2 -I$(TOPDIR)/tools/include -o $@ $<
+	$(CC) -O2 -I$(TOPDIR)/tools/include -o $@ $< -lpthread
 
 $(STAGING_DIR_HOST)/bin/xxd: $(SCRIPT_DIR)/xxdi.pl
 	$(LN) $< $@
@@ -10,6 +10,16 @@ SCAN_DIR ?= package
 TARGET_STAMP:=$(TMP_DIR)/info/.files-$(SCAN_TARGET).stamp
 FILELIST:=$(TMP_DIR)/info/.files-$(SCAN_TARGET)-$(SCAN_COOKIE)
 OVERRIDELIST:=$(TMP_DIR)/info/.overrides-$(SCAN_TARGET)-$(SCAN_COOKIE)
+TIMELIST:=$(TMP_DIR)/.$(SCAN_TARGET)-times
+
+# Number of parallel Makefile dumps
+SCAN_JOBS ?= 1
+
+# Directory for dumps keyed by the content hash of the package Makefile
+# and its scan dependencies, can be shared between build trees
+SCAN_CACHE_DIR ?=
+
+SCAN_TIME:=perl -MTime::HiRes=time -e 'printf "%d\n", time * 1000'
 
 export PATH:=$(TOPDIR)/staging_dir/host/bin:$(PATH)
 
@@ -45,6 +55,13 @@ endif
 define PackageDir
   $(TMP_DIR)/.$(SCAN_TARGET): $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1)
   $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
+	$(if $(SCAN_CACHE_DIR), \
+		key=$$$$({ echo "$(SCAN_DIR)/$(2) $(3) $(SCAN_MAKEOPTS)"; cat $$^; } | $(MKHASH) md5); \
+		if [ -s "$(SCAN_CACHE_DIR)/$$$$key" ]; then \
+			echo "0 $(SCAN_DIR)/$(2) (cached)" > $(TMP_DIR)/info/.time-$(SCAN_TARGET)-$(1); \
+			cp "$(SCAN_CACHE_DIR)/$$$$key" $$@.tmp && mv $$@.tmp $$@ && exit 0; \
+		fi;) \
+	start=$$$$($(SCAN_TIME)); failed=; \
 	{ \
 		$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
 		echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
@@ -54,9 +71,17 @@ define PackageDir
 			$(NO_TRACE_MAKE) --no-print-dir -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) > $(TOPDIR)/logs/$(SCAN_DIR)/$(2)/dump.txt 2>&1; \
 			$$(call progress,ERROR: please fix $(SCAN_DIR)/$(2)/Makefile - see logs/$(SCAN_DIR)/$(2)/dump.txt for details\n) \
 			rm -f $$@; \
+			failed=1; \
 		}; \
 		echo; \
-	} > $$@.tmp
+	} > $$@.tmp; \
+	echo "$$$$(( $$$$($(SCAN_TIME)) - $$$$start )) $(SCAN_DIR)/$(2)" > $(TMP_DIR)/info/.time-$(SCAN_TARGET)-$(1); \
+	$(if $(SCAN_CACHE_DIR), \
+		[ -n "$$$$failed" ] || { \
+			mkdir -p "$(SCAN_CACHE_DIR)" && \
+			cp $$@.tmp "$(SCAN_CACHE_DIR)/.$$$$key.$$$$$$$$" && \
+			mv "$(SCAN_CACHE_DIR)/.$$$$key.$$$$$$$$" "$(SCAN_CACHE_DIR)/$$$$key"; \
+		};) \
 	mv $$@.tmp $$@
 endef
 
@@ -112,9 +137,12 @@ $(TARGET_STAMP)::
 $(TMP_DIR)/.$(SCAN_TARGET): $(TARGET_STAMP)
 	$(call progress,Collecting $(SCAN_NAME) info: merging...)
 	-cat $(FILELIST) | awk '{gsub(/\//, "_", $$0);print "$(TMP_DIR)/info/.$(SCAN_TARGET)-" $$0}' | xargs cat > $@ 2>/dev/null
+	-cat $(FILELIST) | awk '{gsub(/\//, "_", $$0);print "$(TMP_DIR)/info/.time-$(SCAN_TARGET)-" $$0}' | xargs cat 2>/dev/null | sort -rn > $(TIMELIST)
 	$(call progress,Collecting $(SCAN_NAME) info: done)
 	echo
 
 FORCE:
 .PHONY: FORCE
+ifeq ($(filter-out 1,$(SCAN_JOBS)),)
 .NOTPARALLEL:
+endif
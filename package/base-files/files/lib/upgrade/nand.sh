@@ -63,6 +63,30 @@ get_magic_long_tar() {
 	(tar xO${3}f "$1" "$2" | dd bs=4 count=1 | hexdump -v -n 4 -e '1/1 "%02x"') 2> /dev/null
 }
 
+# Member index of a sysupgrade tar, built by tarscan if it is installed.
+# One "<size> <offset> <magic> <crc32> <name>" line per member.
+NAND_TAR_INDEX=/tmp/sysupgrade.index
+
+# Scan the tar file once, verifying tar headers and gzip checksum on the
+# way. The index is cached, so calling this again for the same file is cheap.
+# Returns 1 if tarscan is not available and 2 if the file is corrupted.
+nand_index_tar() {
+	command -v tarscan > /dev/null || return 1
+	tarscan index -c "$NAND_TAR_INDEX" "$1" > /dev/null 2>&1 || return 2
+}
+
+# $(1): member name, $(2): index field (1: size, 3: magic)
+nand_tar_field() {
+	awk -v name="$1" -v field="$2" '
+		!/^#/ && $5 == name { print $field; found = 1; exit }
+		END { if (!found && field == 1) print 0 }
+	' "$NAND_TAR_INDEX"
+}
+
+nand_tar_board_dir() {
+	awk '!/^#/ && $5 ~ /^sysupgrade-[^\/]*\// { sub(/\/.*/, "", $5); print $5; exit }' "$NAND_TAR_INDEX"
+}
+
 identify_magic() {
 	local magic=$1
 	case "$magic" in
@@ -305,21 +329,38 @@ nand_upgrade_fit() {
 nand_upgrade_tar() {
 	local tar_file="$1"
 	local gz="$2"
+	local indexed
+	nand_index_tar "$tar_file" && indexed=1
 
 	# WARNING: This fails if tar contains more than one 'sysupgrade-*' directory.
-	local board_dir="$(tar t${gz}f "$tar_file" | grep -m 1 '^sysupgrade-.*/$')"
-	board_dir="${board_dir%/}"
+	local board_dir
+	if [ "$indexed" ]; then
+		board_dir="$(nand_tar_board_dir)"
+	else
+		board_dir="$(tar t${gz}f "$tar_file" | grep -m 1 '^sysupgrade-.*/$')"
+		board_dir="${board_dir%/}"
+	fi
 
 	local kernel_mtd kernel_length
 	if [ "$CI_KERNPART" != "none" ]; then
 		kernel_mtd="$(find_mtd_index "$CI_KERNPART")"
-		kernel_length=$( (tar xO${gz}f "$tar_file" "$board_dir/kernel" | wc -c) 2> /dev/null)
+		if [ "$indexed" ]; then
+			kernel_length="$(nand_tar_field "$board_dir/kernel" 1)"
+		else
+			kernel_length=$( (tar xO${gz}f "$tar_file" "$board_dir/kernel" | wc -c) 2> /dev/null)
+		fi
 		[ "$kernel_length" = 0 ] && kernel_length=
 	fi
-	local rootfs_length=$( (tar xO${gz}f "$tar_file" "$board_dir/root" | wc -c) 2> /dev/null)
-	[ "$rootfs_length" = 0 ] && rootfs_length=
-	local rootfs_type
-	[ "$rootfs_length" ] && rootfs_type="$(identify_tar "$tar_file" "$board_dir/root" "$gz")"
+	local rootfs_length rootfs_type
+	if [ "$indexed" ]; then
+		rootfs_length="$(nand_tar_field "$board_dir/root" 1)"
+		[ "$rootfs_length" = 0 ] && rootfs_length=
+		[ "$rootfs_length" ] && rootfs_type="$(identify_magic $(nand_tar_field "$board_dir/root" 3))"
+	else
+		rootfs_length=$( (tar xO${gz}f "$tar_file" "$board_dir/root" | wc -c) 2> /dev/null)
+		[ "$rootfs_length" = 0 ] && rootfs_length=
+		[ "$rootfs_length" ] && rootfs_type="$(identify_tar "$tar_file" "$board_dir/root" "$gz")"
+	fi
 
 	local ubi_kernel_length
 	if [ "$kernel_length" ]; then
@@ -337,6 +378,30 @@ nand_upgrade_tar() {
 	nand_upgrade_prepare_ubi "$rootfs_length" "$rootfs_type" "$ubi_kernel_length" "$has_env" || return 1
 
 	local ubidev="$( nand_find_ubi "$CI_UBIPART" )"
+	if [ "$indexed" ]; then
+		# The archive was verified while indexing, extract checks that the
+		# data still matches the index. Write the rootfs first and the
+		# kernel last, and only after the rootfs went through, so that an
+		# interrupted upgrade never leaves a new kernel with a broken rootfs.
+		if [ "$rootfs_length" ]; then
+			local root_ubivol="$( nand_find_volume $ubidev "$CI_ROOTPART" )"
+			tarscan extract -i "$NAND_TAR_INDEX" "$tar_file" "$board_dir/root" \
+				"ubiupdatevol /dev/$root_ubivol -s $rootfs_length -" || return 1
+		fi
+		if [ "$kernel_length" ]; then
+			if [ "$kernel_mtd" ]; then
+				tarscan extract -i "$NAND_TAR_INDEX" "$tar_file" "$board_dir/kernel" \
+					"mtd write - '$CI_KERNPART'" || return 1
+			else
+				local kern_ubivol="$( nand_find_volume $ubidev "$CI_KERNPART" )"
+				tarscan extract -i "$NAND_TAR_INDEX" "$tar_file" "$board_dir/kernel" \
+					"ubiupdatevol /dev/$kern_ubivol -s $kernel_length -" || return 1
+			fi
+		fi
+
+		return 0
+	fi
+
 	if [ "$rootfs_length" ]; then
 		local root_ubivol="$( nand_find_volume $ubidev "$CI_ROOTPART" )"
 		tar xO${gz}f "$tar_file" "$board_dir/root" | \
@@ -374,10 +439,13 @@ nand_verify_tar_file() {
 	local gz="$2"
 
 	echo "verifying sysupgrade tar file integrity"
-	if ! tar xO${gz}f "$file" > /dev/null; then
-		echo "corrupted sysupgrade tar file"
-		return 1
-	fi
+	nand_index_tar "$file"
+	case $? in
+		0) return 0;;
+		1) tar xO${gz}f "$file" > /dev/null && return 0;;
+	esac
+	echo "corrupted sysupgrade tar file"
+	return 1
 }
 
 nand_do_flash_file() {
@@ -457,7 +525,12 @@ nand_do_platform_check() {
 
 	local gz="$(identify_if_gzip "$file")"
 	local file_type="$(identify "$file" "" "$gz")"
-	local control_length=$( (tar xO${gz}f "$file" "sysupgrade-$board_name/CONTROL" | wc -c) 2> /dev/null)
+	local control_length
+	if nand_index_tar "$file"; then
+		control_length="$(nand_tar_field "sysupgrade-$board_name/CONTROL" 1)"
+	else
+		control_length=$( (tar xO${gz}f "$file" "sysupgrade-$board_name/CONTROL" | wc -c) 2> /dev/null)
+	fi
 
 	if [ "$control_length" != 0 ]; then
 		nand_verify_tar_file "$file" "$gz" || return 1
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Benchmark swconfig config loading against the swconfig-sim virtual switch
+#
+# (Re)loads swconfig-sim with the given geometry, generates a config that
+# uses every VLAN and port, and lets "swconfig dev <dev> bench" apply it
+# with single and with batched netlink requests. The driver callback
+# counters of both modes together are printed after each run.
+#
+# usage: swconfig-sim-bench [-p <ports>] [-v <vlans>] [-n <runs>]
+#
+
+PORTS=28
+VLANS=4095
+RUNS=3
+DEV=swsim0
+
+usage() {
+	echo "Usage: $0 [-p <ports>] [-v <vlans>] [-n <runs>]" >&2
+	exit 1
+}
+
+while getopts "p:v:n:" opt; do
+	case "$opt" in
+		p) PORTS="$OPTARG";;
+		v) VLANS="$OPTARG";;
+		n) RUNS="$OPTARG";;
+		*) usage;;
+	esac
+done
+
+CPU_PORT=$((PORTS - 1))
+TMP_DIR="$(mktemp -d /tmp/swconfig-sim-bench.XXXXXX)" || exit 1
+trap 'rm -rf "$TMP_DIR"' EXIT
+CONFIG="$TMP_DIR/network"
+
+rmmod swconfig-sim 2>/dev/null
+insmod swconfig-sim ports="$PORTS" vlans="$VLANS" || exit 1
+
+# every VLAN on all ports: the first two ports untagged in alternating
+# VLANs, all others tagged
+{
+	cat <<EOF
+config switch
+	option name '$DEV'
+	option reset '1'
+	option enable_vlan '1'
+
+EOF
+	tagged=
+	port=2
+	while [ "$port" -lt "$PORTS" ]; do
+		tagged="$tagged ${port}t"
+		port=$((port + 1))
+	done
+	vlan=1
+	while [ "$vlan" -lt "$VLANS" ]; do
+		cat <<EOF
+config switch_vlan
+	option device '$DEV'
+	option vlan '$vlan'
+	option vid '$vlan'
+	option ports '$((vlan % 2))$tagged'
+
+EOF
+		vlan=$((vlan + 1))
+	done
+	port=0
+	while [ "$port" -lt "$PORTS" ]; do
+		cat <<EOF
+config switch_port
+	option device '$DEV'
+	option port '$port'
+	option sim_traffic '$((port * 1000))'
+
+EOF
+		port=$((port + 1))
+	done
+} > "$CONFIG"
+
+echo "$DEV: $PORTS ports (cpu port $CPU_PORT), $VLANS VLANs"
+
+run=1
+while [ "$run" -le "$RUNS" ]; do
+	echo "run $run:"
+	swconfig dev "$DEV" set reset_stats
+	swconfig dev "$DEV" bench "$CONFIG" || exit 1
+	swconfig dev "$DEV" get stats | sed -e 's/^/	/'
+	run=$((run + 1))
+done
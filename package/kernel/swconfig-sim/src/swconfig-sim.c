@@ -0,0 +1,749 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * swconfig-sim.c: memory backed virtual switch for swconfig
+ *
+ * Registers one or more switches without any hardware behind them. The
+ * VLAN table, port PVIDs, link states and MIB counters only live in
+ * memory; MIB counters advance at a configurable per-port rate so the
+ * swconfig LED trigger has something to blink for.
+ *
+ * Every driver callback is counted, the counters can be read through the
+ * global "stats" attribute or /sys/kernel/debug/swconfig-sim/<alias>.
+ * Attribute calls and netlink message sizes on the swconfig side are
+ * available through the swconfig tracepoints.
+ */
+
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/switch.h>
+
+#define SWSIM_MAX_PORTS		32
+#define SWSIM_MAX_VLANS		4096
+#define SWSIM_PKT_SIZE		512
+
+static unsigned int switches = 1;
+module_param(switches, uint, 0444);
+MODULE_PARM_DESC(switches, "Number of virtual switches to register");
+
+static unsigned int ports = 8;
+module_param(ports, uint, 0444);
+MODULE_PARM_DESC(ports, "Number of ports per switch (max 32)");
+
+static unsigned int vlans = SWSIM_MAX_VLANS;
+module_param(vlans, uint, 0444);
+MODULE_PARM_DESC(vlans, "Number of VLAN table entries per switch");
+
+static int cpu_port = -1;
+module_param(cpu_port, int, 0444);
+MODULE_PARM_DESC(cpu_port, "CPU port number (default: last port)");
+
+enum swsim_op {
+	SWSIM_OP_GET_VLAN_PORTS,
+	SWSIM_OP_SET_VLAN_PORTS,
+	SWSIM_OP_GET_PVID,
+	SWSIM_OP_SET_PVID,
+	SWSIM_OP_APPLY,
+	SWSIM_OP_RESET,
+	SWSIM_OP_GET_LINK,
+	SWSIM_OP_SET_LINK,
+	SWSIM_OP_GET_STATS,
+	SWSIM_OP_GET_ATTR,
+	SWSIM_OP_SET_ATTR,
+	__SWSIM_OP_MAX
+};
+
+static const char * const swsim_op_names[__SWSIM_OP_MAX] = {
+	[SWSIM_OP_GET_VLAN_PORTS] = "get_vlan_ports",
+	[SWSIM_OP_SET_VLAN_PORTS] = "set_vlan_ports",
+	[SWSIM_OP_GET_PVID] = "get_port_pvid",
+	[SWSIM_OP_SET_PVID] = "set_port_pvid",
+	[SWSIM_OP_APPLY] = "apply_config",
+	[SWSIM_OP_RESET] = "reset_switch",
+	[SWSIM_OP_GET_LINK] = "get_port_link",
+	[SWSIM_OP_SET_LINK] = "set_port_link",
+	[SWSIM_OP_GET_STATS] = "get_port_stats",
+	[SWSIM_OP_GET_ATTR] = "get_attr",
+	[SWSIM_OP_SET_ATTR] = "set_attr",
+};
+
+struct swsim_vlan {
+	u16 vid;
+	u32 members;
+	u32 tagged;
+};
+
+struct swsim_port {
+	u16 pvid;
+	struct switch_port_link link;
+
+	/* simulated traffic in bytes per second, in each direction */
+	u32 rate;
+	unsigned long stamp;
+	u64 rx_bytes, tx_bytes;
+	u64 rx_packets, tx_packets;
+};
+
+struct swsim_priv {
+	struct switch_dev dev;
+	char alias[IFNAMSIZ];
+
+	/*
+	 * The LED trigger polls link and stats without holding the
+	 * swconfig device mutex, so all state is under this lock.
+	 */
+	spinlock_t lock;
+	bool vlan_enable;
+	struct swsim_vlan *vlan;
+	struct swsim_port port[SWSIM_MAX_PORTS];
+
+	atomic_long_t calls[__SWSIM_OP_MAX];
+	struct dentry *debugfs;
+	char buf[512];
+};
+
+static struct swsim_priv **swsim_devs;
+static struct dentry *swsim_debugfs;
+
+static inline struct swsim_priv *
+swdev_to_swsim(struct switch_dev *dev)
+{
+	return container_of(dev, struct swsim_priv, dev);
+}
+
+static inline void
+swsim_count(struct swsim_priv *priv, enum swsim_op op)
+{
+	atomic_long_inc(&priv->calls[op]);
+}
+
+/* Advance the MIB counters of a port by the traffic since the last call */
+static void
+swsim_port_update(struct swsim_port *p)
+{
+	unsigned long now = jiffies;
+	u64 bytes;
+
+	if (p->link.link && p->rate) {
+		bytes = div_u64((u64)p->rate * (now - p->stamp), HZ);
+		p->rx_bytes += bytes;
+		p->tx_bytes += bytes;
+		p->rx_packets += div_u64(bytes, SWSIM_PKT_SIZE);
+		p->tx_packets += div_u64(bytes, SWSIM_PKT_SIZE);
+	}
+
+	p->stamp = now;
+}
+
+static void
+swsim_reset_mibs(struct swsim_priv *priv)
+{
+	int i;
+
+	for (i = 0; i < priv->dev.ports; i++) {
+		struct swsim_port *p = &priv->port[i];
+
+		p->rx_bytes = p->tx_bytes = 0;
+		p->rx_packets = p->tx_packets = 0;
+		p->stamp = jiffies;
+	}
+}
+
+static void
+swsim_reset(struct swsim_priv *priv)
+{
+	int i;
+
+	spin_lock_bh(&priv->lock);
+
+	priv->vlan_enable = false;
+	memset(priv->vlan, 0, sizeof(*priv->vlan) * priv->dev.vlans);
+	for (i = 0; i < priv->dev.vlans; i++)
+		priv->vlan[i].vid = i;
+
+	for (i = 0; i < priv->dev.ports; i++) {
+		struct swsim_port *p = &priv->port[i];
+
+		memset(p, 0, sizeof(*p));
+		p->link.link = true;
+		p->link.duplex = true;
+		p->link.aneg = true;
+		p->link.speed = SWITCH_PORT_SPEED_1000;
+	}
+	swsim_reset_mibs(priv);
+
+	spin_unlock_bh(&priv->lock);
+}
+
+static int
+swsim_get_vlan_ports(struct switch_dev *dev, struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_vlan *v;
+	int i;
+
+	swsim_count(priv, SWSIM_OP_GET_VLAN_PORTS);
+	if (val->port_vlan >= dev->vlans)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	v = &priv->vlan[val->port_vlan];
+	val->len = 0;
+	for (i = 0; i < dev->ports; i++) {
+		struct switch_port *p;
+
+		if (!(v->members & BIT(i)))
+			continue;
+
+		p = &val->value.ports[val->len++];
+		p->id = i;
+		p->flags = (v->tagged & BIT(i)) ?
+			   BIT(SWITCH_PORT_FLAG_TAGGED) : 0;
+	}
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_set_vlan_ports(struct switch_dev *dev, struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_vlan *v;
+	int i;
+
+	swsim_count(priv, SWSIM_OP_SET_VLAN_PORTS);
+	if (val->port_vlan >= dev->vlans)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	v = &priv->vlan[val->port_vlan];
+	v->members = 0;
+	v->tagged = 0;
+	for (i = 0; i < val->len; i++) {
+		struct switch_port *p = &val->value.ports[i];
+
+		if (p->id >= dev->ports)
+			continue;
+
+		v->members |= BIT(p->id);
+		if (p->flags & BIT(SWITCH_PORT_FLAG_TAGGED))
+			v->tagged |= BIT(p->id);
+		else
+			priv->port[p->id].pvid = val->port_vlan;
+	}
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_get_port_pvid(struct switch_dev *dev, int port, int *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_PVID);
+	if (port >= dev->ports)
+		return -EINVAL;
+
+	*val = priv->port[port].pvid;
+	return 0;
+}
+
+static int
+swsim_set_port_pvid(struct switch_dev *dev, int port, int val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_SET_PVID);
+	if (port >= dev->ports || val < 0 || val >= dev->vlans)
+		return -EINVAL;
+
+	priv->port[port].pvid = val;
+	return 0;
+}
+
+static int
+swsim_apply_config(struct switch_dev *dev)
+{
+	swsim_count(swdev_to_swsim(dev), SWSIM_OP_APPLY);
+	return 0;
+}
+
+static int
+swsim_reset_switch(struct switch_dev *dev)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_RESET);
+	swsim_reset(priv);
+	return 0;
+}
+
+static int
+swsim_get_port_link(struct switch_dev *dev, int port,
+		    struct switch_port_link *link)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_LINK);
+	if (port >= dev->ports)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	*link = priv->port[port].link;
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_set_port_link(struct switch_dev *dev, int port,
+		    struct switch_port_link *link)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_port *p;
+
+	swsim_count(priv, SWSIM_OP_SET_LINK);
+	if (port >= dev->ports)
+		return -EINVAL;
+
+	/* the carrier is controlled through the sim_link attribute */
+	spin_lock_bh(&priv->lock);
+	p = &priv->port[port];
+	swsim_port_update(p);
+	link->link = p->link.link;
+	p->link = *link;
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_get_port_stats(struct switch_dev *dev, int port,
+		     struct switch_port_stats *stats)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_port *p;
+
+	swsim_count(priv, SWSIM_OP_GET_STATS);
+	if (port >= dev->ports)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	p = &priv->port[port];
+	swsim_port_update(p);
+	stats->rx_bytes = p->rx_bytes;
+	stats->tx_bytes = p->tx_bytes;
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_set_vlan_enable(struct switch_dev *dev, const struct switch_attr *attr,
+		      struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_SET_ATTR);
+	priv->vlan_enable = !!val->value.i;
+	return 0;
+}
+
+static int
+swsim_get_vlan_enable(struct switch_dev *dev, const struct switch_attr *attr,
+		      struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	val->value.i = priv->vlan_enable;
+	return 0;
+}
+
+static int
+swsim_set_reset_mibs(struct switch_dev *dev, const struct switch_attr *attr,
+		     struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_SET_ATTR);
+	spin_lock_bh(&priv->lock);
+	swsim_reset_mibs(priv);
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_get_stats(struct switch_dev *dev, const struct switch_attr *attr,
+		struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	int len = 0;
+	int i;
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	for (i = 0; i < __SWSIM_OP_MAX; i++)
+		len += scnprintf(priv->buf + len, sizeof(priv->buf) - len,
+				 "%s: %ld\n", swsim_op_names[i],
+				 atomic_long_read(&priv->calls[i]));
+
+	val->value.s = priv->buf;
+	val->len = len;
+	return 0;
+}
+
+static int
+swsim_set_reset_stats(struct switch_dev *dev, const struct switch_attr *attr,
+		      struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	int i;
+
+	for (i = 0; i < __SWSIM_OP_MAX; i++)
+		atomic_long_set(&priv->calls[i], 0);
+
+	return 0;
+}
+
+static int
+swsim_get_port_mib(struct switch_dev *dev, const struct switch_attr *attr,
+		   struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_port *p;
+	int len;
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	if (val->port_vlan >= dev->ports)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	p = &priv->port[val->port_vlan];
+	swsim_port_update(p);
+	len = scnprintf(priv->buf, sizeof(priv->buf),
+			"Port %d MIB counters\n"
+			"RxBytes    : %llu\n"
+			"RxPackets  : %llu\n"
+			"TxBytes    : %llu\n"
+			"TxPackets  : %llu\n",
+			val->port_vlan, p->rx_bytes, p->rx_packets,
+			p->tx_bytes, p->tx_packets);
+	spin_unlock_bh(&priv->lock);
+
+	val->value.s = priv->buf;
+	val->len = len;
+	return 0;
+}
+
+static int
+swsim_set_port_traffic(struct switch_dev *dev, const struct switch_attr *attr,
+		       struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_port *p;
+
+	swsim_count(priv, SWSIM_OP_SET_ATTR);
+	if (val->port_vlan >= dev->ports)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	p = &priv->port[val->port_vlan];
+	swsim_port_update(p);
+	p->rate = val->value.i;
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_get_port_traffic(struct switch_dev *dev, const struct switch_attr *attr,
+		       struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	if (val->port_vlan >= dev->ports)
+		return -EINVAL;
+
+	val->value.i = priv->port[val->port_vlan].rate;
+	return 0;
+}
+
+static int
+swsim_set_port_carrier(struct switch_dev *dev, const struct switch_attr *attr,
+		       struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+	struct swsim_port *p;
+
+	swsim_count(priv, SWSIM_OP_SET_ATTR);
+	if (val->port_vlan >= dev->ports)
+		return -EINVAL;
+
+	spin_lock_bh(&priv->lock);
+	p = &priv->port[val->port_vlan];
+	swsim_port_update(p);
+	p->link.link = !!val->value.i;
+	spin_unlock_bh(&priv->lock);
+
+	return 0;
+}
+
+static int
+swsim_get_port_carrier(struct switch_dev *dev, const struct switch_attr *attr,
+		       struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	if (val->port_vlan >= dev->ports)
+		return -EINVAL;
+
+	val->value.i = priv->port[val->port_vlan].link.link;
+	return 0;
+}
+
+static int
+swsim_set_vid(struct switch_dev *dev, const struct switch_attr *attr,
+	      struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_SET_ATTR);
+	if (val->port_vlan >= dev->vlans)
+		return -EINVAL;
+
+	priv->vlan[val->port_vlan].vid = val->value.i;
+	return 0;
+}
+
+static int
+swsim_get_vid(struct switch_dev *dev, const struct switch_attr *attr,
+	      struct switch_val *val)
+{
+	struct swsim_priv *priv = swdev_to_swsim(dev);
+
+	swsim_count(priv, SWSIM_OP_GET_ATTR);
+	if (val->port_vlan >= dev->vlans)
+		return -EINVAL;
+
+	val->value.i = priv->vlan[val->port_vlan].vid;
+	return 0;
+}
+
+static const struct switch_attr swsim_globals[] = {
+	{
+		.type = SWITCH_TYPE_INT,
+		.name = "enable_vlan",
+		.description = "Enable VLAN mode",
+		.set = swsim_set_vlan_enable,
+		.get = swsim_get_vlan_enable,
+		.max = 1,
+	},
+	{
+		.type = SWITCH_TYPE_NOVAL,
+		.name = "reset_mibs",
+		.description = "Reset all MIB counters",
+		.set = swsim_set_reset_mibs,
+	},
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "stats",
+		.description = "Driver callback counters",
+		.get = swsim_get_stats,
+	},
+	{
+		.type = SWITCH_TYPE_NOVAL,
+		.name = "reset_stats",
+		.description = "Reset driver callback counters",
+		.set = swsim_set_reset_stats,
+	},
+};
+
+static const struct switch_attr swsim_port_attrs[] = {
+	{
+		.type = SWITCH_TYPE_STRING,
+		.name = "mib",
+		.description = "Get port's MIB counters",
+		.get = swsim_get_port_mib,
+	},
+	{
+		.type = SWITCH_TYPE_INT,
+		.name = "sim_traffic",
+		.description = "Simulated traffic in bytes/s per direction",
+		.set = swsim_set_port_traffic,
+		.get = swsim_get_port_traffic,
+	},
+	{
+		.type = SWITCH_TYPE_INT,
+		.name = "sim_link",
+		.description = "Simulated carrier state",
+		.set = swsim_set_port_carrier,
+		.get = swsim_get_port_carrier,
+		.max = 1,
+	},
+};
+
+static const struct switch_attr swsim_vlan_attrs[] = {
+	{
+		.type = SWITCH_TYPE_INT,
+		.name = "vid",
+		.description = "VLAN ID (0-4094)",
+		.set = swsim_set_vid,
+		.get = swsim_get_vid,
+		.max = 4094,
+	},
+};
+
+static const struct switch_dev_ops swsim_ops = {
+	.attr_global = {
+		.attr = swsim_globals,
+		.n_attr = ARRAY_SIZE(swsim_globals),
+	},
+	.attr_port = {
+		.attr = swsim_port_attrs,
+		.n_attr = ARRAY_SIZE(swsim_port_attrs),
+	},
+	.attr_vlan = {
+		.attr = swsim_vlan_attrs,
+		.n_attr = ARRAY_SIZE(swsim_vlan_attrs),
+	},
+	.get_vlan_ports = swsim_get_vlan_ports,
+	.set_vlan_ports = swsim_set_vlan_ports,
+	.get_port_pvid = swsim_get_port_pvid,
+	.set_port_pvid = swsim_set_port_pvid,
+	.apply_config = swsim_apply_config,
+	.reset_switch = swsim_reset_switch,
+	.get_port_link = swsim_get_port_link,
+	.set_port_link = swsim_set_port_link,
+	.get_port_stats = swsim_get_port_stats,
+};
+
+static int
+swsim_debugfs_show(struct seq_file *s, void *data)
+{
+	struct swsim_priv *priv = s->private;
+	int i;
+
+	for (i = 0; i < __SWSIM_OP_MAX; i++)
+		seq_printf(s, "%s: %ld\n", swsim_op_names[i],
+			   atomic_long_read(&priv->calls[i]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(swsim_debugfs);
+
+static struct swsim_priv *
+swsim_create(int id)
+{
+	struct swsim_priv *priv;
+	int err;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return ERR_PTR(-ENOMEM);
+
+	priv->vlan = kcalloc(vlans, sizeof(*priv->vlan), GFP_KERNEL);
+	if (!priv->vlan) {
+		err = -ENOMEM;
+		goto err_free;
+	}
+
+	spin_lock_init(&priv->lock);
+	snprintf(priv->alias, sizeof(priv->alias), "swsim%d", id);
+
+	priv->dev.name = "swconfig-sim";
+	priv->dev.alias = priv->alias;
+	priv->dev.ops = &swsim_ops;
+	priv->dev.ports = ports;
+	priv->dev.vlans = vlans;
+	priv->dev.cpu_port = cpu_port >= 0 ? cpu_port : ports - 1;
+
+	swsim_reset(priv);
+
+	err = register_switch(&priv->dev, NULL);
+	if (err)
+		goto err_free;
+
+	priv->debugfs = debugfs_create_file(priv->alias, 0444, swsim_debugfs,
+					    priv, &swsim_debugfs_fops);
+
+	return priv;
+
+err_free:
+	kfree(priv->vlan);
+	kfree(priv);
+	return ERR_PTR(err);
+}
+
+static void
+swsim_destroy(struct swsim_priv *priv)
+{
+	debugfs_remove(priv->debugfs);
+	unregister_switch(&priv->dev);
+	kfree(priv->vlan);
+	kfree(priv);
+}
+
+static void
+swsim_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < switches; i++)
+		if (!IS_ERR_OR_NULL(swsim_devs[i]))
+			swsim_destroy(swsim_devs[i]);
+
+	debugfs_remove_recursive(swsim_debugfs);
+	kfree(swsim_devs);
+}
+
+static int __init
+swsim_init(void)
+{
+	int i;
+
+	if (!switches || !ports || ports > SWSIM_MAX_PORTS ||
+	    !vlans || vlans > SWSIM_MAX_VLANS ||
+	    (cpu_port >= 0 && cpu_port >= ports))
+		return -EINVAL;
+
+	swsim_devs = kcalloc(switches, sizeof(*swsim_devs), GFP_KERNEL);
+	if (!swsim_devs)
+		return -ENOMEM;
+
+	swsim_debugfs = debugfs_create_dir("swconfig-sim", NULL);
+
+	for (i = 0; i < switches; i++) {
+		swsim_devs[i] = swsim_create(i);
+		if (IS_ERR(swsim_devs[i])) {
+			int err = PTR_ERR(swsim_devs[i]);
+
+			pr_err("swconfig-sim: failed to register switch %d: %d\n",
+			       i, err);
+			swsim_cleanup();
+			return err;
+		}
+	}
+
+	return 0;
+}
+module_init(swsim_init);
+
+static void __exit
+swsim_exit(void)
+{
+	swsim_cleanup();
+}
+module_exit(swsim_exit);
+
+MODULE_DESCRIPTION("Virtual switch for swconfig testing");
+MODULE_LICENSE("GPL v2");
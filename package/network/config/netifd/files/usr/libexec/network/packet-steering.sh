@@ -0,0 +1,274 @@
+#!/bin/sh
+#
+# Map NIC interrupts, RPS and XPS to CPUs
+#
+# Every hardware queue interrupt of a device is pinned to the least loaded
+# CPU, where the load is the NET_RX/NET_TX softirq activity measured since
+# the previous run plus the queues already placed on that CPU. RPS of each
+# RX queue spreads to the other CPUs of the cluster servicing its interrupt,
+# so packets stay within a shared cache. With several TX queues every CPU
+# gets one queue for XPS.
+#
+# Only the given devices are (re)balanced, the placement of all other
+# devices is kept in $STATE_DIR.
+#
+# usage: packet-steering.sh [--dry-run] [--remove] <device>...|--all
+#
+
+STATE_DIR=/var/run/packet-steering
+
+DRY_RUN=
+REMOVE=
+ALL=
+
+while [ -n "$1" ]; do
+	case "$1" in
+		--dry-run) DRY_RUN=1;;
+		--remove) REMOVE=1;;
+		--all) ALL=1;;
+		-*)
+			echo "Usage: $0 [--dry-run] [--remove] <device>...|--all" >&2
+			exit 1
+		;;
+		*) break;;
+	esac
+	shift
+done
+
+[ -n "$ALL" ] && set -- $(ls /sys/class/net)
+[ -n "$1" ] || exit 0
+
+# expand a cpu list like "0-2,4" to "0 1 2 4"
+cpu_list() {
+	local IFS=,
+	local range
+
+	for range in $1; do
+		case "$range" in
+			*-*) seq "${range%-*}" "${range#*-}";;
+			*) echo "$range";;
+		esac
+	done
+}
+
+cpu_mask() {
+	local mask=0
+	local cpu
+
+	for cpu in "$@"; do
+		mask=$((mask | (1 << cpu)))
+	done
+	printf %x "$mask"
+}
+
+set_val() {
+	local file="$1"
+	local val="$2"
+
+	[ -n "$DRY_RUN$DEBUG" ] && echo "$file = $val"
+	[ -n "$DRY_RUN" ] || echo "$val" > "$file" 2>/dev/null
+}
+
+CPUS="$(cpu_list "$(cat /sys/devices/system/cpu/online 2>/dev/null || echo 0)")"
+NPROCS="$(echo $CPUS | wc -w)"
+[ "$NPROCS" -gt 1 ] || exit 0
+
+# CPUs sharing a cluster (and usually a cache) with the given CPU
+cpu_cluster() {
+	local topo="/sys/devices/system/cpu/cpu$1/topology"
+	local key="$(cat "$topo/physical_package_id" "$topo/cluster_id" 2>/dev/null)"
+	local cpu
+
+	for cpu in $CPUS; do
+		topo="/sys/devices/system/cpu/cpu$cpu/topology"
+		[ "$(cat "$topo/physical_package_id" "$topo/cluster_id" 2>/dev/null)" = "$key" ] && echo "$cpu"
+	done
+}
+
+# NET_RX + NET_TX softirqs per CPU since the last call, in percent of all
+softirq_load() {
+	local prev="$STATE_DIR/softirqs"
+
+	# a dry run only reads the counters
+	awk -v cpus="$CPUS" -v prev="$prev" -v save="${DRY_RUN:+-}" '
+		BEGIN {
+			n = split(cpus, cpu, " ")
+			while ((getline line < prev) > 0) {
+				split(line, f, " ")
+				last[f[1]] = f[2]
+			}
+		}
+		NR == 1 {
+			for (i = 1; i <= NF; i++)
+				col[substr($i, 4)] = i + 1
+		}
+		$1 == "NET_RX:" || $1 == "NET_TX:" {
+			for (i = 1; i <= n; i++)
+				cur[cpu[i]] += $(col[cpu[i]])
+		}
+		END {
+			for (i = 1; i <= n; i++) {
+				delta[cpu[i]] = cur[cpu[i]] - last[cpu[i]]
+				if (delta[cpu[i]] < 0)
+					delta[cpu[i]] = cur[cpu[i]]
+				total += delta[cpu[i]]
+			}
+			for (i = 1; i <= n; i++) {
+				if (save == "")
+					print cpu[i], cur[cpu[i]] > prev ".new"
+				print cpu[i], total ? int(delta[cpu[i]] * 100 / total) : 0
+			}
+		}
+	' /proc/softirqs
+	[ -n "$DRY_RUN" ] || mv "$prev.new" "$prev"
+}
+
+# queues currently placed on a CPU, excluding the devices being rebalanced
+cpu_queues() {
+	local cpu="$1"; shift
+	local count=0
+	local file dev n
+
+	for file in "$STATE_DIR"/dev.*; do
+		[ -f "$file" ] || continue
+		for dev in "$@"; do
+			[ "$file" = "$STATE_DIR/dev.$dev" ] && continue 2
+		done
+		for n in $(cat "$file"); do
+			[ "$n" = "$cpu" ] && count=$((count + 1))
+		done
+	done
+	echo "$count"
+}
+
+# least loaded CPU to $CPU, each placed queue weighs as much as an equal
+# share of the softirq load
+pick_cpu() {
+	local best= best_score= load score
+
+	for CPU in $CPUS; do
+		eval "load=\${LOAD_$CPU:-0}"
+		eval "score=\$((load + \${QUEUES_$CPU:-0} * 100 / NPROCS))"
+		[ -z "$best" ] || [ "$score" -lt "$best_score" ] && {
+			best="$CPU"
+			best_score="$score"
+		}
+	done
+
+	eval "QUEUES_$best=\$((\${QUEUES_$best:-0} + 1))"
+	CPU="$best"
+}
+
+irq_cpu() {
+	local list
+
+	list="$(cat "/proc/irq/$1/effective_affinity_list" 2>/dev/null || cat "/proc/irq/$1/smp_affinity_list" 2>/dev/null)"
+	list="$(cpu_list "$list")"
+	echo "${list%%[!0-9]*}"
+}
+
+# interrupts of a device, named after the netdev or the bus device
+dev_irqs() {
+	awk -v dev="$1" -v bus="$2" '
+		$1 ~ /^[0-9]+:$/ {
+			name = $NF
+			if (name == dev || name == bus || index(name, dev "-") == 1 ||
+			    (bus != "" && index(name, bus "-") == 1))
+				print substr($1, 1, length($1) - 1)
+		}
+	' /proc/interrupts
+}
+
+steer_dev() {
+	local dev="$1"
+	local sysfs="/sys/class/net/$dev"
+	local bus subsys irqs irq cpu cpus q n ntx mask flows
+
+	# ignore virtual interfaces
+	[ -n "$(ls "$sysfs/" | grep '^lower_')" ] && return
+	[ -d "$sysfs/device" ] || return
+
+	bus="$(basename "$(readlink "$sysfs/device")")"
+	subsys="$(basename "$(readlink "$sysfs/device/subsystem")")"
+
+	# dsa slave ports share the interrupts of the conduit device
+	[ "$subsys" = "mdio_bus" ] || irqs="$(dev_irqs "$dev" "$bus")"
+
+	cpus=
+	for irq in $irqs; do
+		pick_cpu
+		cpu="$CPU"
+		[ -n "$DRY_RUN$DEBUG" ] && echo "irq $irq ($dev) -> cpu $cpu"
+		set_val "/proc/irq/$irq/smp_affinity" "$(cpu_mask "$cpu")"
+		[ -n "$DRY_RUN" ] || cpu="$(irq_cpu "$irq")"
+		cpus="$cpus $cpu"
+	done
+	[ -n "$DRY_RUN" ] || echo $cpus > "$STATE_DIR/dev.$dev"
+
+	ntx="$(ls -d "$sysfs"/queues/tx-* 2>/dev/null | wc -l)"
+	[ "$ntx" -gt 1 ] && {
+		n=0
+		for q in "$sysfs"/queues/tx-*; do
+			mask=
+			for cpu in $CPUS; do
+				[ $((cpu % ntx)) = "$n" ] && mask="$mask $cpu"
+			done
+			set_val "$q/xps_cpus" "$(cpu_mask $mask)"
+			n=$((n + 1))
+		done
+	}
+
+	# ignore dsa slave ports for RPS
+	[ "$subsys" = "mdio_bus" ] && return
+
+	flows=
+	[ -n "$FLOWS" ] && flows=$((FLOWS / $(ls -d "$sysfs"/queues/rx-* | wc -l)))
+
+	set -- $cpus
+	for q in "$sysfs"/queues/rx-*; do
+		# without a known interrupt, spread over all CPUs
+		cpu="${1:--1}"
+		[ "$#" -gt 1 ] && shift
+
+		mask=
+		for n in $(cpu_cluster "$cpu"); do
+			[ "$n" = "$cpu" ] || mask="$mask $n"
+		done
+		[ -n "$mask" ] || for n in $CPUS; do
+			[ "$n" = "$cpu" ] || mask="$mask $n"
+		done
+
+		set_val "$q/rps_cpus" "$(cpu_mask $mask)"
+		[ -n "$flows" ] && set_val "$q/rps_flow_cnt" "$flows"
+	done
+}
+
+if [ -z "$DRY_RUN" ]; then
+	exec 512>/var/lock/smp_tune.lock
+	flock 512 || exit 1
+
+	mkdir -p "$STATE_DIR"
+fi
+
+if [ -n "$REMOVE" ]; then
+	[ -n "$DRY_RUN" ] && exit 0
+	for dev in "$@"; do
+		rm -f "$STATE_DIR/dev.$dev"
+	done
+	exit 0
+fi
+
+# leave RFS alone unless configured
+FLOWS="$(uci -q get "network.@globals[0].steering_flows")"
+[ -n "$FLOWS" ] && set_val /proc/sys/net/core/rps_sock_flow_entries "$FLOWS"
+
+while read cpu load; do
+	eval "LOAD_$cpu=$load"
+	eval "QUEUES_$cpu=$(cpu_queues "$cpu" "$@")"
+done <<EOF
+$(softirq_load)
+EOF
+
+for dev in "$@"; do
+	[ -d "/sys/class/net/$dev" ] && steer_dev "$dev"
+done
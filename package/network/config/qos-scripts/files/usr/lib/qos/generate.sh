@@ -119,7 +119,7 @@ parse_matching_rule() {
 			;;
 			*:comment)
 				add_insmod xt_comment
-				append "$var" "-m comment --comment '$value'"
+				append "$var" "-m comment --comment \"$value\""
 			;;
 			*:tos)
 				add_insmod xt_dscp
@@ -327,9 +327,9 @@ start_interface() {
 		append ${prefix}q "$(tcrules)" "$N"
 		export dev_${dir}="ip link add ${dev} type ifb >&- 2>&-
 ip link set $dev up >&- 2>&-
-tc qdisc del dev $dev root >&- 2>&-
-tc qdisc add dev $dev root handle 1: hfsc default ${class_default}0
-tc class add dev $dev parent 1: classid 1:1 hfsc sc rate ${rate}kbit ul rate ${rate}kbit"
+tc qdisc del dev $dev root >&- 2>&-"
+		export tc_${dir}="qdisc add dev $dev root handle 1: hfsc default ${class_default}0
+class add dev $dev parent 1: classid 1:1 hfsc sc rate ${rate}kbit ul rate ${rate}kbit"
 	done
 	[ -n "$download" ] && {
 		add_insmod cls_u32
@@ -339,27 +339,30 @@ tc class add dev $dev parent 1: classid 1:1 hfsc sc rate ${rate}kbit ul rate ${r
 		add_insmod sch_ingress
 	}
 	if [ -n "$halfduplex" ]; then
-		export dev_up="tc qdisc del dev $device root >&- 2>&-
-tc qdisc add dev $device root handle 1: hfsc
-tc filter add dev $device parent 1: prio 10 u32 match u32 0 0 flowid 1:1 action mirred egress redirect dev ifb$ifbdev"
+		export dev_up="tc qdisc del dev $device root >&- 2>&-"
+		export tc_up="qdisc add dev $device root handle 1: hfsc
+filter add dev $device parent 1: prio 10 u32 match u32 0 0 flowid 1:1 action mirred egress redirect dev ifb$ifbdev"
 	elif [ -n "$download" ]; then
-		append dev_${dir} "tc qdisc del dev $device ingress >&- 2>&-
-tc qdisc add dev $device ingress
-tc filter add dev $device parent ffff: prio 1 u32 match u32 0 0 flowid 1:1 action connmark action mirred egress redirect dev ifb$ifbdev" "$N"
+		append dev_${dir} "tc qdisc del dev $device ingress >&- 2>&-" "$N"
+		append tc_${dir} "qdisc add dev $device ingress
+filter add dev $device parent ffff: prio 1 u32 match u32 0 0 flowid 1:1 action connmark action mirred egress redirect dev ifb$ifbdev" "$N"
 	fi
 	add_insmod cls_fw
 	add_insmod sch_hfsc
 
+	# all qdiscs, classes and filters are added by a single tc process,
+	# errors are skipped like with separate tc calls
 	cat <<EOF
 ${INSMOD:+$INSMOD$N}${dev_up:+$dev_up
-$clsq
 }${ifbdev:+$dev_down
+}tc -force -batch - <<'EOT'
+${tc_up:+$tc_up
+$clsq
+}${ifbdev:+$tc_down
 $d_clsq
-$d_clsl
-$d_clsf
-}
+}EOT
 EOF
-	unset INSMOD clsq clsf clsl d_clsq d_clsl d_clsf dev_up dev_down
+	unset INSMOD clsq d_clsq dev_up dev_down tc_up tc_down
 }
 
 start_interfaces() {
@@ -369,13 +372,35 @@ start_interfaces() {
 	done
 }
 
+# Address family of a rule matching on hosts, empty if it applies to both
+rule_family() {
+	local rule="$1"
+	local option value
+
+	for option in srchost dsthost; do
+		config_get value "$rule" "$option"
+		case "$value" in
+			*:*) echo ip6tables; return;;
+			?*) echo iptables; return;;
+		esac
+	done
+}
+
 add_rules() {
 	local var="$1"
 	local rules="$2"
 	local prefix="$3"
+	local command="$4"
+	local family
 
 	for rule in $rules; do
 		unset iptrule
+
+		# a rule failing in the other family would abort the whole
+		# iptables-restore transaction
+		family="$(rule_family "$rule")"
+		[ -n "$family" -a "$family" != "$command" ] && continue
+
 		config_get target "$rule" target
 		config_get target "$target" classnr
 		config_get options "$rule" options
@@ -395,105 +420,102 @@ add_rules() {
 	done
 }
 
+# Append the mangle table rules of a class group for one of $iptables to
+# $fwrules, in iptables-restore format
 start_cg() {
 	local cg="$1"
+	local command="$2"
 	local iptrules
 	local pktrules
-	local sizerules
+	local up
 	enum_classes "$cg"
-	for command in $iptables; do
-		add_rules iptrules "$ctrules" "$command -w -t mangle -A qos_${cg}_ct"
-	done
+	add_rules iptrules "$ctrules" "-A qos_${cg}_ct" "$command"
 	config_get classes "$cg" classes
 	for class in $classes; do
 		config_get mark "$class" classnr
 		config_get maxsize "$class" maxsize
 		[ -z "$maxsize" -o -z "$mark" ] || {
 			add_insmod xt_length
-			for command in $iptables; do
-				append pktrules "$command -w -t mangle -A qos_${cg} -m mark --mark $mark/0x0f -m length --length $maxsize: -j MARK --set-mark 0/0xff" "$N"
-			done
+			append pktrules "-A qos_${cg} -m mark --mark $mark/0x0f -m length --length $maxsize: -j MARK --set-mark 0/0xff" "$N"
 		}
 	done
-	for command in $iptables; do
-		add_rules pktrules "$rules" "$command -w -t mangle -A qos_${cg}"
-	done
+	add_rules pktrules "$rules" "-A qos_${cg}" "$command"
 	for iface in $INTERFACES; do
-		config_get classgroup "$iface" classgroup
 		config_get device "$iface" device
-		config_get ifbdev "$iface" ifbdev
-		config_get upload "$iface" upload
-		config_get download "$iface" download
-		config_get halfduplex "$iface" halfduplex
-		download="${download:-${halfduplex:+$upload}}"
-		for command in $iptables; do
-			append up "$command -w -t mangle -A OUTPUT -o $device -j qos_${cg}" "$N"
-			append up "$command -w -t mangle -A FORWARD -o $device -j qos_${cg}" "$N"
-		done
+		append up "-A OUTPUT -o $device -j qos_${cg}" "$N"
+		append up "-A FORWARD -o $device -j qos_${cg}" "$N"
 	done
-	cat <<EOF
-$INSMOD
-EOF
 
-for command in $iptables; do
-	cat <<EOF
-	$command -w -t mangle -N qos_${cg}
-	$command -w -t mangle -N qos_${cg}_ct
-EOF
-done
-cat <<EOF
-	${iptrules:+${iptrules}${N}}
-EOF
-for command in $iptables; do
-	cat <<EOF
-	$command -w -t mangle -A qos_${cg}_ct -j CONNMARK --save-mark --mask 0xff
-	$command -w -t mangle -A qos_${cg} -j CONNMARK --restore-mark --mask 0x0f
-	$command -w -t mangle -A qos_${cg} -m mark --mark 0/0x0f -j qos_${cg}_ct
-EOF
-done
-cat <<EOF
-$pktrules
-EOF
-for command in $iptables; do
+	append fwrules "-N qos_${cg}
+-N qos_${cg}_ct
+${iptrules:+$iptrules$N}-A qos_${cg}_ct -j CONNMARK --save-mark --mask 0xff
+-A qos_${cg} -j CONNMARK --restore-mark --mask 0x0f
+-A qos_${cg} -m mark --mark 0/0x0f -j qos_${cg}_ct
+${pktrules:+$pktrules$N}-A qos_${cg} -j CONNMARK --save-mark --mask 0xff
+$up" "$N"
+}
+
+# Print a command applying mangle table rules in a single transaction
+restore_rules() {
+	local command="$1"
+	local rules="$2"
+
+	[ -n "$rules" ] || return 0
 	cat <<EOF
-	$command -w -t mangle -A qos_${cg} -j CONNMARK --save-mark --mask 0xff
+$command-restore -w --noflush <<'EOT'
+*mangle
+$rules
+COMMIT
+EOT
 EOF
-done
-cat <<EOF
-$up$N${down:+${down}$N}
-EOF
-	unset INSMOD
 }
 
 start_firewall() {
+	local fwrules
+
 	add_insmod xt_multiport
 	add_insmod xt_connmark
-	stop_firewall
-	for group in $CG; do
-		start_cg $group
+
+	# the old chains are replaced in the same transaction, so traffic
+	# is never left unclassified in between
+	for command in $iptables; do
+		fwrules="$(stop_rules "$command")"
+		for group in $CG; do
+			start_cg "$group" "$command"
+		done
+		append fw "$(restore_rules "$command" "$fwrules")" "$N"
 	done
+
+	cat <<EOF
+$INSMOD
+$fw
+EOF
+	unset INSMOD fw
 }
 
-stop_firewall() {
-	# Builds up a list of iptables commands to flush the qos_* chains,
-	# remove rules referring to them, then delete them
+# Rules to flush the qos_* chains, remove rules referring to them, then
+# delete them, in iptables-restore format
+stop_rules() {
+	local command="$1"
 
 	# Print rules in the mangle table, like iptables-save
+	$command -w -t mangle -S |
+		# Find rules for the qos_* chains
+		grep -E '(^-N qos_|-j qos_)' |
+		# Exclude rules in qos_* chains (inter-qos_* refs)
+		grep -v '^-A qos_' |
+		# Replace -N with -X and hold, with -F and print
+		# Replace -A with -D
+		# Print held lines at the end (note leading newline)
+		sed -e '/^-N/{s/^-N/-X/;H;s/^-X/-F/}' \
+			-e 's/^-A/-D/' \
+			-e '${p;g}' |
+		sed -e '/^$/d'
+}
+
+stop_firewall() {
 	for command in $iptables; do
-		$command -w -t mangle -S |
-			# Find rules for the qos_* chains
-			grep -E '(^-N qos_|-j qos_)' |
-			# Exclude rules in qos_* chains (inter-qos_* refs)
-			grep -v '^-A qos_' |
-			# Replace -N with -X and hold, with -F and print
-			# Replace -A with -D
-			# Print held lines at the end (note leading newline)
-			sed -e '/^-N/{s/^-N/-X/;H;s/^-X/-F/}' \
-				-e 's/^-A/-D/' \
-				-e '${p;g}' |
-			# Make into proper iptables calls
-			# Note: awkward in previous call due to hold space usage
-			sed -n -e "s/^./${command} -w -t mangle &/p"
+		restore_rules "$command" "$(stop_rules "$command")"
 	done
 }
 
@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <stdint.h>
 #include <getopt.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <uci.h>
@@ -42,6 +43,7 @@ enum {
 	CMD_HELP,
 	CMD_SHOW,
 	CMD_PORTMAP,
+	CMD_BENCH,
 };
 
 static void
@@ -142,67 +144,157 @@ print_attr_val(const struct switch_attr *attr, const struct switch_val *val)
 	}
 }
 
+static int
+count_attrs(const struct switch_attr *attr)
+{
+	int n = 0;
+
+	for (; attr; attr = attr->next)
+		n++;
+
+	return n;
+}
+
+/* queue get requests for all attributes of a group, results are valid after commit */
+static struct switch_val *
+queue_attrs(struct swlib_batch *b, struct switch_attr *attr, int port_vlan)
+{
+	struct switch_val *vals, *val;
+
+	vals = calloc(count_attrs(attr) + 1, sizeof(*vals));
+	if (!vals)
+		return NULL;
+
+	for (val = vals; attr; attr = attr->next, val++) {
+		val->port_vlan = port_vlan;
+		if (attr->type != SWITCH_TYPE_NOVAL)
+			swlib_batch_get(b, attr, val);
+	}
+
+	return vals;
+}
+
 static void
-show_attrs(struct switch_dev *dev, struct switch_attr *attr, struct switch_val *val)
+free_val(const struct switch_attr *attr, struct switch_val *val)
 {
-	while (attr) {
+	if (val->err < 0)
+		return;
+
+	switch (attr->type) {
+	case SWITCH_TYPE_STRING:
+		free(val->value.s);
+		break;
+	case SWITCH_TYPE_PORTS:
+		free(val->value.ports);
+		break;
+	case SWITCH_TYPE_LINK:
+		free(val->value.link);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+show_attrs(struct switch_attr *attr, struct switch_val *vals)
+{
+	struct switch_val *val = vals;
+
+	if (!vals)
+		return;
+
+	for (; attr; attr = attr->next, val++) {
 		if (attr->type != SWITCH_TYPE_NOVAL) {
 			printf("\t%s: ", attr->name);
-			if (swlib_get_attr(dev, attr, val) < 0)
+			if (val->err < 0)
 				printf("???");
 			else
 				print_attr_val(attr, val);
 			putchar('\n');
+			free_val(attr, val);
 		}
-		attr = attr->next;
 	}
+	free(vals);
 }
 
 static void
-show_global(struct switch_dev *dev)
+show_group(struct switch_dev *dev, struct switch_attr *attr, int port_vlan)
 {
-	struct switch_val val;
-
-	printf("Global attributes:\n");
-	show_attrs(dev, dev->ops, &val);
-}
+	struct swlib_batch *b;
+	struct switch_val *vals;
 
-static void
-show_port(struct switch_dev *dev, int port)
-{
-	struct switch_val val;
+	b = swlib_batch_new(dev);
+	if (!b)
+		return;
 
-	printf("Port %d:\n", port);
-	val.port_vlan = port;
-	show_attrs(dev, dev->port_ops, &val);
+	vals = queue_attrs(b, attr, port_vlan);
+	swlib_batch_commit(b);
+	swlib_batch_free(b);
+	show_attrs(attr, vals);
 }
 
 static void
-show_vlan(struct switch_dev *dev, int vlan, bool all)
+show_all(struct switch_dev *dev)
 {
-	struct switch_val val;
-	struct switch_attr *attr;
+	struct switch_attr *vlan_ports;
+	struct switch_val *global, **ports, **vlans, *members;
+	struct swlib_batch *b;
+	int i;
 
-	val.port_vlan = vlan;
+	b = swlib_batch_new(dev);
+	ports = calloc(dev->ports, sizeof(*ports));
+	vlans = calloc(dev->vlans, sizeof(*vlans));
+	members = calloc(dev->vlans, sizeof(*members));
+	if (!b || !ports || !vlans || !members)
+		goto out;
 
-	if (all) {
-		attr = swlib_lookup_attr(dev, SWLIB_ATTR_GROUP_VLAN, "ports");
-		if (swlib_get_attr(dev, attr, &val) < 0)
-			return;
+	/* fetch everything except the attributes of unused vlans in two passes */
+	global = queue_attrs(b, dev->ops, 0);
+	for (i = 0; i < dev->ports; i++)
+		ports[i] = queue_attrs(b, dev->port_ops, i);
 
-		if (!val.len)
-			return;
+	vlan_ports = swlib_lookup_attr(dev, SWLIB_ATTR_GROUP_VLAN, "ports");
+	for (i = 0; vlan_ports && i < dev->vlans; i++) {
+		members[i].port_vlan = i;
+		swlib_batch_get(b, vlan_ports, &members[i]);
+	}
+	swlib_batch_commit(b);
+
+	for (i = 0; vlan_ports && i < dev->vlans; i++) {
+		if (members[i].err < 0)
+			continue;
+		if (members[i].len)
+			vlans[i] = queue_attrs(b, dev->vlan_ops, i);
+		free_val(vlan_ports, &members[i]);
+	}
+	swlib_batch_commit(b);
+
+	printf("Global attributes:\n");
+	show_attrs(dev->ops, global);
+	for (i = 0; i < dev->ports; i++) {
+		printf("Port %d:\n", i);
+		show_attrs(dev->port_ops, ports[i]);
+	}
+	for (i = 0; i < dev->vlans; i++) {
+		if (!vlans[i])
+			continue;
+		printf("VLAN %d:\n", i);
+		show_attrs(dev->vlan_ops, vlans[i]);
 	}
 
-	printf("VLAN %d:\n", vlan);
-	show_attrs(dev, dev->vlan_ops, &val);
+out:
+	free(members);
+	free(vlans);
+	free(ports);
+	if (b)
+		swlib_batch_free(b);
 }
 
 static void
 print_usage(void)
 {
 	printf("swconfig list\n");
-	printf("swconfig dev <dev> [port <port>|vlan <vlan>] (help|set <key> <value>|get <key>|load <config>|show)\n");
+	printf("swconfig dev <dev> [port <port>|vlan <vlan>] (help|set <key> <value>|get <key>|load <config>|bench <config>|show)\n");
 	exit(1);
 }
 
@@ -232,6 +324,59 @@ out:
 	exit(ret);
 }
 
+static double
+bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* apply a config with single and batched requests and compare the cost */
+static void
+swconfig_bench_uci(struct switch_dev *dev, const char *name)
+{
+	static const char * const modes[] = { "single", "batched" };
+	struct uci_context *ctx;
+	struct uci_package *p = NULL;
+	unsigned int calls;
+	double start;
+	int ret = -1;
+	int i;
+
+	ctx = uci_alloc_context();
+	if (!ctx)
+		return;
+
+	uci_load(ctx, name, &p);
+	if (!p) {
+		uci_perror(ctx, "Failed to load config file: ");
+		goto out;
+	}
+
+	for (i = 0; i < 2; i++) {
+		/* -1 forces single requests, 0 probes for batch support */
+		dev->batch = i ? 0 : -1;
+
+		calls = swlib_get_round_trips();
+		start = bench_time();
+		ret = swlib_apply_from_uci(dev, p);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to apply configuration for switch '%s'\n", dev->dev_name);
+			goto out;
+		}
+
+		printf("%s: %u round trips, %.3f ms%s\n", modes[i],
+		       swlib_get_round_trips() - calls, bench_time() - start,
+		       dev->batch < 0 && i ? " (not supported by the kernel)" : "");
+	}
+
+out:
+	uci_free_context(ctx);
+	exit(ret);
+}
+
 int main(int argc, char **argv)
 {
 	int retval = 0;
@@ -285,6 +430,11 @@ int main(int argc, char **argv)
 				print_usage();
 			cmd = CMD_LOAD;
 			ckey = argv[++i];
+		} else if (!strcmp(arg, "bench") && i+1 < argc) {
+			if ((cport >= 0) || (cvlan >= 0))
+				print_usage();
+			cmd = CMD_BENCH;
+			ckey = argv[++i];
 		} else if (!strcmp(arg, "portmap")) {
 			if (i + 1 < argc)
 				csegment = argv[++i];
@@ -359,6 +509,9 @@ int main(int argc, char **argv)
 	case CMD_LOAD:
 		swconfig_load_uci(dev, ckey);
 		break;
+	case CMD_BENCH:
+		swconfig_bench_uci(dev, ckey);
+		break;
 	case CMD_HELP:
 		list_attributes(dev);
 		break;
@@ -366,17 +519,14 @@ int main(int argc, char **argv)
 		swlib_print_portmap(dev, csegment);
 		break;
 	case CMD_SHOW:
-		if (cport >= 0 || cvlan >= 0) {
-			if (cport >= 0)
-				show_port(dev, cport);
-			else
-				show_vlan(dev, cvlan, false);
+		if (cport >= 0) {
+			printf("Port %d:\n", cport);
+			show_group(dev, dev->port_ops, cport);
+		} else if (cvlan >= 0) {
+			printf("VLAN %d:\n", cvlan);
+			show_group(dev, dev->vlan_ops, cvlan);
 		} else {
-			show_global(dev);
-			for (i=0; i < dev->ports; i++)
-				show_port(dev, i);
-			for (i=0; i < dev->vlans; i++)
-				show_vlan(dev, i, true);
+			show_all(dev);
 		}
 		break;
 	}
@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -41,6 +42,23 @@ static struct nl_cache *cache;
 static struct genl_family *family;
 static struct nlattr *tb[SWITCH_ATTR_MAX + 1];
 static int refcount = 0;
+static unsigned int round_trips;
+
+/* limits for a single SWITCH_CMD_BATCH request and its replies */
+#define SWLIB_BATCH_MSG_SIZE	32768
+#define SWLIB_BATCH_REPLY_SIZE	16384
+#define SWLIB_BATCH_MAX_OPS	1024
+
+struct swlib_batch {
+	struct switch_dev *dev;
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	int reply_size;
+	int n_ops;
+	int err;
+	/* destination of each queued get request, NULL for set requests */
+	struct switch_val *vals[SWLIB_BATCH_MAX_OPS];
+};
 
 static struct nla_policy port_policy[SWITCH_ATTR_MAX] = {
 	[SWITCH_PORT_ID] = { .type = NLA_U32 },
@@ -84,32 +102,14 @@ wait_handler(struct nl_msg *msg, void *arg)
 	return NL_STOP;
 }
 
-/* helper function for performing netlink requests */
+/* send a request and process all replies up to the final ack or dump end */
 static int
-swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
-		int (*data)(struct nl_msg *, void *), void *arg)
+swlib_transact(struct nl_msg *msg, int (*call)(struct nl_msg *, void *),
+		bool dump, void *arg)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb = NULL;
+	struct nl_cb *cb;
 	int finished;
-	int flags = 0;
-	int err = 0;
-
-	msg = nlmsg_alloc();
-	if (!msg) {
-		fprintf(stderr, "Out of memory!\n");
-		exit(1);
-	}
-
-	if (!data)
-		flags |= NLM_F_DUMP;
-
-	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, genl_family_get_id(family), 0, flags, cmd, 0);
-	if (data) {
-		err = data(msg, arg);
-		if (err < 0)
-			goto nla_put_failure;
-	}
+	int err;
 
 	cb = nl_cb_alloc(NL_CB_CUSTOM);
 	if (!cb) {
@@ -117,6 +117,7 @@ swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
 		exit(1);
 	}
 
+	round_trips++;
 	err = nl_send_auto_complete(handle, msg);
 	if (err < 0) {
 		fprintf(stderr, "nl_send_auto_complete failed: %d\n", err);
@@ -128,7 +129,7 @@ swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
 	if (call)
 		nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, call, arg);
 
-	if (data)
+	if (!dump)
 		nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, wait_handler, &finished);
 	else
 		nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, wait_handler, &finished);
@@ -142,13 +143,48 @@ swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
 		err = nl_wait_for_ack(handle);
 
 out:
-	if (cb)
-		nl_cb_put(cb);
+	nl_cb_put(cb);
+	return err;
+}
+
+/* helper function for performing netlink requests */
+static int
+swlib_call(int cmd, int (*call)(struct nl_msg *, void *),
+		int (*data)(struct nl_msg *, void *), void *arg)
+{
+	struct nl_msg *msg;
+	int flags = 0;
+	int err = 0;
+
+	msg = nlmsg_alloc();
+	if (!msg) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(1);
+	}
+
+	if (!data)
+		flags |= NLM_F_DUMP;
+
+	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, genl_family_get_id(family), 0, flags, cmd, 0);
+	if (data) {
+		err = data(msg, arg);
+		if (err < 0)
+			goto nla_put_failure;
+	}
+
+	err = swlib_transact(msg, call, !data, arg);
+
 nla_put_failure:
 	nlmsg_free(msg);
 	return err;
 }
 
+unsigned int
+swlib_get_round_trips(void)
+{
+	return round_trips;
+}
+
 static int
 send_attr(struct nl_msg *msg, void *arg)
 {
@@ -243,6 +279,21 @@ out:
 	return err;
 }
 
+static void
+store_val_attrs(struct nl_msg *msg, struct nlattr **tb, struct switch_val *val)
+{
+	if (tb[SWITCH_ATTR_OP_VALUE_INT])
+		val->value.i = nla_get_u32(tb[SWITCH_ATTR_OP_VALUE_INT]);
+	else if (tb[SWITCH_ATTR_OP_VALUE_STR])
+		val->value.s = strdup(nla_get_string(tb[SWITCH_ATTR_OP_VALUE_STR]));
+	else if (tb[SWITCH_ATTR_OP_VALUE_PORTS])
+		val->err = store_port_val(msg, tb[SWITCH_ATTR_OP_VALUE_PORTS], val);
+	else if (tb[SWITCH_ATTR_OP_VALUE_LINK])
+		val->err = store_link_val(msg, tb[SWITCH_ATTR_OP_VALUE_LINK], val);
+
+	val->err = 0;
+}
+
 static int
 store_val(struct nl_msg *msg, void *arg)
 {
@@ -257,46 +308,48 @@ store_val(struct nl_msg *msg, void *arg)
 		goto error;
 	}
 
-	if (tb[SWITCH_ATTR_OP_VALUE_INT])
-		val->value.i = nla_get_u32(tb[SWITCH_ATTR_OP_VALUE_INT]);
-	else if (tb[SWITCH_ATTR_OP_VALUE_STR])
-		val->value.s = strdup(nla_get_string(tb[SWITCH_ATTR_OP_VALUE_STR]));
-	else if (tb[SWITCH_ATTR_OP_VALUE_PORTS])
-		val->err = store_port_val(msg, tb[SWITCH_ATTR_OP_VALUE_PORTS], val);
-	else if (tb[SWITCH_ATTR_OP_VALUE_LINK])
-		val->err = store_link_val(msg, tb[SWITCH_ATTR_OP_VALUE_LINK], val);
-
-	val->err = 0;
+	store_val_attrs(msg, tb, val);
 	return 0;
 
 error:
 	return NL_SKIP;
 }
 
-int
-swlib_get_attr(struct switch_dev *dev, struct switch_attr *attr, struct switch_val *val)
+static int
+swlib_attr_cmd(struct switch_attr *attr, bool set)
 {
-	int cmd;
-	int err;
-
 	switch(attr->atype) {
 	case SWLIB_ATTR_GROUP_GLOBAL:
-		cmd = SWITCH_CMD_GET_GLOBAL;
-		break;
+		return set ? SWITCH_CMD_SET_GLOBAL : SWITCH_CMD_GET_GLOBAL;
 	case SWLIB_ATTR_GROUP_PORT:
-		cmd = SWITCH_CMD_GET_PORT;
-		break;
+		return set ? SWITCH_CMD_SET_PORT : SWITCH_CMD_GET_PORT;
 	case SWLIB_ATTR_GROUP_VLAN:
-		cmd = SWITCH_CMD_GET_VLAN;
-		break;
+		return set ? SWITCH_CMD_SET_VLAN : SWITCH_CMD_GET_VLAN;
 	default:
 		return -EINVAL;
 	}
+}
 
+static void
+swlib_init_get(struct switch_attr *attr, struct switch_val *val)
+{
 	memset(&val->value, 0, sizeof(val->value));
 	val->len = 0;
 	val->attr = attr;
 	val->err = -EINVAL;
+}
+
+int
+swlib_get_attr(struct switch_dev *dev, struct switch_attr *attr, struct switch_val *val)
+{
+	int cmd;
+	int err;
+
+	cmd = swlib_attr_cmd(attr, false);
+	if (cmd < 0)
+		return cmd;
+
+	swlib_init_get(attr, val);
 	err = swlib_call(cmd, store_val, send_attr, val);
 	if (!err)
 		err = val->err;
@@ -404,19 +457,9 @@ swlib_set_attr(struct switch_dev *dev, struct switch_attr *attr, struct switch_v
 {
 	int cmd;
 
-	switch(attr->atype) {
-	case SWLIB_ATTR_GROUP_GLOBAL:
-		cmd = SWITCH_CMD_SET_GLOBAL;
-		break;
-	case SWLIB_ATTR_GROUP_PORT:
-		cmd = SWITCH_CMD_SET_PORT;
-		break;
-	case SWLIB_ATTR_GROUP_VLAN:
-		cmd = SWITCH_CMD_SET_VLAN;
-		break;
-	default:
-		return -EINVAL;
-	}
+	cmd = swlib_attr_cmd(attr, true);
+	if (cmd < 0)
+		return cmd;
 
 	val->attr = attr;
 	return swlib_call(cmd, NULL, send_attr_val, val);
@@ -429,27 +472,31 @@ enum {
 	CMD_SPEED,
 };
 
-int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int port_vlan, const char *str)
+/*
+ * convert str into a value for attribute a, port lists are stored in ports
+ * returns 1 if there is nothing to set
+ */
+static int
+swlib_parse_attr_string(struct switch_dev *dev, struct switch_attr *a,
+		int port_vlan, const char *str, struct switch_val *val,
+		struct switch_port *ports)
 {
-	struct switch_port *ports;
 	struct switch_port_link *link;
-	struct switch_val val;
 	char *ptr;
 	int cmd = CMD_NONE;
 
-	memset(&val, 0, sizeof(val));
-	val.port_vlan = port_vlan;
+	memset(val, 0, sizeof(*val));
+	val->port_vlan = port_vlan;
 	switch(a->type) {
 	case SWITCH_TYPE_INT:
-		val.value.i = atoi(str);
+		val->value.i = atoi(str);
 		break;
 	case SWITCH_TYPE_STRING:
-		val.value.s = (char *)str;
+		val->value.s = (char *)str;
 		break;
 	case SWITCH_TYPE_PORTS:
-		ports = alloca(sizeof(struct switch_port) * dev->ports);
 		memset(ports, 0, sizeof(struct switch_port) * dev->ports);
-		val.len = 0;
+		val->len = 0;
 		ptr = (char *)str;
 		while(ptr && *ptr)
 		{
@@ -462,14 +509,14 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int por
 			if (!isdigit(*ptr))
 				return -1;
 
-			if (val.len >= dev->ports)
+			if (val->len >= dev->ports)
 				return -1;
 
-			ports[val.len].flags = 0;
-			ports[val.len].id = strtoul(ptr, &ptr, 10);
+			ports[val->len].flags = 0;
+			ports[val->len].id = strtoul(ptr, &ptr, 10);
 			while(*ptr && !isspace(*ptr)) {
 				if (*ptr == 't')
-					ports[val.len].flags |= SWLIB_PORT_FLAG_TAGGED;
+					ports[val->len].flags |= SWLIB_PORT_FLAG_TAGGED;
 				else
 					return -1;
 
@@ -477,9 +524,9 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int por
 			}
 			if (*ptr)
 				ptr++;
-			val.len++;
+			val->len++;
 		}
-		val.value.ports = ports;
+		val->value.ports = ports;
 		break;
 	case SWITCH_TYPE_LINK:
 		link = malloc(sizeof(struct switch_port_link));
@@ -521,20 +568,277 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int por
 				break;
 			}
 		}
-		val.value.link = link;
+		val->value.link = link;
 		break;
 	case SWITCH_TYPE_NOVAL:
 		if (str && !strcmp(str, "0"))
-			return 0;
+			return 1;
 
 		break;
 	default:
 		return -1;
 	}
-	return swlib_set_attr(dev, a, &val);
+	return 0;
+}
+
+int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *a, int port_vlan, const char *str)
+{
+	struct switch_port *ports = alloca(sizeof(struct switch_port) * dev->ports);
+	struct switch_val val;
+	int ret;
+
+	ret = swlib_parse_attr_string(dev, a, port_vlan, str, &val, ports);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ret = swlib_set_attr(dev, a, &val);
+	if (a->type == SWITCH_TYPE_LINK)
+		free(val.value.link);
+
+	return ret;
+}
+
+static int
+send_dev_id(struct nl_msg *msg, void *arg)
+{
+	struct switch_dev *dev = arg;
+
+	NLA_PUT_U32(msg, SWITCH_ATTR_ID, dev->id);
+
+	return 0;
+nla_put_failure:
+	return -1;
+}
+
+static int
+store_batch(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct swlib_batch *b = arg;
+	struct nlattr *op;
+	int remaining;
+
+	if (nla_parse(tb, SWITCH_ATTR_MAX - 1, genlmsg_attrdata(gnlh, 0),
+			genlmsg_attrlen(gnlh, 0), NULL) < 0)
+		goto done;
+
+	if (!tb[SWITCH_ATTR_OP_BATCH])
+		goto done;
+
+	nla_for_each_nested(op, tb[SWITCH_ATTR_OP_BATCH], remaining) {
+		struct nlattr *otb[SWITCH_ATTR_MAX];
+		struct switch_val *val;
+		unsigned int idx;
+
+		if (nla_parse_nested(otb, SWITCH_ATTR_MAX - 1, op, NULL) < 0)
+			continue;
+
+		if (!otb[SWITCH_ATTR_OP_INDEX])
+			continue;
+
+		idx = nla_get_u32(otb[SWITCH_ATTR_OP_INDEX]);
+		if (idx >= b->n_ops)
+			continue;
+
+		val = b->vals[idx];
+		if (otb[SWITCH_ATTR_OP_ERROR]) {
+			int err = -(int) nla_get_u32(otb[SWITCH_ATTR_OP_ERROR]);
+
+			if (val)
+				val->err = err;
+			if (!b->err)
+				b->err = err;
+		} else if (val) {
+			store_val_attrs(msg, otb, val);
+		}
+	}
+
+done:
+	return NL_SKIP;
+}
+
+struct swlib_batch *
+swlib_batch_new(struct switch_dev *dev)
+{
+	struct swlib_batch *b;
+
+	b = swlib_alloc(sizeof(*b));
+	if (!b)
+		return NULL;
+
+	b->dev = dev;
+
+	/* check once whether the kernel knows about batched requests */
+	if (!dev->batch)
+		dev->batch = swlib_call(SWITCH_CMD_BATCH, NULL, send_dev_id, dev) ? -1 : 1;
+
+	return b;
+}
+
+static int
+swlib_batch_flush(struct swlib_batch *b)
+{
+	int err;
+
+	if (!b->msg)
+		return 0;
+
+	nla_nest_end(b->msg, b->nest);
+	err = swlib_transact(b->msg, store_batch, false, b);
+	if (err < 0 && !b->err)
+		b->err = err;
+
+	nlmsg_free(b->msg);
+	b->msg = NULL;
+	b->n_ops = 0;
+	b->reply_size = 0;
+
+	return err;
+}
+
+static int
+swlib_batch_start(struct swlib_batch *b)
+{
+	b->msg = nlmsg_alloc_size(SWLIB_BATCH_MSG_SIZE);
+	if (!b->msg)
+		return -1;
+
+	genlmsg_put(b->msg, NL_AUTO_PID, NL_AUTO_SEQ,
+		    genl_family_get_id(family), 0, 0, SWITCH_CMD_BATCH, 0);
+	NLA_PUT_U32(b->msg, SWITCH_ATTR_ID, b->dev->id);
+	b->nest = nla_nest_start(b->msg, SWITCH_ATTR_OP_BATCH);
+	if (!b->nest)
+		goto nla_put_failure;
+
+	return 0;
+
+nla_put_failure:
+	nlmsg_free(b->msg);
+	b->msg = NULL;
+	return -1;
+}
+
+static int
+swlib_batch_add(struct swlib_batch *b, int cmd, struct switch_val *val,
+		struct switch_val *result, int size, int reply_size)
+{
+	struct nlattr *n;
+	int len;
+
+	if (b->msg && (nlmsg_hdr(b->msg)->nlmsg_len + size > SWLIB_BATCH_MSG_SIZE ||
+		       b->reply_size + reply_size > SWLIB_BATCH_REPLY_SIZE ||
+		       b->n_ops >= SWLIB_BATCH_MAX_OPS))
+		swlib_batch_flush(b);
+
+	if (!b->msg && swlib_batch_start(b) < 0)
+		return -ENOMEM;
+
+	len = nlmsg_hdr(b->msg)->nlmsg_len;
+	n = nla_nest_start(b->msg, SWITCH_ATTR_OP);
+	if (!n)
+		goto nla_put_failure;
+
+	NLA_PUT_U32(b->msg, SWITCH_ATTR_OP_CMD, cmd);
+	if (result ? send_attr(b->msg, val) : send_attr_val(b->msg, val))
+		goto nla_put_failure;
+
+	nla_nest_end(b->msg, n);
+	b->vals[b->n_ops++] = result;
+	b->reply_size += reply_size;
+
+	return 0;
+
+nla_put_failure:
+	/* drop the partially added operation */
+	nlmsg_hdr(b->msg)->nlmsg_len = len;
+	return -1;
+}
+
+int
+swlib_batch_set(struct swlib_batch *b, struct switch_attr *attr, struct switch_val *val)
+{
+	int size = 64;
+	int cmd;
+
+	if (b->dev->batch < 0)
+		return swlib_set_attr(b->dev, attr, val);
+
+	cmd = swlib_attr_cmd(attr, true);
+	if (cmd < 0)
+		return cmd;
+
+	val->attr = attr;
+	if (attr->type == SWITCH_TYPE_PORTS)
+		size += 16 * val->len;
+	else if (attr->type == SWITCH_TYPE_STRING && val->value.s)
+		size += strlen(val->value.s);
+
+	return swlib_batch_add(b, cmd, val, NULL, size, 0);
+}
+
+int
+swlib_batch_set_string(struct swlib_batch *b, struct switch_attr *a,
+		int port_vlan, const char *str)
+{
+	struct switch_port *ports = alloca(sizeof(struct switch_port) * b->dev->ports);
+	struct switch_val val;
+	int ret;
+
+	ret = swlib_parse_attr_string(b->dev, a, port_vlan, str, &val, ports);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ret = swlib_batch_set(b, a, &val);
+	if (a->type == SWITCH_TYPE_LINK)
+		free(val.value.link);
+
+	return ret;
+}
+
+int
+swlib_batch_get(struct swlib_batch *b, struct switch_attr *attr, struct switch_val *val)
+{
+	int reply_size = 64;
+	int cmd;
+
+	if (b->dev->batch < 0)
+		return swlib_get_attr(b->dev, attr, val);
+
+	cmd = swlib_attr_cmd(attr, false);
+	if (cmd < 0)
+		return cmd;
+
+	if (attr->type == SWITCH_TYPE_PORTS)
+		reply_size += 16 * b->dev->ports;
+	else if (attr->type == SWITCH_TYPE_STRING)
+		reply_size += 256;
+
+	swlib_init_get(attr, val);
+	return swlib_batch_add(b, cmd, val, val, 48, reply_size);
+}
+
+int
+swlib_batch_commit(struct swlib_batch *b)
+{
+	int err;
+
+	swlib_batch_flush(b);
+	err = b->err;
+	b->err = 0;
+
+	return err;
+}
+
+void
+swlib_batch_free(struct swlib_batch *b)
+{
+	if (b->msg)
+		nlmsg_free(b->msg);
+	free(b);
 }
 
 
+
 struct attrlist_arg {
 	int id;
 	int atype;
@@ -52,6 +52,11 @@ Usage of the library functions:
   switch_set_attr() and switch_get_attr() can alter or request the values
   of attributes.
 
+  To change or query many attributes at once, queue the requests on a
+  batch created with swlib_batch_new() and send them with
+  swlib_batch_commit(). Results of queued get requests are only valid
+  after the commit.
+
 Usage of the switch_attr struct:
 
   ->atype: attribute group, one of:
@@ -116,6 +121,7 @@ struct switch_port;
 struct switch_port_map;
 struct switch_port_link;
 struct switch_val;
+struct swlib_batch;
 struct uci_package;
 
 struct switch_dev {
@@ -132,6 +138,8 @@ struct switch_dev {
 	struct switch_portmap *maps;
 	struct switch_dev *next;
 	void *priv;
+	/* kernel support for batched requests: 0 unknown, 1 yes, -1 no */
+	int batch;
 };
 
 struct switch_val {
@@ -259,6 +267,64 @@ int swlib_set_attr_string(struct switch_dev *dev, struct switch_attr *attr,
 int swlib_get_attr(struct switch_dev *dev, struct switch_attr *attr,
 		struct switch_val *val);
 
+/**
+ * swlib_batch_new: start a batch of requests for a switch
+ * @dev: switch device struct
+ *
+ * queued requests are sent in as few netlink messages as possible. If the
+ * kernel does not support batching, they are carried out immediately.
+ */
+struct swlib_batch *swlib_batch_new(struct switch_dev *dev);
+
+/**
+ * swlib_batch_set: queue setting the value for an attribute
+ * @b: batch
+ * @attr: switch attribute struct
+ * @val: attribute value pointer, only used until the call returns
+ * returns 0 on success
+ */
+int swlib_batch_set(struct swlib_batch *b, struct switch_attr *attr,
+		struct switch_val *val);
+
+/**
+ * swlib_batch_set_string: queue setting an attribute with type conversion
+ * @b: batch
+ * @attr: switch attribute struct
+ * @port_vlan: port or vlan (if applicable)
+ * @str: string value
+ * returns 0 on success
+ */
+int swlib_batch_set_string(struct swlib_batch *b, struct switch_attr *attr,
+		int port_vlan, const char *str);
+
+/**
+ * swlib_batch_get: queue getting the value for an attribute
+ * @b: batch
+ * @attr: switch attribute struct
+ * @val: attribute value pointer, filled in and val->err set on commit
+ * returns 0 on success
+ */
+int swlib_batch_get(struct swlib_batch *b, struct switch_attr *attr,
+		struct switch_val *val);
+
+/**
+ * swlib_batch_commit: send all queued requests
+ * @b: batch
+ * returns 0 if all requests succeeded, otherwise the first error
+ */
+int swlib_batch_commit(struct swlib_batch *b);
+
+/**
+ * swlib_batch_free: free a batch, dropping requests not yet committed
+ * @b: batch
+ */
+void swlib_batch_free(struct swlib_batch *b);
+
+/**
+ * swlib_get_round_trips: number of netlink requests sent so far
+ */
+unsigned int swlib_get_round_trips(void);
+
 /**
  * swlib_apply_from_uci: set up the switch from a uci configuration
  * @dev: switch device struct
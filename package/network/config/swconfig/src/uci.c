@@ -113,6 +113,7 @@ int swlib_apply_from_uci(struct switch_dev *dev, struct uci_package *p)
 	struct uci_option *o;
 	struct uci_ptr ptr;
 	struct switch_val val;
+	struct swlib_batch *b;
 	int i;
 
 	settings = NULL;
@@ -224,18 +225,22 @@ found:
 		swlib_map_settings(dev, SWLIB_ATTR_GROUP_PORT, port_n, s);
 	}
 
+	b = swlib_batch_new(dev);
+	if (!b)
+		return -1;
+
 	for (i = 0; i < ARRAY_SIZE(early_settings); i++) {
 		struct swlib_setting *st = &early_settings[i];
 		if (!st->attr || !st->val)
 			continue;
-		swlib_set_attr_string(dev, st->attr, st->port_vlan, st->val);
+		swlib_batch_set_string(b, st->attr, st->port_vlan, st->val);
 
 	}
 
 	while (settings) {
 		struct swlib_setting *st = settings;
 
-		swlib_set_attr_string(dev, st->attr, st->port_vlan, st->val);
+		swlib_batch_set_string(b, st->attr, st->port_vlan, st->val);
 		st = st->next;
 		free(settings);
 		settings = st;
@@ -243,11 +248,13 @@ found:
 
 	/* Apply the config */
 	attr = swlib_lookup_attr(dev, SWLIB_ATTR_GROUP_GLOBAL, "apply");
-	if (!attr)
-		return 0;
+	if (attr) {
+		memset(&val, 0, sizeof(val));
+		swlib_batch_set(b, attr, &val);
+	}
 
-	memset(&val, 0, sizeof(val));
-	swlib_set_attr(dev, attr, &val);
+	swlib_batch_commit(b);
+	swlib_batch_free(b);
 
 	return 0;
 }
@@ -25,9 +25,23 @@
 #include "airtime_policy.h"
 #include "hw_features.h"
 
+#ifdef CONFIG_DRIVER_NL80211
+#include <net/if.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include "drivers/nl80211_copy.h"
+#endif
+
+/* how long removed stations are reported to get_clients "since" callers */
+#define CLIENTS_REMOVED_TTL	60
+
 static struct ubus_context *ctx;
 static struct blob_buf b;
 static int ctx_ref;
+#ifdef CONFIG_DRIVER_NL80211
+static struct nl_sock *sta_dump_sock;
+static int sta_dump_family;
+#endif
 
 static inline struct hapd_interfaces *get_hapd_interfaces_from_object(struct ubus_object *obj)
 {
@@ -44,6 +58,38 @@ struct ubus_banned_client {
 	u8 addr[ETH_ALEN];
 };
 
+/* Last subscriber responses per station, used without waiting for them */
+struct ubus_sta_verdict {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	int resp[HOSTAPD_UBUS_TYPE_MAX];
+	struct os_reltime expires[HOSTAPD_UBUS_TYPE_MAX];
+	struct os_reltime probe_notified;
+};
+
+/* Per station change tracking for get_clients "since" */
+struct ubus_sta_state {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	u32 state_hash;
+	u32 counter_hash;
+	u32 state_gen;
+	u32 counter_gen;
+	bool seen;
+	struct os_reltime removed;
+};
+
+/* Driver data from a station dump, sorted by address */
+struct ubus_sta_data {
+	u8 addr[ETH_ALEN];
+	struct hostap_sta_driver_data data;
+};
+
+struct ubus_sta_dump {
+	struct ubus_sta_data *sta;
+	size_t n, size;
+};
+
 static void ubus_receive(int sock, void *eloop_ctx, void *sock_ctx)
 {
 	struct ubus_context *ctx = eloop_ctx;
@@ -97,6 +143,13 @@ static void hostapd_ubus_ref_dec(void)
 	eloop_unregister_read_sock(ctx->sock.fd);
 	ubus_free(ctx);
 	ctx = NULL;
+
+#ifdef CONFIG_DRIVER_NL80211
+	if (sta_dump_sock) {
+		nl_socket_free(sta_dump_sock);
+		sta_dump_sock = NULL;
+	}
+#endif
 }
 
 void hostapd_ubus_add_iface(struct hostapd_iface *iface)
@@ -197,6 +250,105 @@ hostapd_bss_ban_client(struct hostapd_data *hapd, u8 *addr, int time)
 	eloop_register_timeout(0, time * 1000, hostapd_bss_del_ban, ban, hapd);
 }
 
+static void
+hostapd_reltime_add_ms(struct os_reltime *t, int ms)
+{
+	t->sec += ms / 1000;
+	t->usec += (ms % 1000) * 1000;
+	if (t->usec >= 1000000) {
+		t->sec++;
+		t->usec -= 1000000;
+	}
+}
+
+/*
+ * Drop the entry once neither a verdict nor the probe coalescing window
+ * is current, otherwise check again when the last of them expires.
+ */
+static void
+hostapd_bss_del_verdict(void *eloop_data, void *user_ctx)
+{
+	struct ubus_sta_verdict *v = eloop_data;
+	struct hostapd_data *hapd = user_ctx;
+	struct os_reltime now, last, left;
+	int i;
+
+	last = v->probe_notified;
+	hostapd_reltime_add_ms(&last, hapd->ubus.probe_interval);
+	for (i = 0; i < HOSTAPD_UBUS_TYPE_MAX; i++)
+		if (os_reltime_before(&last, &v->expires[i]))
+			last = v->expires[i];
+
+	os_get_reltime(&now);
+	if (os_reltime_before(&now, &last)) {
+		os_reltime_sub(&last, &now, &left);
+		eloop_register_timeout(left.sec, left.usec,
+				       hostapd_bss_del_verdict, v, hapd);
+		return;
+	}
+
+	avl_delete(&hapd->ubus.verdicts, &v->avl);
+	free(v);
+}
+
+static struct ubus_sta_verdict *
+hostapd_bss_get_verdict(struct hostapd_data *hapd, const u8 *addr, bool create)
+{
+	struct ubus_sta_verdict *v;
+	int time;
+
+	v = avl_find_element(&hapd->ubus.verdicts, addr, v, avl);
+	if (v || !create)
+		return v;
+
+	time = hapd->ubus.verdict_ttl;
+	if (hapd->ubus.probe_interval > time)
+		time = hapd->ubus.probe_interval;
+	if (time <= 0)
+		return NULL;
+
+	v = os_zalloc(sizeof(*v));
+	if (!v)
+		return NULL;
+
+	memcpy(v->addr, addr, sizeof(v->addr));
+	v->avl.key = v->addr;
+	avl_insert(&hapd->ubus.verdicts, &v->avl);
+
+	eloop_register_timeout(time / 1000, (time % 1000) * 1000,
+			       hostapd_bss_del_verdict, v, hapd);
+
+	return v;
+}
+
+static int
+hostapd_bss_cached_verdict(struct ubus_sta_verdict *v,
+			   enum hostapd_ubus_event_type type)
+{
+	struct os_reltime now;
+
+	if (!v || type >= HOSTAPD_UBUS_TYPE_MAX)
+		return WLAN_STATUS_SUCCESS;
+
+	/* every verdict expires verdict_ttl after the reply setting it */
+	os_get_reltime(&now);
+	if (!os_reltime_before(&now, &v->expires[type]))
+		return WLAN_STATUS_SUCCESS;
+
+	return v->resp[type];
+}
+
+static void
+hostapd_bss_flush_verdicts(struct hostapd_data *hapd)
+{
+	struct ubus_sta_verdict *v, *tmp;
+
+	avl_remove_all_elements(&hapd->ubus.verdicts, v, avl, tmp) {
+		eloop_cancel_timeout(hostapd_bss_del_verdict, v, hapd);
+		free(v);
+	}
+}
+
 static int
 hostapd_bss_reload(struct ubus_context *ctx, struct ubus_object *obj,
 		   struct ubus_request_data *req, const char *method,
@@ -278,99 +430,570 @@ hostapd_parse_capab_blobmsg(struct sta_info *sta)
 	blobmsg_close_table(&b, v);
 }
 
+static const struct {
+	const char *name;
+	uint32_t flag;
+} sta_flags[] = {
+	{ "auth", WLAN_STA_AUTH },
+	{ "assoc", WLAN_STA_ASSOC },
+	{ "authorized", WLAN_STA_AUTHORIZED },
+	{ "preauth", WLAN_STA_PREAUTH },
+	{ "wds", WLAN_STA_WDS },
+	{ "wmm", WLAN_STA_WMM },
+	{ "ht", WLAN_STA_HT },
+	{ "vht", WLAN_STA_VHT },
+	{ "he", WLAN_STA_HE },
+	{ "wps", WLAN_STA_WPS },
+	{ "mfp", WLAN_STA_MFP },
+};
+
+enum {
+	CLIENT_FIELD_FLAGS,
+	CLIENT_FIELD_RRM,
+	CLIENT_FIELD_EXT_CAPAB,
+	CLIENT_FIELD_AID,
+	CLIENT_FIELD_SIGNATURE,
+	CLIENT_FIELD_BYTES,
+	CLIENT_FIELD_AIRTIME,
+	CLIENT_FIELD_PACKETS,
+	CLIENT_FIELD_RATE,
+	CLIENT_FIELD_SIGNAL,
+	CLIENT_FIELD_CAPABILITIES,
+	__CLIENT_FIELD_MAX
+};
+
+static const char * const client_fields[__CLIENT_FIELD_MAX] = {
+	[CLIENT_FIELD_FLAGS] = "flags",
+	[CLIENT_FIELD_RRM] = "rrm",
+	[CLIENT_FIELD_EXT_CAPAB] = "extended_capabilities",
+	[CLIENT_FIELD_AID] = "aid",
+	[CLIENT_FIELD_SIGNATURE] = "signature",
+	[CLIENT_FIELD_BYTES] = "bytes",
+	[CLIENT_FIELD_AIRTIME] = "airtime",
+	[CLIENT_FIELD_PACKETS] = "packets",
+	[CLIENT_FIELD_RATE] = "rate",
+	[CLIENT_FIELD_SIGNAL] = "signal",
+	[CLIENT_FIELD_CAPABILITIES] = "capabilities",
+};
+
+/* fields filled from the driver, also selected by "counters" */
+#define CLIENT_FIELDS_DRIVER \
+	(BIT(CLIENT_FIELD_BYTES) | BIT(CLIENT_FIELD_AIRTIME) | \
+	 BIT(CLIENT_FIELD_PACKETS) | BIT(CLIENT_FIELD_RATE) | \
+	 BIT(CLIENT_FIELD_SIGNAL))
+
+static int
+hostapd_sta_data_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, ETH_ALEN);
+}
+
+#ifdef CONFIG_DRIVER_NL80211
+static int
+hostapd_sta_dump_cb(struct nl_msg *msg, void *arg)
+{
+	struct ubus_sta_dump *dump = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *stats[NL80211_STA_INFO_MAX + 1];
+	struct nlattr *rate[NL80211_RATE_INFO_MAX + 1];
+	struct hostap_sta_driver_data *data;
+	struct ubus_sta_data *sta;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_MAC] || !tb[NL80211_ATTR_STA_INFO] ||
+	    nla_parse_nested(stats, NL80211_STA_INFO_MAX,
+			     tb[NL80211_ATTR_STA_INFO], NULL))
+		return NL_SKIP;
+
+	if (dump->n == dump->size) {
+		size_t size = dump->size ? dump->size * 2 : 32;
+
+		sta = os_realloc_array(dump->sta, size, sizeof(*sta));
+		if (!sta)
+			return NL_SKIP;
+
+		dump->sta = sta;
+		dump->size = size;
+	}
+
+	sta = &dump->sta[dump->n++];
+	os_memset(sta, 0, sizeof(*sta));
+	os_memcpy(sta->addr, nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+	data = &sta->data;
+
+	if (stats[NL80211_STA_INFO_RX_BYTES64])
+		data->rx_bytes = nla_get_u64(stats[NL80211_STA_INFO_RX_BYTES64]);
+	else if (stats[NL80211_STA_INFO_RX_BYTES])
+		data->rx_bytes = nla_get_u32(stats[NL80211_STA_INFO_RX_BYTES]);
+	if (stats[NL80211_STA_INFO_TX_BYTES64])
+		data->tx_bytes = nla_get_u64(stats[NL80211_STA_INFO_TX_BYTES64]);
+	else if (stats[NL80211_STA_INFO_TX_BYTES])
+		data->tx_bytes = nla_get_u32(stats[NL80211_STA_INFO_TX_BYTES]);
+	if (stats[NL80211_STA_INFO_RX_PACKETS])
+		data->rx_packets = nla_get_u32(stats[NL80211_STA_INFO_RX_PACKETS]);
+	if (stats[NL80211_STA_INFO_TX_PACKETS])
+		data->tx_packets = nla_get_u32(stats[NL80211_STA_INFO_TX_PACKETS]);
+	if (stats[NL80211_STA_INFO_RX_DURATION])
+		data->rx_airtime = nla_get_u64(stats[NL80211_STA_INFO_RX_DURATION]);
+	if (stats[NL80211_STA_INFO_TX_DURATION])
+		data->tx_airtime = nla_get_u64(stats[NL80211_STA_INFO_TX_DURATION]);
+	if (stats[NL80211_STA_INFO_SIGNAL])
+		data->signal = (s8) nla_get_u8(stats[NL80211_STA_INFO_SIGNAL]);
+
+	/* bitrates in 100 kbit/s, as read_sta_data() reports them */
+	if (stats[NL80211_STA_INFO_TX_BITRATE] &&
+	    !nla_parse_nested(rate, NL80211_RATE_INFO_MAX,
+			      stats[NL80211_STA_INFO_TX_BITRATE], NULL)) {
+		if (rate[NL80211_RATE_INFO_BITRATE32])
+			data->current_tx_rate = nla_get_u32(rate[NL80211_RATE_INFO_BITRATE32]);
+		else if (rate[NL80211_RATE_INFO_BITRATE])
+			data->current_tx_rate = nla_get_u16(rate[NL80211_RATE_INFO_BITRATE]);
+	}
+	if (stats[NL80211_STA_INFO_RX_BITRATE] &&
+	    !nla_parse_nested(rate, NL80211_RATE_INFO_MAX,
+			      stats[NL80211_STA_INFO_RX_BITRATE], NULL)) {
+		if (rate[NL80211_RATE_INFO_BITRATE32])
+			data->current_rx_rate = nla_get_u32(rate[NL80211_RATE_INFO_BITRATE32]);
+		else if (rate[NL80211_RATE_INFO_BITRATE])
+			data->current_rx_rate = nla_get_u16(rate[NL80211_RATE_INFO_BITRATE]);
+	}
+
+	return NL_SKIP;
+}
+
+static int
+hostapd_sta_dump_finish(struct nl_msg *msg, void *arg)
+{
+	*(int *) arg = 0;
+	return NL_SKIP;
+}
+
+static int
+hostapd_sta_dump_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	*(int *) arg = err->error;
+	return NL_STOP;
+}
+
+/*
+ * Fetch the driver data of all stations of the BSS with a single
+ * NL80211_CMD_GET_STATION dump, instead of one request per station.
+ */
+static int
+hostapd_sta_dump(struct hostapd_data *hapd, struct ubus_sta_dump *dump)
+{
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	int ifindex, ret, err = -1;
+
+	if (!sta_dump_sock) {
+		sta_dump_sock = nl_socket_alloc();
+		if (!sta_dump_sock)
+			return -1;
+
+		if (genl_connect(sta_dump_sock) ||
+		    (sta_dump_family = genl_ctrl_resolve(sta_dump_sock, "nl80211")) < 0) {
+			nl_socket_free(sta_dump_sock);
+			sta_dump_sock = NULL;
+			return -1;
+		}
+	}
+
+	ifindex = if_nametoindex(hapd->conf->iface);
+	if (!ifindex)
+		return -1;
+
+	msg = nlmsg_alloc();
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!msg || !cb)
+		goto out;
+
+	if (!genlmsg_put(msg, 0, 0, sta_dump_family, 0, NLM_F_DUMP,
+			 NL80211_CMD_GET_STATION, 0) ||
+	    nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) ||
+	    nl_send_auto_complete(sta_dump_sock, msg) < 0)
+		goto out;
+
+	err = 1;
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, hostapd_sta_dump_cb, dump);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, hostapd_sta_dump_finish, &err);
+	nl_cb_err(cb, NL_CB_CUSTOM, hostapd_sta_dump_error, &err);
+	while (err > 0) {
+		ret = nl_recvmsgs(sta_dump_sock, cb);
+		if (ret < 0)
+			err = ret;
+	}
+
+	if (!err)
+		qsort(dump->sta, dump->n, sizeof(*dump->sta), hostapd_sta_data_cmp);
+
+out:
+	nl_cb_put(cb);
+	nlmsg_free(msg);
+
+	return err;
+}
+#else
+static int
+hostapd_sta_dump(struct hostapd_data *hapd, struct ubus_sta_dump *dump)
+{
+	return -1;
+}
+#endif
+
+static struct hostap_sta_driver_data *
+hostapd_sta_driver_data(struct hostapd_data *hapd, struct ubus_sta_dump *dump,
+			struct sta_info *sta, struct hostap_sta_driver_data *buf)
+{
+	struct ubus_sta_data *data;
+
+	data = bsearch(sta->addr, dump->sta, dump->n, sizeof(*dump->sta),
+		       hostapd_sta_data_cmp);
+	if (data)
+		return &data->data;
+
+	/* not in the dump (e.g. on an AP VLAN interface), ask directly */
+	if (hostapd_drv_read_sta_data(hapd, buf, sta->addr) >= 0)
+		return buf;
+
+	return NULL;
+}
+
+static u32
+hostapd_ubus_hash(u32 hash, const void *data, size_t len)
+{
+	const u8 *p = data;
+
+	/* FNV-1a */
+	while (len--)
+		hash = (hash ^ *p++) * 16777619;
+
+	return hash;
+}
+
+static u32
+hostapd_sta_state_hash(struct sta_info *sta)
+{
+	u32 hash = 2166136261;
+	u32 flags = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
+		flags |= sta->flags & sta_flags[i].flag;
+
+	hash = hostapd_ubus_hash(hash, &flags, sizeof(flags));
+	hash = hostapd_ubus_hash(hash, &sta->aid, sizeof(sta->aid));
+	hash = hostapd_ubus_hash(hash, sta->rrm_enabled_capa,
+			    sizeof(sta->rrm_enabled_capa));
+	if (sta->ext_capability)
+		hash = hostapd_ubus_hash(hash, sta->ext_capability,
+				    1 + sta->ext_capability[0]);
+	if (sta->vht_capabilities)
+		hash = hostapd_ubus_hash(hash, sta->vht_capabilities,
+				    sizeof(*sta->vht_capabilities));
+
+	return hash;
+}
+
+static u32
+hostapd_sta_counter_hash(struct hostap_sta_driver_data *data)
+{
+	u32 hash = 2166136261;
+
+	if (!data)
+		return hash;
+
+	hash = hostapd_ubus_hash(hash, &data->rx_bytes, sizeof(data->rx_bytes));
+	hash = hostapd_ubus_hash(hash, &data->tx_bytes, sizeof(data->tx_bytes));
+	hash = hostapd_ubus_hash(hash, &data->rx_packets, sizeof(data->rx_packets));
+	hash = hostapd_ubus_hash(hash, &data->tx_packets, sizeof(data->tx_packets));
+	hash = hostapd_ubus_hash(hash, &data->rx_airtime, sizeof(data->rx_airtime));
+	hash = hostapd_ubus_hash(hash, &data->tx_airtime, sizeof(data->tx_airtime));
+	hash = hostapd_ubus_hash(hash, &data->current_rx_rate, sizeof(data->current_rx_rate));
+	hash = hostapd_ubus_hash(hash, &data->current_tx_rate, sizeof(data->current_tx_rate));
+	hash = hostapd_ubus_hash(hash, &data->signal, sizeof(data->signal));
+
+	return hash;
+}
+
+/*
+ * Update the change generation of a station, returns the generation of the
+ * last change relevant for the requested fields.
+ */
+static u32
+hostapd_sta_update_state(struct hostapd_data *hapd, struct sta_info *sta,
+			 struct hostap_sta_driver_data *data, u32 fields)
+{
+	struct ubus_sta_state *st;
+	u32 hash;
+
+	st = avl_find_element(&hapd->ubus.clients, sta->addr, st, avl);
+	if (!st) {
+		st = os_zalloc(sizeof(*st));
+		if (!st)
+			return ++hapd->ubus.clients_gen;
+
+		os_memcpy(st->addr, sta->addr, ETH_ALEN);
+		st->avl.key = st->addr;
+		avl_insert(&hapd->ubus.clients, &st->avl);
+		st->state_gen = st->counter_gen = ++hapd->ubus.clients_gen;
+	}
+
+	st->seen = true;
+	if (st->removed.sec) {
+		st->removed.sec = 0;
+		st->state_gen = ++hapd->ubus.clients_gen;
+	}
+
+	hash = hostapd_sta_state_hash(sta);
+	if (hash != st->state_hash) {
+		st->state_hash = hash;
+		st->state_gen = ++hapd->ubus.clients_gen;
+	}
+
+	if (fields & CLIENT_FIELDS_DRIVER) {
+		hash = hostapd_sta_counter_hash(data);
+		if (hash != st->counter_hash) {
+			st->counter_hash = hash;
+			st->counter_gen = ++hapd->ubus.clients_gen;
+		}
+		if (st->counter_gen > st->state_gen)
+			return st->counter_gen;
+	}
+
+	return st->state_gen;
+}
+
+/* Mark stations that are gone as removed and drop old removals */
+static void
+hostapd_sta_update_removed(struct hostapd_data *hapd)
+{
+	struct ubus_sta_state *st, *tmp;
+	struct os_reltime now;
+
+	os_get_reltime(&now);
+	avl_for_each_element_safe(&hapd->ubus.clients, st, avl, tmp) {
+		if (st->seen) {
+			st->seen = false;
+			continue;
+		}
+
+		if (!st->removed.sec) {
+			st->removed = now;
+			if (!st->removed.sec)
+				st->removed.sec = 1;
+			st->state_gen = ++hapd->ubus.clients_gen;
+			continue;
+		}
+
+		if (!os_reltime_expired(&now, &st->removed, CLIENTS_REMOVED_TTL))
+			continue;
+
+		if (st->state_gen > hapd->ubus.clients_pruned)
+			hapd->ubus.clients_pruned = st->state_gen;
+		avl_delete(&hapd->ubus.clients, &st->avl);
+		free(st);
+	}
+}
+
+static void
+hostapd_bss_flush_clients(struct hostapd_data *hapd)
+{
+	struct ubus_sta_state *st, *tmp;
+
+	avl_remove_all_elements(&hapd->ubus.clients, st, avl, tmp) {
+		free(st);
+	}
+
+	/* the flushed clients are gone without a removal record */
+	hapd->ubus.clients_pruned = ++hapd->ubus.clients_gen;
+}
+
+enum {
+	GET_CLIENTS_FIELDS,
+	GET_CLIENTS_SINCE,
+	__GET_CLIENTS_MAX
+};
+
+static const struct blobmsg_policy get_clients_policy[__GET_CLIENTS_MAX] = {
+	[GET_CLIENTS_FIELDS] = { "fields", BLOBMSG_TYPE_ARRAY },
+	[GET_CLIENTS_SINCE] = { "since", BLOBMSG_TYPE_INT32 },
+};
+
 static int
 hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 			struct ubus_request_data *req, const char *method,
 			struct blob_attr *msg)
 {
 	struct hostapd_data *hapd = container_of(obj, struct hostapd_data, ubus.obj);
-	struct hostap_sta_driver_data sta_driver_data;
+	struct blob_attr *tb[__GET_CLIENTS_MAX], *cur;
+	struct hostap_sta_driver_data sta_driver_data, *data;
+	struct ubus_sta_dump dump = {};
+	struct ubus_sta_state *st;
 	struct sta_info *sta;
+	u32 fields = ~0, since = 0;
+	bool cursor = false;
 	void *list, *c;
 	char mac_buf[20];
-	static const struct {
-		const char *name;
-		uint32_t flag;
-	} sta_flags[] = {
-		{ "auth", WLAN_STA_AUTH },
-		{ "assoc", WLAN_STA_ASSOC },
-		{ "authorized", WLAN_STA_AUTHORIZED },
-		{ "preauth", WLAN_STA_PREAUTH },
-		{ "wds", WLAN_STA_WDS },
-		{ "wmm", WLAN_STA_WMM },
-		{ "ht", WLAN_STA_HT },
-		{ "vht", WLAN_STA_VHT },
-		{ "he", WLAN_STA_HE },
-		{ "wps", WLAN_STA_WPS },
-		{ "mfp", WLAN_STA_MFP },
-	};
+	int rem;
+
+	blobmsg_parse(get_clients_policy, __GET_CLIENTS_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[GET_CLIENTS_FIELDS]) {
+		fields = 0;
+		blobmsg_for_each_attr(cur, tb[GET_CLIENTS_FIELDS], rem) {
+			const char *name;
+			int i;
+
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			name = blobmsg_get_string(cur);
+			if (!strcmp(name, "counters")) {
+				fields |= CLIENT_FIELDS_DRIVER;
+				continue;
+			}
+
+			for (i = 0; i < __CLIENT_FIELD_MAX; i++)
+				if (!strcmp(name, client_fields[i]))
+					break;
+			if (i == __CLIENT_FIELD_MAX)
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			fields |= BIT(i);
+		}
+	}
+
+	if (tb[GET_CLIENTS_SINCE]) {
+		cursor = true;
+		since = blobmsg_get_u32(tb[GET_CLIENTS_SINCE]);
+	}
+
+	if ((fields & CLIENT_FIELDS_DRIVER) && hapd->num_sta &&
+	    hostapd_sta_dump(hapd, &dump))
+		dump.n = 0;
 
 	blob_buf_init(&b, 0);
 	blobmsg_add_u32(&b, "freq", hapd->iface->freq);
+	if (cursor && since && (since < hapd->ubus.clients_pruned ||
+				since > hapd->ubus.clients_gen)) {
+		/*
+		 * removals since the cursor may have been forgotten, or the
+		 * cursor stems from before a restart of the counter
+		 */
+		blobmsg_add_u8(&b, "reset", true);
+		since = 0;
+	}
 	list = blobmsg_open_table(&b, "clients");
 	for (sta = hapd->sta_list; sta; sta = sta->next) {
 		void *r;
 		int i;
 
+		data = NULL;
+		if (fields & CLIENT_FIELDS_DRIVER)
+			data = hostapd_sta_driver_data(hapd, &dump, sta, &sta_driver_data);
+
+		if (cursor &&
+		    hostapd_sta_update_state(hapd, sta, data, fields) <= since)
+			continue;
+
 		sprintf(mac_buf, MACSTR, MAC2STR(sta->addr));
 		c = blobmsg_open_table(&b, mac_buf);
-		for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
-			blobmsg_add_u8(&b, sta_flags[i].name,
-				       !!(sta->flags & sta_flags[i].flag));
+		if (fields & BIT(CLIENT_FIELD_FLAGS)) {
+			for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
+				blobmsg_add_u8(&b, sta_flags[i].name,
+					       !!(sta->flags & sta_flags[i].flag));
 
 #ifdef CONFIG_MBO
-		blobmsg_add_u8(&b, "mbo", !!(sta->cell_capa));
+			blobmsg_add_u8(&b, "mbo", !!(sta->cell_capa));
 #endif
+		}
 
-		r = blobmsg_open_array(&b, "rrm");
-		for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
-			blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
-		blobmsg_close_array(&b, r);
+		if (fields & BIT(CLIENT_FIELD_RRM)) {
+			r = blobmsg_open_array(&b, "rrm");
+			for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
+				blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
+			blobmsg_close_array(&b, r);
+		}
 
-		r = blobmsg_open_array(&b, "extended_capabilities");
-		/* Check if client advertises extended capabilities */
-		if (sta->ext_capability && sta->ext_capability[0] > 0) {
-			for (i = 0; i < sta->ext_capability[0]; i++) {
-				blobmsg_add_u32(&b, "", sta->ext_capability[1 + i]);
+		if (fields & BIT(CLIENT_FIELD_EXT_CAPAB)) {
+			r = blobmsg_open_array(&b, "extended_capabilities");
+			/* Check if client advertises extended capabilities */
+			if (sta->ext_capability && sta->ext_capability[0] > 0) {
+				for (i = 0; i < sta->ext_capability[0]; i++) {
+					blobmsg_add_u32(&b, "", sta->ext_capability[1 + i]);
+				}
 			}
+			blobmsg_close_array(&b, r);
 		}
-		blobmsg_close_array(&b, r);
 
-		blobmsg_add_u32(&b, "aid", sta->aid);
+		if (fields & BIT(CLIENT_FIELD_AID))
+			blobmsg_add_u32(&b, "aid", sta->aid);
 #ifdef CONFIG_TAXONOMY
-		r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
-		if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
-			blobmsg_add_string_buffer(&b);
+		if (fields & BIT(CLIENT_FIELD_SIGNATURE)) {
+			r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
+			if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
+				blobmsg_add_string_buffer(&b);
+		}
 #endif
 
 		/* Driver information */
-		if (hostapd_drv_read_sta_data(hapd, &sta_driver_data, sta->addr) >= 0) {
-			r = blobmsg_open_table(&b, "bytes");
-			blobmsg_add_u64(&b, "rx", sta_driver_data.rx_bytes);
-			blobmsg_add_u64(&b, "tx", sta_driver_data.tx_bytes);
-			blobmsg_close_table(&b, r);
-			r = blobmsg_open_table(&b, "airtime");
-			blobmsg_add_u64(&b, "rx", sta_driver_data.rx_airtime);
-			blobmsg_add_u64(&b, "tx", sta_driver_data.tx_airtime);
-			blobmsg_close_table(&b, r);
-			r = blobmsg_open_table(&b, "packets");
-			blobmsg_add_u32(&b, "rx", sta_driver_data.rx_packets);
-			blobmsg_add_u32(&b, "tx", sta_driver_data.tx_packets);
-			blobmsg_close_table(&b, r);
-			r = blobmsg_open_table(&b, "rate");
-			/* Rate in kbits */
-			blobmsg_add_u32(&b, "rx", sta_driver_data.current_rx_rate * 100);
-			blobmsg_add_u32(&b, "tx", sta_driver_data.current_tx_rate * 100);
-			blobmsg_close_table(&b, r);
-			blobmsg_add_u32(&b, "signal", sta_driver_data.signal);
+		if (data) {
+			if (fields & BIT(CLIENT_FIELD_BYTES)) {
+				r = blobmsg_open_table(&b, "bytes");
+				blobmsg_add_u64(&b, "rx", data->rx_bytes);
+				blobmsg_add_u64(&b, "tx", data->tx_bytes);
+				blobmsg_close_table(&b, r);
+			}
+			if (fields & BIT(CLIENT_FIELD_AIRTIME)) {
+				r = blobmsg_open_table(&b, "airtime");
+				blobmsg_add_u64(&b, "rx", data->rx_airtime);
+				blobmsg_add_u64(&b, "tx", data->tx_airtime);
+				blobmsg_close_table(&b, r);
+			}
+			if (fields & BIT(CLIENT_FIELD_PACKETS)) {
+				r = blobmsg_open_table(&b, "packets");
+				blobmsg_add_u32(&b, "rx", data->rx_packets);
+				blobmsg_add_u32(&b, "tx", data->tx_packets);
+				blobmsg_close_table(&b, r);
+			}
+			if (fields & BIT(CLIENT_FIELD_RATE)) {
+				r = blobmsg_open_table(&b, "rate");
+				/* Rate in kbits */
+				blobmsg_add_u32(&b, "rx", data->current_rx_rate * 100);
+				blobmsg_add_u32(&b, "tx", data->current_tx_rate * 100);
+				blobmsg_close_table(&b, r);
+			}
+			if (fields & BIT(CLIENT_FIELD_SIGNAL))
+				blobmsg_add_u32(&b, "signal", data->signal);
 		}
 
-		hostapd_parse_capab_blobmsg(sta);
+		if (fields & BIT(CLIENT_FIELD_CAPABILITIES))
+			hostapd_parse_capab_blobmsg(sta);
 
 		blobmsg_close_table(&b, c);
 	}
-	blobmsg_close_array(&b, list);
+	blobmsg_close_table(&b, list);
+
+	if (cursor) {
+		hostapd_sta_update_removed(hapd);
+
+		list = blobmsg_open_array(&b, "removed");
+		avl_for_each_element(&hapd->ubus.clients, st, avl) {
+			if (!st->removed.sec || st->state_gen <= since)
+				continue;
+
+			sprintf(mac_buf, MACSTR, MAC2STR(st->addr));
+			blobmsg_add_string(&b, NULL, mac_buf);
+		}
+		blobmsg_close_array(&b, list);
+		blobmsg_add_u32(&b, "cursor", hapd->ubus.clients_gen);
+	}
+
 	ubus_send_reply(ctx, req, b.head);
+	free(dump.sta);
 
 	return 0;
 }
@@ -494,11 +1117,17 @@ hostapd_bss_get_status(struct ubus_context *ctx, struct ubus_object *obj,
 
 enum {
 	NOTIFY_RESPONSE,
+	NOTIFY_ASYNC,
+	NOTIFY_VERDICT_TTL,
+	NOTIFY_PROBE_INTERVAL,
 	__NOTIFY_MAX
 };
 
 static const struct blobmsg_policy notify_policy[__NOTIFY_MAX] = {
 	[NOTIFY_RESPONSE] = { "notify_response", BLOBMSG_TYPE_INT32 },
+	[NOTIFY_ASYNC] = { "async", BLOBMSG_TYPE_BOOL },
+	[NOTIFY_VERDICT_TTL] = { "verdict_ttl", BLOBMSG_TYPE_INT32 },
+	[NOTIFY_PROBE_INTERVAL] = { "probe_interval", BLOBMSG_TYPE_INT32 },
 };
 
 static int
@@ -520,6 +1149,18 @@ hostapd_notify_response(struct ubus_context *ctx, struct ubus_object *obj,
 
 	hapd->ubus.notify_response = blobmsg_get_u32(tb[NOTIFY_RESPONSE]);
 
+	if (tb[NOTIFY_ASYNC])
+		hapd->ubus.notify_async = blobmsg_get_bool(tb[NOTIFY_ASYNC]);
+
+	if (tb[NOTIFY_VERDICT_TTL])
+		hapd->ubus.verdict_ttl = blobmsg_get_u32(tb[NOTIFY_VERDICT_TTL]);
+
+	if (tb[NOTIFY_PROBE_INTERVAL])
+		hapd->ubus.probe_interval = blobmsg_get_u32(tb[NOTIFY_PROBE_INTERVAL]);
+
+	if (!hapd->ubus.notify_response || hapd->ubus.verdict_ttl <= 0)
+		hostapd_bss_flush_verdicts(hapd);
+
 	return UBUS_STATUS_OK;
 }
 
@@ -1696,7 +2337,7 @@ hostapd_bss_update_airtime(struct ubus_context *ctx, struct ubus_object *obj,
 
 static const struct ubus_method bss_methods[] = {
 	UBUS_METHOD_NOARG("reload", hostapd_bss_reload),
-	UBUS_METHOD_NOARG("get_clients", hostapd_bss_get_clients),
+	UBUS_METHOD("get_clients", hostapd_bss_get_clients, get_clients_policy),
 	UBUS_METHOD_NOARG("get_status", hostapd_bss_get_status),
 	UBUS_METHOD("del_client", hostapd_bss_del_client, del_policy),
 #ifdef CONFIG_AIRTIME_POLICY
@@ -1752,6 +2393,10 @@ void hostapd_ubus_add_bss(struct hostapd_data *hapd)
 		return;
 
 	avl_init(&hapd->ubus.banned, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.verdicts, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.clients, avl_compare_macaddr, false, NULL);
+	INIT_LIST_HEAD(&hapd->ubus.pending);
+	hapd->ubus.verdict_ttl = 10000;
 	obj->name = name;
 	obj->type = &bss_object_type;
 	obj->methods = bss_object_type.methods;
@@ -1762,6 +2407,8 @@ void hostapd_ubus_add_bss(struct hostapd_data *hapd)
 	hostapd_send_shared_event(&hapd->iface->interfaces->ubus, hapd->conf->iface, "add");
 }
 
+static void hostapd_ubus_abort_pending(struct hostapd_data *hapd);
+
 void hostapd_ubus_free_bss(struct hostapd_data *hapd)
 {
 	struct ubus_object *obj = &hapd->ubus.obj;
@@ -1777,6 +2424,10 @@ void hostapd_ubus_free_bss(struct hostapd_data *hapd)
 
 	hostapd_send_shared_event(&hapd->iface->interfaces->ubus, hapd->conf->iface, "remove");
 
+	hostapd_ubus_abort_pending(hapd);
+	hostapd_bss_flush_verdicts(hapd);
+	hostapd_bss_flush_clients(hapd);
+
 	if (obj->id) {
 		ubus_remove_object(ctx, obj);
 		hostapd_ubus_ref_dec();
@@ -1865,6 +2516,10 @@ void hostapd_ubus_free(struct hapd_interfaces *interfaces)
 
 struct ubus_event_req {
 	struct ubus_notify_request nreq;
+	struct list_head list;
+	struct hostapd_data *hapd;
+	enum hostapd_ubus_event_type type;
+	u8 addr[ETH_ALEN];
 	int resp;
 };
 
@@ -1872,8 +2527,81 @@ static void
 ubus_event_cb(struct ubus_notify_request *req, int idx, int ret)
 {
 	struct ubus_event_req *ureq = container_of(req, struct ubus_event_req, nreq);
+	struct ubus_sta_verdict *v;
 
 	ureq->resp = ret;
+
+	if (!ureq->hapd || ureq->type >= HOSTAPD_UBUS_TYPE_MAX ||
+	    ureq->hapd->ubus.verdict_ttl <= 0)
+		return;
+
+	v = hostapd_bss_get_verdict(ureq->hapd, ureq->addr, true);
+	if (!v)
+		return;
+
+	v->resp[ureq->type] = ret;
+	os_get_reltime(&v->expires[ureq->type]);
+	hostapd_reltime_add_ms(&v->expires[ureq->type], ureq->hapd->ubus.verdict_ttl);
+}
+
+static void ubus_event_req_timeout(void *eloop_data, void *user_ctx);
+
+static void
+ubus_event_req_free(struct ubus_event_req *ureq)
+{
+	eloop_cancel_timeout(ubus_event_req_timeout, ureq, NULL);
+	list_del(&ureq->list);
+	free(ureq);
+}
+
+static void
+ubus_event_complete_cb(struct ubus_notify_request *req, int idx, int ret)
+{
+	ubus_event_req_free(container_of(req, struct ubus_event_req, nreq));
+}
+
+static void
+ubus_event_req_timeout(void *eloop_data, void *user_ctx)
+{
+	struct ubus_event_req *ureq = eloop_data;
+
+	ubus_abort_request(ctx, &ureq->nreq.req);
+	ubus_event_req_free(ureq);
+}
+
+static void
+hostapd_ubus_abort_pending(struct hostapd_data *hapd)
+{
+	struct ubus_event_req *ureq, *tmp;
+
+	list_for_each_entry_safe(ureq, tmp, &hapd->ubus.pending, list)
+		ubus_event_req_timeout(ureq, NULL);
+}
+
+/* Send the notification, replies only update the verdict cache */
+static void
+hostapd_ubus_notify_async(struct hostapd_data *hapd, const char *type,
+			  enum hostapd_ubus_event_type req_type, const u8 *addr)
+{
+	struct ubus_event_req *ureq;
+
+	ureq = os_zalloc(sizeof(*ureq));
+	if (!ureq)
+		return;
+
+	if (ubus_notify_async(ctx, &hapd->ubus.obj, type, b.head, &ureq->nreq)) {
+		free(ureq);
+		return;
+	}
+
+	ureq->hapd = hapd;
+	ureq->type = req_type;
+	memcpy(ureq->addr, addr, ETH_ALEN);
+	ureq->nreq.status_cb = ubus_event_cb;
+	ureq->nreq.complete_cb = ubus_event_complete_cb;
+	list_add(&ureq->list, &hapd->ubus.pending);
+	eloop_register_timeout(1, 0, ubus_event_req_timeout, ureq, NULL);
+	ubus_complete_request_async(ctx, &ureq->nreq.req);
 }
 
 int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_request *req)
@@ -1886,6 +2614,7 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 	};
 	const char *type = "mgmt";
 	struct ubus_event_req ureq = {};
+	struct ubus_sta_verdict *v;
 	const u8 *addr;
 
 	if (req->mgmt_frame)
@@ -1900,6 +2629,24 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 	if (!hapd->ubus.obj.has_subscribers)
 		return WLAN_STATUS_SUCCESS;
 
+	v = hostapd_bss_get_verdict(hapd, addr, false);
+
+	/* Coalesce repeated probe requests from the same station */
+	if (req->type == HOSTAPD_UBUS_PROBE_REQ && hapd->ubus.probe_interval > 0) {
+		struct os_reltime now, age;
+
+		os_get_reltime(&now);
+		if (v && v->probe_notified.sec) {
+			os_reltime_sub(&now, &v->probe_notified, &age);
+			if (age.sec * 1000 + age.usec / 1000 < hapd->ubus.probe_interval)
+				return hostapd_bss_cached_verdict(v, req->type);
+		}
+
+		v = hostapd_bss_get_verdict(hapd, addr, true);
+		if (v)
+			v->probe_notified = now;
+	}
+
 	if (req->type < ARRAY_SIZE(types))
 		type = types[req->type];
 
@@ -1957,9 +2704,17 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 		return WLAN_STATUS_SUCCESS;
 	}
 
+	if (hapd->ubus.notify_async) {
+		hostapd_ubus_notify_async(hapd, type, req->type, addr);
+		return hostapd_bss_cached_verdict(v, req->type);
+	}
+
 	if (ubus_notify_async(ctx, &hapd->ubus.obj, type, b.head, &ureq.nreq))
 		return WLAN_STATUS_SUCCESS;
 
+	ureq.hapd = hapd;
+	ureq.type = req->type;
+	memcpy(ureq.addr, addr, ETH_ALEN);
 	ureq.nreq.status_cb = ubus_event_cb;
 	ubus_complete_request(ctx, &ureq.nreq.req, 100);
 
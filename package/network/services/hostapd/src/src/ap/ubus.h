@@ -36,7 +36,15 @@ struct rrm_measurement_beacon_report;
 struct hostapd_ubus_bss {
 	struct ubus_object obj;
 	struct avl_tree banned;
+	struct avl_tree verdicts;
+	struct list_head pending;
 	int notify_response;
+	int notify_async;
+	int verdict_ttl; /* ms */
+	int probe_interval; /* ms */
+	struct avl_tree clients;
+	u32 clients_gen;
+	u32 clients_pruned;
 };
 
 void hostapd_ubus_add_iface(struct hostapd_iface *iface);
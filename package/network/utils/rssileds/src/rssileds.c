@@ -26,21 +26,49 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <net/if.h>
+
+#include <linux/nl80211.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/msg.h>
+#include <netlink/attr.h>
+
+#include <libubox/list.h>
+#include <libubox/uloop.h>
 
 #include "iwinfo.h"
 
 #define RUN_DIR			"/var/run"
+#define STATS_FILE		RUN_DIR "/rssileds.stats"
+#define WPAS_CTRL_DIR		RUN_DIR "/wpa_supplicant"
 #define LEDS_BASEPATH		"/sys/class/leds/"
 #define BACKEND_RETRY_DELAY	500000
+#define DEFAULT_RATELIMIT	200
+#define POLL_BACKOFF_MAX	8
 
 char *ifname;
 int qual_max;
 
+/* counters to compare polling and event mode, dumped on SIGUSR1 */
+struct {
+	unsigned long wakeups;
+	unsigned long events;
+	unsigned long polls;
+	unsigned long writes;
+} stats;
+
+static volatile sig_atomic_t dump_stats;
+
 struct led {
 	char *sysfspath;
 	FILE *controlfd;
@@ -92,6 +120,7 @@ int set_led(struct led *led, unsigned char value)
 
 	fflush(led->controlfd);
 	led->state=value;
+	stats.writes++;
 
 	return 0;
 }
@@ -158,20 +187,22 @@ void close_led(struct led **led)
 }
 
 
-int quality(const struct iwinfo_ops *iw, const char *ifname)
+int quality(const struct iwinfo_ops *iw, const char *ifname, int *qual_max)
 {
 	int qual;
 
 	if ( ! iw ) return -1;
 
-	if (qual_max < 1)
-		if (iw->quality_max(ifname, &qual_max))
+	stats.polls++;
+
+	if (*qual_max < 1)
+		if (iw->quality_max(ifname, qual_max))
 			return -1;
 
 	if (iw->quality(ifname, &qual))
 		return -1;
 
-	return ( qual * 100 ) / qual_max ;
+	return ( qual * 100 ) / *qual_max ;
 }
 
 int open_backend(const struct iwinfo_ops **iw, const char *ifname)
@@ -206,34 +237,64 @@ void update_leds(rule_t *rules, int q)
 	}
 }
 
-int main(int argc, char **argv)
+
+void write_stats(void)
+{
+	FILE *f;
+
+	syslog(LOG_INFO, "wakeups %lu, events %lu, polls %lu, led writes %lu\n",
+		stats.wakeups, stats.events, stats.polls, stats.writes);
+
+	f = fopen(STATS_FILE, "w");
+	if ( ! f )
+		return;
+
+	fprintf(f, "wakeups %lu\nevents %lu\npolls %lu\nwrites %lu\n",
+		stats.wakeups, stats.events, stats.polls, stats.writes);
+	fclose(f);
+}
+
+static int stats_pipe[2] = { -1, -1 };
+
+static void handle_usr1(int sig)
+{
+	int err = errno;
+	ssize_t ret = 0;
+
+	dump_stats = 1;
+	if ( stats_pipe[1] >= 0 )
+		ret = write(stats_pipe[1], "", 1);
+	(void)ret;
+	errno = err;
+}
+
+/*
+ * Parse "(ifname) (refresh) (threshold) (rule) [rule] ..." from argv,
+ * returns the number of arguments consumed or -1 on error.
+ */
+int parse_iface(int argc, char **argv, char **name, int *refresh,
+		int *threshold, rule_t **rules)
 {
-	int i,q,q0,r,s;
-	const struct iwinfo_ops *iw = NULL;
 	rule_t *headrule = NULL, *currentrule = NULL;
+	int i, n;
 
-	if (argc < 9 || ( (argc-4) % 5 != 0 ) )
-	{
-		printf("syntax: %s (ifname) (refresh) (threshold) (rule) [rule] ...\n", argv[0]);
-		printf("  rule: (sysfs-name) (minq) (maxq) (offset) (factore)\n");
-		return 1;
-	}
+	/* arguments up to the next separator */
+	for (n = 0; n < argc && strcmp(argv[n], "--"); n++);
 
-	ifname = argv[1];
+	if ( n < 8 || ( (n-3) % 5 != 0 ) )
+		return -1;
+
+	*name = argv[0];
 
 	/* refresh interval */
-	if ( sscanf(argv[2], "%d", &r) != 1 )
-		return 1;
+	if ( sscanf(argv[1], "%d", refresh) != 1 )
+		return -1;
 
 	/* sustain threshold */
-	if ( sscanf(argv[3], "%d", &s) != 1 )
-		return 1;
-
-	openlog("rssileds", LOG_PID, LOG_DAEMON);
-	syslog(LOG_INFO, "monitoring %s, refresh rate %d, threshold %d\n", ifname, r, s);
+	if ( sscanf(argv[2], "%d", threshold) != 1 )
+		return -1;
 
-	currentrule = headrule;
-	for (i=4; i<argc; i=i+5) {
+	for (i=3; i<n; i=i+5) {
 		if (! currentrule)
 		{
 			/* first element in the list */
@@ -247,26 +308,44 @@ int main(int argc, char **argv)
 			currentrule = currentrule->next;
 		}
 
+		if ( ! currentrule )
+			return -1;
+
 		if ( init_led(&(currentrule->led), argv[i]) )
-			return 1;
-		
+			return -1;
+
 		if ( sscanf(argv[i+1], "%d", &(currentrule->minq)) != 1 )
-			return 1;
+			return -1;
 
 		if ( sscanf(argv[i+2], "%d", &(currentrule->maxq)) != 1 )
-			return 1;
-		
+			return -1;
+
 		if ( sscanf(argv[i+3], "%d", &(currentrule->boffset)) != 1 )
-			return 1;
-		
+			return -1;
+
 		if ( sscanf(argv[i+4], "%d", &(currentrule->bfactor)) != 1 )
-			return 1;
+			return -1;
 	}
-	log_rules(headrule);
+
+	*rules = headrule;
+
+	return n;
+}
+
+int run_poll(int r, int s, rule_t *headrule)
+{
+	int q,q0;
+	const struct iwinfo_ops *iw = NULL;
 
 	q0 = -1;
 	do {
-		q = quality(iw, ifname);
+		stats.wakeups++;
+		if ( dump_stats ) {
+			dump_stats = 0;
+			write_stats();
+		}
+
+		q = quality(iw, ifname, &qual_max);
 		if ( q < q0 - s || q > q0 + s ) {
 			update_leds(headrule, q);
 			q0=q;
@@ -288,3 +367,411 @@ int main(int argc, char **argv)
 
 	return 0;
 }
+
+/*
+ * Event mode: instead of polling every interface at its refresh interval,
+ * wait for nl80211 notifications (station added/removed, connect,
+ * disconnect, CQM signal changes) and only then re-read the quality.
+ *
+ * Station interfaces arm a CQM RSSI threshold around the current signal
+ * with a hysteresis derived from the configured threshold, so the kernel
+ * reports signal changes by itself. nl80211 keeps a single CQM setting per
+ * interface, so interfaces managed by wpa_supplicant are left alone: their
+ * CQM events (e.g. from bgscan) still trigger an update, otherwise they are
+ * polled. Where CQM is not available (e.g. AP mode) the interface is polled
+ * as well, but only while it has a link, and the interval is stretched while
+ * the quality is stable.
+ *
+ * Updates of an interface are rate limited to one per ratelimit ms.
+ */
+struct iface {
+	struct list_head list;
+	char *name;
+	int ifindex;
+	const struct iwinfo_ops *iw;
+	int qual_max;
+	int refresh;
+	int threshold;
+	int q0;
+	int backoff;
+	bool cqm;
+	int64_t last_update;
+	struct uloop_timeout timer;
+	rule_t *rules;
+};
+
+static LIST_HEAD(ifaces);
+static int ratelimit = DEFAULT_RATELIMIT;
+static struct nl_sock *nl_cmd, *nl_event;
+static int nl80211_id;
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int ack_handler(struct nl_msg *msg, void *arg)
+{
+	*(int *)arg = 0;
+	return NL_STOP;
+}
+
+static int finish_handler(struct nl_msg *msg, void *arg)
+{
+	*(int *)arg = 0;
+	return NL_SKIP;
+}
+
+static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
+			 void *arg)
+{
+	*(int *)arg = err->error;
+	return NL_STOP;
+}
+
+/* Ask the kernel to report when the signal leaves thold +/- hyst dBm */
+static int iface_set_cqm(struct iface *iface, int thold, int hyst)
+{
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	struct nlattr *cqm;
+	int err = -ENOMEM;
+
+	msg = nlmsg_alloc();
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if ( ! msg || ! cb )
+		goto out;
+
+	genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_CQM, 0);
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, iface->ifindex);
+	cqm = nla_nest_start(msg, NL80211_ATTR_CQM);
+	nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_THOLD, thold);
+	nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_HYST, hyst);
+	nla_nest_end(msg, cqm);
+
+	err = nl_send_auto_complete(nl_cmd, msg);
+	if ( err < 0 )
+		goto out;
+
+	err = 1;
+	nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
+
+	while ( err > 0 )
+		nl_recvmsgs(nl_cmd, cb);
+
+out:
+	nl_cb_put(cb);
+	nlmsg_free(msg);
+
+	return err;
+}
+
+/* wpa_supplicant owns the CQM thresholds of the interfaces it controls */
+static bool iface_supplicant(struct iface *iface)
+{
+	char path[sizeof(WPAS_CTRL_DIR) + IF_NAMESIZE + 1];
+
+	snprintf(path, sizeof(path), WPAS_CTRL_DIR "/%s", iface->name);
+
+	return ! access(path, F_OK);
+}
+
+static void iface_schedule(struct iface *iface)
+{
+	int64_t delay = iface->last_update + ratelimit - now_ms();
+	int remaining;
+
+	if ( delay < 0 )
+		delay = 0;
+
+	/* an earlier update or poll is already due */
+	remaining = uloop_timeout_remaining(&iface->timer);
+	if ( iface->timer.pending && remaining <= delay )
+		return;
+
+	iface->backoff = 1;
+	uloop_timeout_set(&iface->timer, delay);
+}
+
+static void iface_update(struct uloop_timeout *t)
+{
+	struct iface *iface = container_of(t, struct iface, timer);
+	int q, sig, hyst, interval;
+
+	stats.wakeups++;
+
+	/* wait for NL80211_CMD_NEW_INTERFACE if the interface is gone */
+	if ( ! iface->ifindex )
+		iface->ifindex = if_nametoindex(iface->name);
+
+	if ( ! iface->ifindex ) {
+		update_leds(iface->rules, -1);
+		iface->q0 = -1;
+		return;
+	}
+
+	if ( ! iface->iw && open_backend(&iface->iw, iface->name) ) {
+		uloop_timeout_set(&iface->timer, BACKEND_RETRY_DELAY / 1000);
+		return;
+	}
+
+	iface->last_update = now_ms();
+	q = quality(iface->iw, iface->name, &iface->qual_max);
+	if ( q < iface->q0 - iface->threshold || q > iface->q0 + iface->threshold ) {
+		update_leds(iface->rules, q);
+		iface->q0 = q;
+		iface->backoff = 1;
+
+		/* re-arm CQM around the new signal level */
+		iface->cqm = false;
+		if ( q > 0 && iface->ifindex && ! iface_supplicant(iface) &&
+		     ! iface->iw->signal(iface->name, &sig) ) {
+			hyst = iface->threshold * iface->qual_max / 100;
+			iface->cqm = ! iface_set_cqm(iface, sig, hyst > 0 ? hyst : 1);
+		}
+	} else if ( iface->backoff < POLL_BACKOFF_MAX ) {
+		iface->backoff *= 2;
+	}
+
+	if ( q < 0 ) {
+		/* backend went away, try again later */
+		iface->iw = NULL;
+		iface->qual_max = 0;
+		uloop_timeout_set(&iface->timer, BACKEND_RETRY_DELAY / 1000);
+	} else if ( q > 0 && ! iface->cqm ) {
+		interval = iface->refresh / 1000;
+		if ( interval < 1 )
+			interval = 1;
+		uloop_timeout_set(&iface->timer, interval * iface->backoff);
+	}
+}
+
+static struct iface *iface_find(int ifindex, const char *name)
+{
+	struct iface *iface;
+
+	list_for_each_entry(iface, &ifaces, list) {
+		if ( name ? ! strcmp(iface->name, name) :
+			    iface->ifindex == ifindex )
+			return iface;
+	}
+
+	return NULL;
+}
+
+static int nl80211_event(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct iface *iface = NULL;
+
+	stats.events++;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	switch (gnlh->cmd) {
+	case NL80211_CMD_NEW_INTERFACE:
+	case NL80211_CMD_DEL_INTERFACE:
+		if ( ! tb[NL80211_ATTR_IFNAME] )
+			break;
+
+		iface = iface_find(0, nla_get_string(tb[NL80211_ATTR_IFNAME]));
+		if ( ! iface )
+			break;
+
+		iface->ifindex = 0;
+		if ( gnlh->cmd == NL80211_CMD_NEW_INTERFACE && tb[NL80211_ATTR_IFINDEX] )
+			iface->ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+		iface->cqm = false;
+		iface->qual_max = 0;
+		break;
+
+	case NL80211_CMD_NEW_STATION:
+	case NL80211_CMD_DEL_STATION:
+	case NL80211_CMD_CONNECT:
+	case NL80211_CMD_ROAM:
+	case NL80211_CMD_DISCONNECT:
+	case NL80211_CMD_NOTIFY_CQM:
+		if ( tb[NL80211_ATTR_IFINDEX] )
+			iface = iface_find(nla_get_u32(tb[NL80211_ATTR_IFINDEX]), NULL);
+		break;
+	}
+
+	if ( iface )
+		iface_schedule(iface);
+
+	return NL_SKIP;
+}
+
+static void nl_event_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct iface *iface;
+
+	stats.wakeups++;
+
+	/* on overflow notifications were lost, re-check everything */
+	if ( nl_recvmsgs_default(nl_event) == -NLE_NOMEM )
+		list_for_each_entry(iface, &ifaces, list)
+			iface_schedule(iface);
+}
+
+static void stats_cb(struct uloop_fd *fd, unsigned int events)
+{
+	char buf[16];
+
+	stats.wakeups++;
+	while ( read(fd->fd, buf, sizeof(buf)) > 0 );
+
+	dump_stats = 0;
+	write_stats();
+}
+
+static struct uloop_fd nl_event_fd = { .cb = nl_event_cb };
+static struct uloop_fd stats_fd = { .cb = stats_cb };
+
+static int init_nl80211(void)
+{
+	static const char * const groups[] = { "config", "mlme" };
+	int i, id;
+
+	nl_cmd = nl_socket_alloc();
+	nl_event = nl_socket_alloc();
+	if ( ! nl_cmd || ! nl_event )
+		return -1;
+
+	if ( genl_connect(nl_cmd) || genl_connect(nl_event) )
+		return -1;
+
+	nl80211_id = genl_ctrl_resolve(nl_cmd, "nl80211");
+	if ( nl80211_id < 0 )
+		return -1;
+
+	for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+		id = genl_ctrl_resolve_grp(nl_cmd, "nl80211", groups[i]);
+		if ( id < 0 || nl_socket_add_membership(nl_event, id) )
+			return -1;
+	}
+
+	nl_socket_disable_seq_check(nl_event);
+	nl_socket_modify_cb(nl_event, NL_CB_VALID, NL_CB_CUSTOM,
+			    nl80211_event, NULL);
+
+	nl_event_fd.fd = nl_socket_get_fd(nl_event);
+	fcntl(nl_event_fd.fd, F_SETFL, fcntl(nl_event_fd.fd, F_GETFL) | O_NONBLOCK);
+	uloop_fd_add(&nl_event_fd, ULOOP_READ);
+
+	return 0;
+}
+
+int run_events(void)
+{
+	struct iface *iface;
+
+	uloop_init();
+
+	if ( init_nl80211() ) {
+		syslog(LOG_CRIT, "can't subscribe to nl80211 events\n");
+		return 1;
+	}
+
+	if ( ! pipe(stats_pipe) ) {
+		fcntl(stats_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(stats_pipe[1], F_SETFL, O_NONBLOCK);
+		stats_fd.fd = stats_pipe[0];
+		uloop_fd_add(&stats_fd, ULOOP_READ);
+	}
+
+	list_for_each_entry(iface, &ifaces, list)
+		uloop_timeout_set(&iface->timer, 0);
+
+	uloop_run();
+	uloop_done();
+
+	iwinfo_finish();
+
+	return 0;
+}
+
+void usage(const char *prog)
+{
+	printf("syntax: %s [-e [-l ratelimit]] (ifname) (refresh) (threshold) (rule) [rule] ... [-- (ifname) ...]\n", prog);
+	printf("  rule: (sysfs-name) (minq) (maxq) (offset) (factore)\n");
+	printf("  -e: update on nl80211 events, allows multiple interfaces separated by --\n");
+	printf("  -l: minimum time between updates of an interface in ms (default %d)\n", DEFAULT_RATELIMIT);
+	printf("  SIGUSR1 writes wakeup and LED write counters to " STATS_FILE "\n");
+}
+
+int main(int argc, char **argv)
+{
+	int ch, n, r, s;
+	const char *prog = argv[0];
+	bool events = false;
+	rule_t *headrule = NULL;
+	struct iface *iface;
+
+	while ((ch = getopt(argc, argv, "+el:")) != -1) {
+		switch (ch) {
+		case 'e':
+			events = true;
+			break;
+		case 'l':
+			ratelimit = atoi(optarg);
+			break;
+		default:
+			usage(prog);
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	openlog("rssileds", LOG_PID, LOG_DAEMON);
+	signal(SIGUSR1, handle_usr1);
+
+	while ( argc > 0 ) {
+		n = parse_iface(argc, argv, &ifname, &r, &s, &headrule);
+		if ( n < 0 ) {
+			usage(prog);
+			return 1;
+		}
+
+		syslog(LOG_INFO, "monitoring %s, refresh rate %d, threshold %d\n", ifname, r, s);
+		log_rules(headrule);
+
+		if ( ! events )
+			return run_poll(r, s, headrule);
+
+		iface = calloc(1, sizeof(*iface));
+		if ( ! iface )
+			return 1;
+
+		iface->name = ifname;
+		iface->refresh = r;
+		iface->threshold = s;
+		iface->rules = headrule;
+		iface->q0 = -1;
+		iface->backoff = 1;
+		iface->timer.cb = iface_update;
+		list_add_tail(&iface->list, &ifaces);
+
+		/* skip the separator */
+		if ( n < argc )
+			n++;
+		argc -= n;
+		argv += n;
+	}
+
+	if ( list_empty(&ifaces) ) {
+		usage(prog);
+		return 1;
+	}
+
+	return run_events();
+}
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
@@ -94,8 +95,55 @@ int mtdsize = 0;
 int erasesize = 0;
 int jffs2_skip_bytes=0;
 int mtdtype = 0;
+int pipeline_depth = 0;
+int skip_unchanged = 0;
+int delta = 0;
 uint32_t opt_trxmagic = TRX_MAGIC;
 
+struct image_slot {
+	char *data;
+	int len;
+};
+
+/* ring of erase block sized buffers filled by the image reader thread */
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct image_slot *slots;
+	int fd;
+	int n_slots;
+	int head, tail, count;
+	int pos;
+	int error;
+	bool eof;
+} pipeline = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* per erase block result of a delta write or verify */
+static struct {
+	char *map;
+	int len;
+	int size;
+} block_map;
+
+enum {
+	BLOCK_UNCHANGED = '.',
+	BLOCK_WRITTEN = 'w',
+	BLOCK_DIFFERS = 'x',
+	BLOCK_BAD = 'b',
+};
+
+struct write_stats {
+	struct timespec start;
+	uint64_t bytes;
+	int written;
+	int unchanged;
+	int erased;
+};
+
 int mtd_open(const char *mtd, bool block)
 {
 	FILE *fp;
@@ -184,6 +232,196 @@ int mtd_write_buffer(int fd, const char *buf, int offset, int length)
 	return 0;
 }
 
+static void *
+image_reader(void *arg)
+{
+	struct image_slot *slot;
+	int error = 0;
+	bool eof = false;
+	ssize_t r;
+
+	while (!eof && !error) {
+		pthread_mutex_lock(&pipeline.lock);
+		while (pipeline.count == pipeline.n_slots)
+			pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+		slot = &pipeline.slots[pipeline.head];
+		pthread_mutex_unlock(&pipeline.lock);
+
+		/* the slot is not visible to the writer until count is raised */
+		slot->len = 0;
+		while (slot->len < erasesize) {
+			r = read(pipeline.fd, slot->data + slot->len, erasesize - slot->len);
+			if (r < 0) {
+				if ((errno == EINTR) || (errno == EAGAIN))
+					continue;
+
+				error = errno;
+				break;
+			}
+
+			if (r == 0) {
+				eof = true;
+				break;
+			}
+
+			slot->len += r;
+		}
+
+		pthread_mutex_lock(&pipeline.lock);
+		if (slot->len > 0) {
+			pipeline.head = (pipeline.head + 1) % pipeline.n_slots;
+			pipeline.count++;
+		}
+		pipeline.eof = eof;
+		pipeline.error = error;
+		pthread_cond_broadcast(&pipeline.cond);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	return NULL;
+}
+
+static int
+image_pipeline_start(int imagefd, int depth)
+{
+	int i;
+
+	pipeline.slots = calloc(depth, sizeof(*pipeline.slots));
+	if (!pipeline.slots)
+		return -1;
+
+	for (i = 0; i < depth; i++) {
+		pipeline.slots[i].data = malloc(erasesize);
+		if (!pipeline.slots[i].data)
+			return -1;
+	}
+
+	pipeline.fd = imagefd;
+	pipeline.n_slots = depth;
+
+	if (pthread_create(&pipeline.thread, NULL, image_reader, NULL))
+		return -1;
+
+	return 0;
+}
+
+/* read() replacement used by mtd_write, served from the pipeline if active */
+static ssize_t
+image_read(int imagefd, char *dest, size_t len)
+{
+	struct image_slot *slot;
+	size_t n;
+
+	if (!pipeline.n_slots)
+		return read(imagefd, dest, len);
+
+	pthread_mutex_lock(&pipeline.lock);
+	while (!pipeline.count && !pipeline.eof && !pipeline.error)
+		pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+
+	if (!pipeline.count) {
+		pthread_mutex_unlock(&pipeline.lock);
+		if (!pipeline.error)
+			return 0;
+
+		errno = pipeline.error;
+		return -1;
+	}
+
+	slot = &pipeline.slots[pipeline.tail];
+	pthread_mutex_unlock(&pipeline.lock);
+
+	n = slot->len - pipeline.pos;
+	if (n > len)
+		n = len;
+
+	memcpy(dest, slot->data + pipeline.pos, n);
+	pipeline.pos += n;
+
+	if (pipeline.pos == slot->len) {
+		pthread_mutex_lock(&pipeline.lock);
+		pipeline.pos = 0;
+		pipeline.tail = (pipeline.tail + 1) % pipeline.n_slots;
+		pipeline.count--;
+		pthread_cond_broadcast(&pipeline.cond);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	return n;
+}
+
+/* compare the erase block at offset with the contents of buf */
+static bool
+mtd_block_unchanged(int fd, int offset, const char *buf)
+{
+	static char *cmpbuf;
+	ssize_t r;
+
+	if (!cmpbuf) {
+		cmpbuf = malloc(erasesize);
+		if (!cmpbuf)
+			return false;
+	}
+
+	r = pread(fd, cmpbuf, erasesize, offset);
+	if (r != erasesize)
+		return false;
+
+	return !memcmp(cmpbuf, buf, erasesize);
+}
+
+static void
+block_map_add(char state)
+{
+	if (!delta)
+		return;
+
+	if (block_map.len == block_map.size) {
+		block_map.size = block_map.size ? block_map.size * 2 : 256;
+		block_map.map = realloc(block_map.map, block_map.size);
+		if (!block_map.map) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	block_map.map[block_map.len++] = state;
+}
+
+static void
+block_map_print(void)
+{
+	int i, n[256] = {};
+
+	for (i = 0; i < block_map.len; i++)
+		n[(unsigned char) block_map.map[i]]++;
+
+	fprintf(stderr, "Block map: %d blocks, %d unchanged, %d written, %d differing, %d bad\n",
+		block_map.len, n[BLOCK_UNCHANGED], n[BLOCK_WRITTEN],
+		n[BLOCK_DIFFERS], n[BLOCK_BAD]);
+
+	for (i = 0; i < block_map.len; i += 64)
+		fprintf(stderr, "0x%08x %.*s\n", i * erasesize,
+			MIN(64, block_map.len - i), block_map.map + i);
+}
+
+static void
+write_stats_print(const struct write_stats *stats)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - stats->start.tv_sec) +
+		  (now.tv_nsec - stats->start.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+
+	fprintf(stderr, "Wrote %d blocks (%d unchanged), %d erases, %.2f MB/s\n",
+		stats->written, stats->unchanged, stats->erased,
+		stats->bytes / elapsed / (1024 * 1024));
+}
+
 static int
 image_check(int imagefd, const char *mtd)
 {
@@ -456,6 +694,91 @@ out:
 	return ret;
 }
 
+static int
+mtd_verify_blocks(const char *mtd, char *file)
+{
+	char *fbuf = NULL, *mbuf = NULL;
+	int ffd, fd, flen, mlen;
+	int ret = 0, offset = 0;
+
+	if (quiet < 2)
+		fprintf(stderr, "Comparing %s against %s block by block ...\n", mtd, file);
+
+	ffd = open(file, O_RDONLY);
+	if (ffd < 0) {
+		fprintf(stderr, "Failed to open %s\n", file);
+		return -1;
+	}
+
+	fd = mtd_check_open(mtd);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open mtd device: %s\n", mtd);
+		close(ffd);
+		return -1;
+	}
+
+	fbuf = malloc(erasesize);
+	mbuf = malloc(erasesize);
+	if (!fbuf || !mbuf) {
+		ret = -1;
+		goto out;
+	}
+
+	for (;;) {
+		for (flen = 0; flen < erasesize; flen += ret) {
+			ret = read(ffd, fbuf + flen, erasesize - flen);
+			if (ret < 0 && errno == EINTR)
+				ret = 0;
+			else if (ret <= 0)
+				break;
+		}
+		if (ret < 0)
+			goto out;
+		if (!flen)
+			break;
+
+		while (offset < mtdsize && mtd_block_is_bad(fd, offset)) {
+			block_map_add(BLOCK_BAD);
+			offset += erasesize;
+		}
+
+		if (offset >= mtdsize) {
+			fprintf(stderr, "Image is larger than %s\n", mtd);
+			ret = -1;
+			goto out;
+		}
+
+		mlen = pread(fd, mbuf, flen, offset);
+		if (mlen != flen) {
+			ret = -1;
+			goto out;
+		}
+
+		if (!memcmp(fbuf, mbuf, flen))
+			block_map_add(BLOCK_UNCHANGED);
+		else
+			block_map_add(BLOCK_DIFFERS);
+
+		offset += erasesize;
+	}
+	ret = 0;
+
+	block_map_print();
+	if (memchr(block_map.map, BLOCK_DIFFERS, block_map.len)) {
+		fprintf(stderr, "Failed\n");
+		ret = 1;
+	} else {
+		fprintf(stderr, "Success\n");
+	}
+
+out:
+	free(fbuf);
+	free(mbuf);
+	close(ffd);
+	close(fd);
+	return ret;
+}
+
 static void
 indicate_writing(const char *mtd)
 {
@@ -478,6 +801,8 @@ mtd_write(int imagefd, const char *mtd, char *fis_layout, size_t part_offset)
 	int buflen_raw = 0;
 	int jffs2_replaced = 0;
 	int skip_bad_blocks = 0;
+	bool unchanged;
+	struct write_stats stats = {};
 
 #ifdef FIS_SUPPORT
 	static struct fis_part new_parts[MAX_ARGS];
@@ -544,6 +869,13 @@ next:
 
 	r = 0;
 
+	clock_gettime(CLOCK_MONOTONIC, &stats.start);
+
+	if (pipeline_depth > 0 && image_pipeline_start(imagefd, pipeline_depth) < 0) {
+		fprintf(stderr, "Failed to set up image read pipeline\n");
+		exit(1);
+	}
+
 resume:
 	next = strchr(mtd, ':');
 	if (next) {
@@ -578,7 +910,7 @@ resume:
 	for (;;) {
 		/* buffer may contain data already (from trx check or last mtd partition write attempt) */
 		while (buflen < erasesize) {
-			r = read(imagefd, buf + buflen, erasesize - buflen);
+			r = image_read(imagefd, buf + buflen, erasesize - buflen);
 			if (r < 0) {
 				if ((errno == EINTR) || (errno == EAGAIN))
 					continue;
@@ -643,6 +975,7 @@ resume:
 		}
 
 		/* need to erase the next block before writing data to it */
+		unchanged = false;
 		if(!no_erase)
 		{
 			while (w + buflen > e - skip_bad_blocks) {
@@ -655,12 +988,22 @@ resume:
 
 					skip_bad_blocks += erasesize;
 					e += erasesize;
+					block_map_add(BLOCK_BAD);
 
 					// Move the file pointer along over the bad block.
 					lseek(fd, erasesize, SEEK_CUR);
 					continue;
 				}
 
+				/* leave blocks alone which already hold the data */
+				if (skip_unchanged && !offset && buflen == erasesize &&
+				    w + skip_bad_blocks == e &&
+				    mtd_block_unchanged(fd, e + part_offset, buf)) {
+					unchanged = true;
+					e += erasesize;
+					break;
+				}
+
 				if (mtd_erase_block(fd, e + part_offset) < 0) {
 					if (next) {
 						if (w < e) {
@@ -681,22 +1024,35 @@ resume:
 
 				/* erase the chunk */
 				e += erasesize;
+				stats.erased++;
 			}
 		}
 
-		if (!quiet)
-			fprintf(stderr, "\b\b\b[w]");
+		if (unchanged) {
+			if (!quiet)
+				fprintf(stderr, "\b\b\b[s]");
 
-		if ((result = write(fd, buf + offset, buflen)) < buflen) {
-			if (result < 0) {
-				fprintf(stderr, "Error writing image.\n");
-				exit(1);
-			} else {
-				fprintf(stderr, "Insufficient space.\n");
-				exit(1);
+			lseek(fd, buflen, SEEK_CUR);
+			stats.unchanged++;
+			block_map_add(BLOCK_UNCHANGED);
+		} else {
+			if (!quiet)
+				fprintf(stderr, "\b\b\b[w]");
+
+			if ((result = write(fd, buf + offset, buflen)) < buflen) {
+				if (result < 0) {
+					fprintf(stderr, "Error writing image.\n");
+					exit(1);
+				} else {
+					fprintf(stderr, "Insufficient space.\n");
+					exit(1);
+				}
 			}
+			block_map_add(BLOCK_WRITTEN);
 		}
 		w += buflen;
+		stats.written++;
+		stats.bytes += buflen;
 
 #ifdef FIS_SUPPORT
 		if (cur_part && cur_part->size
@@ -742,6 +1098,12 @@ resume:
 	if (quiet < 2)
 		fprintf(stderr, "\n");
 
+	if (quiet < 2 && (pipeline_depth || skip_unchanged))
+		write_stats_print(&stats);
+
+	if (quiet < 2 && delta)
+		block_map_print();
+
 #ifdef FIS_SUPPORT
 	if (fis_layout) {
 		if (fis_remap(old_parts, n_old, new_parts, n_new) < 0)
@@ -801,6 +1163,14 @@ static void usage(void)
 	"        -q                      quiet mode (once: no [w] on writing,\n"
 	"                                           twice: no status messages)\n"
 	"        -n                      write without first erasing the blocks\n"
+	"        -D                      delta mode: only erase and write blocks that\n"
+	"                                differ from the device and print a block map\n"
+	"                                (for write, implies -u), compare block by\n"
+	"                                block and print a block map (for verify)\n"
+	"        -u                      skip erase and write of blocks that already\n"
+	"                                contain the image data (for write)\n"
+	"        -P <number>             read the image in a separate thread, buffering\n"
+	"                                up to <number> erase blocks ahead (for write)\n"
 	"        -r                      reboot after successful command\n"
 	"        -f                      force write without trx checks\n"
 	"        -e <device>             erase <device> before executing the command\n"
@@ -850,7 +1220,7 @@ static void do_reboot(void)
 
 int main (int argc, char **argv)
 {
-	int ch, i, boot, imagefd = 0, force, unlocked;
+	int ch, i, boot, imagefd = 0, force, unlocked, ret = 0;
 	char *erase[MAX_ARGS], *device = NULL;
 	char *fis_layout = NULL;
 	size_t offset = 0, data_size = 0, part_offset = 0, dump_len = 0;
@@ -879,7 +1249,7 @@ int main (int argc, char **argv)
 #ifdef FIS_SUPPORT
 			"F:"
 #endif
-			"frnqe:d:s:j:p:o:c:t:l:M:")) != -1)
+			"frnquDP:e:d:s:j:p:o:c:t:l:M:")) != -1)
 		switch (ch) {
 			case 'f':
 				force = 1;
@@ -890,6 +1260,21 @@ int main (int argc, char **argv)
 			case 'n':
 				no_erase = 1;
 				break;
+			case 'u':
+				skip_unchanged = 1;
+				break;
+			case 'D':
+				delta = 1;
+				skip_unchanged = 1;
+				break;
+			case 'P':
+				errno = 0;
+				pipeline_depth = strtoul(optarg, 0, 0);
+				if (errno) {
+					fprintf(stderr, "-P: illegal numeric string\n");
+					usage();
+				}
+				break;
 			case 'j':
 				jffs2file = optarg;
 				break;
@@ -1056,7 +1441,10 @@ int main (int argc, char **argv)
 				mtd_unlock(device);
 			break;
 		case CMD_VERIFY:
-			mtd_verify(device, imagefile);
+			if (delta)
+				ret = mtd_verify_blocks(device, imagefile);
+			else
+				ret = mtd_verify(device, imagefile);
 			break;
 		case CMD_DUMP:
 			mtd_dump(device, offset, dump_len);
@@ -1105,5 +1493,5 @@ int main (int argc, char **argv)
 	if (boot)
 		do_reboot();
 
-	return 0;
+	return ret ? 1 : 0;
 }
@@ -12,9 +12,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
 #endif
@@ -57,6 +62,8 @@
 
 #define UBI_EC_HDR_MAGIC		0x55424923
 
+#define BCM4908IMG_BUF_SIZE		0x10000
+
 static int debug;
 
 struct bcm4908img_tail {
@@ -87,6 +94,8 @@ struct bcm4908img_info {
 	size_t tail_offset;
 	uint32_t crc32;			/* Calculated checksum */
 	struct bcm4908img_tail tail;
+	const uint8_t *map;		/* Read-only mapping of the whole file (optional) */
+	size_t map_size;
 };
 
 char *pathname;
@@ -166,9 +175,71 @@ static const uint32_t crc32_tbl[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
 };
 
+#if defined(__ARM_FEATURE_CRC32)
+
+uint32_t bcm4908img_crc32(uint32_t crc, const void *buf, size_t len) {
+	const uint8_t *in = buf;
+	uint64_t word;
+
+	while (len >= sizeof(word)) {
+		memcpy(&word, in, sizeof(word));
+		crc = __crc32d(crc, le64toh(word));
+		in += sizeof(word);
+		len -= sizeof(word);
+	}
+
+	while (len) {
+		crc = crc32_tbl[(crc ^ *in) & 0xff] ^ (crc >> 8);
+		in++;
+		len--;
+	}
+
+	return crc;
+}
+
+#else
+
+/*
+ * Slicing-by-8: crc32_tbl8[n][i] is the CRC of byte i followed by n zero
+ * bytes, which allows processing 8 bytes per iteration.
+ */
+static uint32_t crc32_tbl8[8][256];
+
+static void bcm4908img_crc32_init(void) {
+	int i, n;
+
+	for (i = 0; i < 256; i++) {
+		crc32_tbl8[0][i] = crc32_tbl[i];
+		for (n = 1; n < 8; n++)
+			crc32_tbl8[n][i] = (crc32_tbl8[n - 1][i] >> 8) ^ crc32_tbl[crc32_tbl8[n - 1][i] & 0xff];
+	}
+}
+
 uint32_t bcm4908img_crc32(uint32_t crc, const void *buf, size_t len) {
+	static bool initialized;
 	const uint8_t *in = buf;
 
+	if (!initialized) {
+		bcm4908img_crc32_init();
+		initialized = true;
+	}
+
+	while (len >= 8) {
+		uint32_t one = crc ^ (in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24);
+		uint32_t two = in[4] | in[5] << 8 | in[6] << 16 | (uint32_t)in[7] << 24;
+
+		crc = crc32_tbl8[7][one & 0xff] ^
+		      crc32_tbl8[6][(one >> 8) & 0xff] ^
+		      crc32_tbl8[5][(one >> 16) & 0xff] ^
+		      crc32_tbl8[4][one >> 24] ^
+		      crc32_tbl8[3][two & 0xff] ^
+		      crc32_tbl8[2][(two >> 8) & 0xff] ^
+		      crc32_tbl8[1][(two >> 16) & 0xff] ^
+		      crc32_tbl8[0][two >> 24];
+		in += 8;
+		len -= 8;
+	}
+
 	while (len) {
 		crc = crc32_tbl[(crc ^ *in) & 0xff] ^ (crc >> 8);
 		in++;
@@ -178,6 +249,8 @@ uint32_t bcm4908img_crc32(uint32_t crc, const void *buf, size_t len) {
 	return crc;
 }
 
+#endif
+
 /**************************************************
  * Helpers
  **************************************************/
@@ -211,16 +284,65 @@ static void bcm4908img_close(FILE *fp) {
 		fclose(fp);
 }
 
+/*
+ * Mapping is only an optimization: if it fails (e.g. unsupported file type)
+ * all accesses fall back to stdio.
+ */
+static void bcm4908img_map(FILE *fp, struct bcm4908img_info *info, size_t size) {
+	void *map;
+
+	if (!size)
+		return;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	info->map = map;
+	info->map_size = size;
+}
+
+static void bcm4908img_unmap(struct bcm4908img_info *info) {
+	if (info->map)
+		munmap((void *)info->map, info->map_size);
+	info->map = NULL;
+	info->map_size = 0;
+}
+
+static int bcm4908img_read(FILE *fp, struct bcm4908img_info *info, size_t offset, void *buf, size_t length) {
+	if (info->map) {
+		if (offset > info->map_size || length > info->map_size - offset)
+			return -EIO;
+		memcpy(buf, info->map + offset, length);
+		return 0;
+	}
+
+	if (fseek(fp, offset, SEEK_SET))
+		return -errno;
+	if (fread(buf, 1, length, fp) != length)
+		return -EIO;
+
+	return 0;
+}
+
 static int bcm4908img_calc_crc32(FILE *fp, struct bcm4908img_info *info) {
-	uint8_t buf[1024];
+	static uint8_t buf[BCM4908IMG_BUF_SIZE];
 	size_t length;
 	size_t bytes;
 
+	info->crc32 = 0xffffffff;
+	length = info->tail_offset - info->cferom_offset;
+
 	/* Start with cferom (or bootfs) - skip vendor header */
+	if (info->map) {
+		info->crc32 = bcm4908img_crc32(info->crc32, info->map + info->cferom_offset, length);
+		return 0;
+	}
+
 	fseek(fp, info->cferom_offset, SEEK_SET);
 
-	info->crc32 = 0xffffffff;
-	length = info->tail_offset - info->cferom_offset;
 	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
 		info->crc32 = bcm4908img_crc32(info->crc32, buf, bytes);
 		length -= bytes;
@@ -282,7 +404,6 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	size_t file_size;
 	uint16_t tmp16;
 	size_t length;
-	size_t bytes;
 	int err = 0;
 
 	memset(info, 0, sizeof(*info));
@@ -296,12 +417,13 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	}
 	file_size = st.st_size;
 
+	bcm4908img_map(fp, info, file_size);
+
 	info->tail_offset = file_size - sizeof(*tail);
 
 	/* Vendor formats */
 
-	rewind(fp);
-	if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) {
+	if (bcm4908img_read(fp, info, 0, buf, sizeof(buf))) {
 		fprintf(stderr, "Failed to read file header\n");
 		return -EIO;
 	}
@@ -309,8 +431,7 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	if (be32_to_cpu(chk->magic) == 0x2a23245e)
 		info->cferom_offset = be32_to_cpu(chk->header_len);
 
-	fseek(fp, -sizeof(buf), SEEK_END);
-	if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) {
+	if (bcm4908img_read(fp, info, file_size - sizeof(buf), buf, sizeof(buf))) {
 		fprintf(stderr, "Failed to read file header\n");
 		return -EIO;
 	}
@@ -324,12 +445,7 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	for (info->bootfs_offset = info->cferom_offset;
 	     info->bootfs_offset < info->tail_offset;
 	     info->bootfs_offset += 0x20000) {
-		if (fseek(fp, info->bootfs_offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek to the 0x%zx\n", info->bootfs_offset);
-			return err;
-		}
-		if (fread(&tmp16, 1, sizeof(tmp16), fp) != sizeof(tmp16)) {
+		if (bcm4908img_read(fp, info, info->bootfs_offset, &tmp16, sizeof(tmp16))) {
 			fprintf(stderr, "Failed to read while looking for JFFS2\n");
 			return -EIO;
 		}
@@ -346,15 +462,8 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	     info->rootfs_offset += 0x20000) {
 		uint32_t *magic = (uint32_t *)&buf[0];
 
-		if (fseek(fp, info->rootfs_offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
-
 		length = info->padding_offset ? sizeof(*magic) : 256;
-		bytes = fread(buf, 1, length, fp);
-		if (bytes != length) {
+		if (bcm4908img_read(fp, info, info->rootfs_offset, buf, length)) {
 			fprintf(stderr, "Failed to read %zu bytes\n", length);
 			return -EIO;
 		}
@@ -372,23 +481,13 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 
 	/* CRC32 */
 
-	/* Start with cferom (or bootfs) - skip vendor header */
-	fseek(fp, info->cferom_offset, SEEK_SET);
-
-	info->crc32 = 0xffffffff;
-	length = info->tail_offset - info->cferom_offset;
-	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
-		info->crc32 = bcm4908img_crc32(info->crc32, buf, bytes);
-		length -= bytes;
-	}
-	if (length) {
-		fprintf(stderr, "Failed to read last %zd B of data\n", length);
-		return -EIO;
-	}
+	err = bcm4908img_calc_crc32(fp, info);
+	if (err)
+		return err;
 
 	/* Tail */
 
-	if (fread(tail, 1, sizeof(*tail), fp) != sizeof(*tail)) {
+	if (bcm4908img_read(fp, info, info->tail_offset, tail, sizeof(*tail))) {
 		fprintf(stderr, "Failed to read BCM4908 image tail\n");
 		return -EIO;
 	}
@@ -444,6 +543,7 @@ static int bcm4908img_info(int argc, char **argv) {
 	printf("Checksum:\t0x%08x\n", info.crc32);
 
 err_close:
+	bcm4908img_unmap(&info);
 	bcm4908img_close(fp);
 out:
 	return err;
@@ -457,7 +557,7 @@ static ssize_t bcm4908img_create_append_file(FILE *trx, const char *in_path, uin
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[1024];
+	static uint8_t buf[BCM4908IMG_BUF_SIZE];
 
 	in = fopen(in_path, "r");
 	if (!in) {
@@ -593,7 +693,7 @@ static int bcm4908img_extract(int argc, char **argv) {
 	struct bcm4908img_info info;
 	const char *pathname = NULL;
 	const char *type = NULL;
-	uint8_t buf[1024];
+	static uint8_t buf[BCM4908IMG_BUF_SIZE];
 	size_t offset;
 	size_t length;
 	size_t bytes;
@@ -658,6 +758,14 @@ static int bcm4908img_extract(int argc, char **argv) {
 		goto err_close;
 	}
 
+	if (info.map) {
+		if (fwrite(info.map + offset, 1, length, stdout) != length) {
+			err = -EIO;
+			fprintf(stderr, "Failed to write %zu B of data\n", length);
+		}
+		goto err_close;
+	}
+
 	fseek(fp, offset, SEEK_SET);
 	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
 		fwrite(buf, bytes, 1, stdout);
@@ -670,6 +778,7 @@ static int bcm4908img_extract(int argc, char **argv) {
 	}
 
 err_close:
+	bcm4908img_unmap(&info);
 	bcm4908img_close(fp);
 err_out:
 	return err;
@@ -745,20 +854,12 @@ static int bcm4908img_bootfs_ls(FILE *fp, struct bcm4908img_info *info) {
 	struct jffs2_unknown_node node;
 	struct jffs2_raw_dirent dirent;
 	size_t offset;
-	size_t bytes;
 	int err = 0;
 
 	for (offset = info->bootfs_offset; ; offset += (je32_to_cpu(node.totlen) + 0x03) & ~0x03) {
 		char name[FILENAME_MAX + 1];
 
-		if (fseek(fp, offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
-
-		bytes = fread(&node, 1, sizeof(node), fp);
-		if (bytes != sizeof(node)) {
+		if (bcm4908img_read(fp, info, offset, &node, sizeof(node))) {
 			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
 			return -EIO;
 		}
@@ -772,8 +873,7 @@ static int bcm4908img_bootfs_ls(FILE *fp, struct bcm4908img_info *info) {
 		}
 
 		memcpy(&dirent, &node, sizeof(node));
-		bytes += fread((uint8_t *)&dirent + sizeof(node), 1, sizeof(dirent) - sizeof(node), fp);
-		if (bytes != sizeof(dirent)) {
+		if (bcm4908img_read(fp, info, offset + sizeof(node), (uint8_t *)&dirent + sizeof(node), sizeof(dirent) - sizeof(node))) {
 			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
 			return -EIO;
 		}
@@ -785,12 +885,11 @@ static int bcm4908img_bootfs_ls(FILE *fp, struct bcm4908img_info *info) {
 			continue;
 		}
 
-		bytes = fread(name, 1, dirent.nsize, fp);
-		if (bytes != dirent.nsize) {
+		if (bcm4908img_read(fp, info, offset + sizeof(dirent), name, dirent.nsize)) {
 			fprintf(stderr, "Failed to read filename\n");
 			return -EIO;
 		}
-		name[bytes] = '\0';
+		name[dirent.nsize] = '\0';
 
 		printf("%s\n", name);
 	}
@@ -823,14 +922,7 @@ static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc
 		char name[FILENAME_MAX];
 		uint32_t crc32;
 
-		if (fseek(fp, offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
-
-		bytes = fread(&node, 1, sizeof(node), fp);
-		if (bytes != sizeof(node)) {
+		if (bcm4908img_read(fp, info, offset, &node, sizeof(node))) {
 			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
 			return -EIO;
 		}
@@ -843,8 +935,7 @@ static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc
 			continue;
 		}
 
-		bytes += fread((uint8_t *)&dirent + sizeof(node), 1, sizeof(dirent) - sizeof(node), fp);
-		if (bytes != sizeof(dirent)) {
+		if (bcm4908img_read(fp, info, offset + sizeof(node), (uint8_t *)&dirent + sizeof(node), sizeof(dirent) - sizeof(node))) {
 			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
 			return -EIO;
 		}
@@ -855,12 +946,11 @@ static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc
 			continue;
 		}
 
-		bytes = fread(name, 1, dirent.nsize, fp);
-		if (bytes != dirent.nsize) {
+		if (bcm4908img_read(fp, info, offset + sizeof(dirent), name, dirent.nsize)) {
 			fprintf(stderr, "Failed to read filename\n");
 			return -EIO;
 		}
-		name[bytes] = '\0';
+		name[dirent.nsize] = '\0';
 
 		if (debug)
 			printf("offset:%08zx name_crc:%04x filename:%s\n", offset, je32_to_cpu(dirent.name_crc), name);
@@ -894,6 +984,7 @@ static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc
 
 		/* Calculate new BCM4908 image checksum */
 
+		fflush(fp);
 		err = bcm4908img_calc_crc32(fp, info);
 		if (err) {
 			fprintf(stderr, "Failed to write new filename\n");
@@ -970,6 +1061,7 @@ static int bcm4908img_bootfs(int argc, char **argv) {
 	}
 
 err_close:
+	bcm4908img_unmap(&info);
 	bcm4908img_close(fp);
 out:
 	return err;
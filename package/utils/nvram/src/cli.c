@@ -104,6 +104,62 @@ static int do_set(nvram_handle_t *nvram, const char *pair)
 	return stat;
 }
 
+static int do_batch(nvram_handle_t *nvram, const char *file, int *commit)
+{
+	FILE *fp = stdin;
+	char *line = NULL, *arg;
+	size_t size = 0;
+	ssize_t len;
+	int stat = 0;
+
+	if( file != NULL && strcmp(file, "-") && (fp = fopen(file, "r")) == NULL )
+	{
+		fprintf(stderr, "Could not open '%s': %s\n", file, strerror(errno));
+		return 1;
+	}
+
+	/* One command per line, all executed against the same handle */
+	while( (len = getline(&line, &size, fp)) >= 0 )
+	{
+		while( len > 0 && (line[len-1] == '\n' || line[len-1] == '\r') )
+			line[--len] = '\0';
+
+		if( !len || line[0] == '#' )
+			continue;
+
+		if( (arg = strchr(line, ' ')) != NULL )
+			*arg++ = '\0';
+
+		if( !strcmp(line, "commit") )
+			*commit = 1;
+		else if( !strcmp(line, "show") )
+			stat |= do_show(nvram);
+		else if( strcmp(line, "get") && strcmp(line, "set") && strcmp(line, "unset") )
+		{
+			fprintf(stderr, "Unknown command '%s' !\n", line);
+			stat = 1;
+		}
+		else if( arg == NULL )
+		{
+			fprintf(stderr, "Command '%s' requires an argument!\n", line);
+			stat = 1;
+		}
+		else if( !strcmp(line, "get") )
+			stat |= do_get(nvram, arg);
+		else if( !strcmp(line, "set") )
+			stat |= do_set(nvram, arg) ? 1 : 0;
+		else
+			stat |= do_unset(nvram, arg) ? 1 : 0;
+	}
+
+	free(line);
+
+	if( fp != stdin )
+		fclose(fp);
+
+	return stat;
+}
+
 static int do_info(nvram_handle_t *nvram)
 {
 	nvram_header_t *hdr = nvram_header(nvram);
@@ -143,6 +199,10 @@ static void usage(void)
 		"	nvram set variable=value [set ...]\n"
 		"	nvram unset variable [unset ...]\n"
 		"	nvram commit\n"
+		"	nvram batch [file]\n"
+		"\n"
+		"In batch mode, get/set/unset/show/commit commands are read one per\n"
+		"line from file or stdin and applied with a single commit at the end.\n"
 	);
 }
 
@@ -151,6 +211,7 @@ int main( int argc, const char *argv[] )
 	nvram_handle_t *nvram;
 	int commit = 0;
 	int write = 0;
+	int batch = 0;
 	int stat = 1;
 	int done = 0;
 	int i;
@@ -163,7 +224,7 @@ int main( int argc, const char *argv[] )
 	/* Ugly... iterate over arguments to see whether we can expect a write */
 	if( ( !strcmp(argv[1], "set")  && 2 < argc ) ||
 		( !strcmp(argv[1], "unset") && 2 < argc ) ||
-		!strcmp(argv[1], "commit") )
+		!strcmp(argv[1], "commit") || !strcmp(argv[1], "batch") )
 		write = 1;
 
 
@@ -215,6 +276,11 @@ int main( int argc, const char *argv[] )
 				commit = 1;
 				done++;
 			}
+			else if( !strcmp(argv[i], "batch") )
+			{
+				batch = do_batch(nvram, ((i+1) < argc) ? argv[++i] : NULL, &commit);
+				done++;
+			}
 			else
 			{
 				fprintf(stderr, "Unknown option '%s' !\n", argv[i]);
@@ -224,12 +290,13 @@ int main( int argc, const char *argv[] )
 		}
 
 		if( write )
-			stat = nvram_commit(nvram);
+			stat = nvram_commit(nvram) || batch;
 
 		nvram_close(nvram);
 
+		/* Keep errors of the commands that ran before the commit */
 		if( commit )
-			stat = staging_to_nvram();
+			stat |= staging_to_nvram() ? 1 : 0;
 	}
 
 	if( !nvram )
@@ -0,0 +1,316 @@
+/*
+ * Functional checks and microbenchmark for libnvram
+ *
+ * Runs against synthetic 64KB partition images in the current directory,
+ * the cli is exercised through its main() with a local staging file:
+ *
+ *	make check
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <time.h>
+
+#include "nvram.h"
+
+#define TEST_IMAGE	"nvram-test.img"
+#define TEST_SCRIPT	"nvram-test.batch"
+#define TEST_STDERR	"nvram-test.stderr"
+#define TEST_SIZE	0x10000
+#define BENCH_VARS	2000
+#define BENCH_CLI_VARS	300
+
+extern size_t nvram_part_size;
+
+/* main() of cli.c, built with NVRAM_STAGING pointing to a local file */
+int nvram_cli_main(int argc, const char *argv[]);
+
+static int failed;
+
+#define CHECK(cond) \
+	do { \
+		if( !(cond) ) { \
+			fprintf(stderr, "%s:%i: check failed: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			failed++; \
+		} \
+	} while(0)
+
+static int check_str(const char *val, const char *expect)
+{
+	if( !val || !expect )
+		return val == expect;
+
+	return !strcmp(val, expect);
+}
+
+/* Write an empty image holding only the given "name=value\0" data */
+static int make_image(const char *file, const char *data, size_t len)
+{
+	static char buf[TEST_SIZE];
+	nvram_header_t *hdr = (nvram_header_t *) buf;
+	int fd;
+
+	memset(buf, 0xFF, sizeof(buf));
+	hdr->magic = NVRAM_MAGIC;
+	hdr->len = NVRAM_ROUNDUP(sizeof(*hdr) + len + 1, 4);
+	memcpy(&hdr[1], data, len);
+	memset((char *) &hdr[1] + len, 0, hdr->len - sizeof(*hdr) - len);
+
+	if( (fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+	    write(fd, buf, sizeof(buf)) != sizeof(buf) )
+	{
+		perror(file);
+		return -1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void test_store(void)
+{
+	static const char data[] = "foo=bar\0baz=qux\0";
+	nvram_handle_t *h;
+
+	CHECK(make_image(TEST_IMAGE, data, sizeof(data) - 1) == 0);
+	CHECK((h = nvram_open(TEST_IMAGE, NVRAM_RW)) != NULL);
+	if( !h )
+		return;
+
+	CHECK(check_str(nvram_get(h, "foo"), "bar"));
+	CHECK(check_str(nvram_get(h, "baz"), "qux"));
+
+	/* unset, then set a value fitting the old space */
+	CHECK(nvram_unset(h, "foo") == 0);
+	CHECK(nvram_get(h, "foo") == NULL);
+	CHECK(nvram_set(h, "foo", "hi") == 0);
+	CHECK(check_str(nvram_get(h, "foo"), "hi"));
+
+	/* unset, then set a longer value */
+	CHECK(nvram_unset(h, "baz") == 0);
+	CHECK(nvram_set(h, "baz", "a much longer value") == 0);
+	CHECK(check_str(nvram_get(h, "baz"), "a much longer value"));
+
+	CHECK(nvram_set(h, "gone", "1") == 0);
+	CHECK(nvram_unset(h, "gone") == 0);
+
+	CHECK(nvram_commit(h) == 0);
+	nvram_close(h);
+
+	CHECK((h = nvram_open(TEST_IMAGE, NVRAM_RO)) != NULL);
+	if( !h )
+		return;
+
+	CHECK(check_str(nvram_get(h, "foo"), "hi"));
+	CHECK(check_str(nvram_get(h, "baz"), "a much longer value"));
+	CHECK(nvram_get(h, "gone") == NULL);
+	nvram_close(h);
+}
+
+static void bench_store(void)
+{
+	char name[16], value[32];
+	nvram_handle_t *h;
+	double t, t_set, t_get, t_commit;
+	int i, j;
+
+	if( make_image(TEST_IMAGE, "", 0) || !(h = nvram_open(TEST_IMAGE, NVRAM_RW)) )
+	{
+		failed++;
+		return;
+	}
+
+	t = now();
+	for( i = 0; i < BENCH_VARS; i++ )
+	{
+		sprintf(name, "var%04d", i);
+		sprintf(value, "value-%08d", i);
+		nvram_set(h, name, value);
+	}
+	t_set = now() - t;
+
+	t = now();
+	for( j = 0; j < 100; j++ )
+	{
+		for( i = 0; i < BENCH_VARS; i++ )
+		{
+			sprintf(name, "var%04d", i);
+			if( !nvram_get(h, name) )
+				failed++;
+		}
+	}
+	t_get = now() - t;
+
+	t = now();
+	for( j = 0; j < 100; j++ )
+		nvram_commit(h);
+	t_commit = now() - t;
+
+	nvram_close(h);
+
+	printf("set:    %8.0f ns/op\n", t_set * 1e9 / BENCH_VARS);
+	printf("get:    %8.0f ns/op\n", t_get * 1e9 / (100 * BENCH_VARS));
+	printf("commit: %8.0f us/op (%d variables)\n", t_commit * 1e6 / 100, BENCH_VARS);
+}
+
+static int write_script(const char *script)
+{
+	FILE *fp;
+
+	if( !(fp = fopen(TEST_SCRIPT, "w")) )
+	{
+		perror(TEST_SCRIPT);
+		return -1;
+	}
+
+	fputs(script, fp);
+	fclose(fp);
+	return 0;
+}
+
+static int run_batch(const char *script)
+{
+	const char *argv[] = { "nvram", "batch", TEST_SCRIPT, NULL };
+
+	if( write_script(script) )
+		return -1;
+
+	return nvram_cli_main(3, argv);
+}
+
+/* Run a batch and check that its error output contains msg */
+static int run_batch_error(const char *script, const char *msg)
+{
+	char buf[256];
+	ssize_t len;
+	int fd, err, ret;
+
+	fflush(stderr);
+	err = dup(2);
+	if( err < 0 || (fd = open(TEST_STDERR, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 )
+		return 0;
+
+	dup2(fd, 2);
+	ret = run_batch(script);
+	fflush(stderr);
+	dup2(err, 2);
+	close(err);
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	close(fd);
+	unlink(TEST_STDERR);
+
+	buf[len > 0 ? len : 0] = '\0';
+	return ret != 0 && strstr(buf, msg) != NULL;
+}
+
+static const char * staging_get(const char *name)
+{
+	static char value[64];
+	nvram_handle_t *h;
+	const char *v;
+
+	if( !(h = nvram_open(NVRAM_STAGING, NVRAM_RO)) )
+		return NULL;
+
+	v = nvram_get(h, name);
+	if( v )
+		snprintf(value, sizeof(value), "%s", v);
+	nvram_close(h);
+
+	return v ? value : NULL;
+}
+
+static void test_batch(void)
+{
+	static const char data[] = "x=old\0";
+
+	CHECK(make_image(NVRAM_STAGING, data, sizeof(data) - 1) == 0);
+
+	/* unset followed by set of the same variable */
+	CHECK(run_batch("unset x\nset x=1\n") == 0);
+	CHECK(check_str(staging_get("x"), "1"));
+
+	/* a failing line fails the batch, even when the others succeed */
+	CHECK(run_batch("get missing\nset y=2\n") != 0);
+	CHECK(check_str(staging_get("y"), "2"));
+
+	/* ... and is not masked by a following commit */
+	CHECK(run_batch("bogus\nset z=3\ncommit\n") != 0);
+
+	/* unknown commands are reported as such, arguments checked after */
+	CHECK(run_batch_error("bogus\n", "Unknown command 'bogus'"));
+	CHECK(run_batch_error("get\n", "Command 'get' requires an argument"));
+
+	unlink(NVRAM_STAGING);
+}
+
+/* one CLI run per variable against a single batch run */
+static void bench_batch(void)
+{
+	const char *argv[] = { "nvram", "set", NULL, NULL };
+	char pair[32], *script, *p;
+	double t, t_single, t_batch;
+	int i;
+
+	if( !(script = malloc(BENCH_CLI_VARS * 32)) )
+		return;
+
+	CHECK(make_image(NVRAM_STAGING, "", 0) == 0);
+
+	t = now();
+	for( i = 0; i < BENCH_CLI_VARS; i++ )
+	{
+		sprintf(pair, "var%04d=value-%08d", i, i);
+		argv[2] = pair;
+		nvram_cli_main(3, argv);
+	}
+	t_single = now() - t;
+
+	for( i = 0, p = script; i < BENCH_CLI_VARS; i++ )
+		p += sprintf(p, "set var%04d=value-%08d\n", i, i);
+
+	CHECK(make_image(NVRAM_STAGING, "", 0) == 0);
+
+	t = now();
+	CHECK(run_batch(script) == 0);
+	t_batch = now() - t;
+
+	CHECK(check_str(staging_get("var0299"), "value-00000299"));
+
+	free(script);
+	unlink(NVRAM_STAGING);
+
+	printf("cli:    %8.0f us for %d sets, %8.0f us as a batch\n",
+		t_single * 1e6, BENCH_CLI_VARS, t_batch * 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	nvram_part_size = TEST_SIZE;
+
+	test_store();
+	test_batch();
+	bench_store();
+	bench_batch();
+
+	unlink(TEST_IMAGE);
+	unlink(TEST_SCRIPT);
+
+	if( failed )
+		fprintf(stderr, "%d checks failed\n", failed);
+
+	return !!failed;
+}
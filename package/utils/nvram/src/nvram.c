@@ -26,85 +26,119 @@ size_t nvram_part_size = 0;
  * -- Helper functions --
  */
 
-/* String hash */
+/* FNV-1a string hash */
 static uint32_t hash(const char *s)
 {
-	uint32_t hash = 0;
+	uint32_t hash = 0x811c9dc5;
 
-	while (*s)
-		hash = 31 * hash + *s++;
+	while (*s) {
+		hash ^= (uint8_t) *s++;
+		hash *= 0x01000193;
+	}
 
 	return hash;
 }
 
-/* Free all tuples. */
+/* Free arena, entries and index. */
 static void _nvram_free(nvram_handle_t *h)
 {
-	uint32_t i;
-	nvram_tuple_t *t, *next;
-
-	/* Free hash table */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = next) {
-			next = t->next;
-			if (t->value)
-				free(t->value);
-			free(t);
-		}
-		h->nvram_hash[i] = NULL;
-	}
+	struct nvram_arena *a, *next;
 
-	/* Free dead table */
-	for (t = h->nvram_dead; t; t = next) {
-		next = t->next;
-		if (t->value)
-			free(t->value);
-		free(t);
+	for (a = h->arena; a; a = next) {
+		next = a->next;
+		free(a);
 	}
 
-	h->nvram_dead = NULL;
+	free(h->entries);
+	free(h->index);
+
+	h->arena = NULL;
+	h->entries = NULL;
+	h->index = NULL;
+	h->num_entries = h->max_entries = h->index_size = 0;
 }
 
-/* (Re)allocate NVRAM tuples. */
-static nvram_tuple_t * _nvram_realloc( nvram_handle_t *h, nvram_tuple_t *t,
-	const char *name, const char *value )
+/* Allocate string space from the arena. */
+static char * _nvram_alloc(nvram_handle_t *h, size_t len)
 {
-	if ((strlen(value) + 1) > h->length - h->offset)
-		return NULL;
+	struct nvram_arena *a = h->arena;
+	size_t size;
 
-	if (!t) {
-		if (!(t = malloc(sizeof(nvram_tuple_t) + strlen(name) + 1)))
+	if (!a || a->size - a->used < len) {
+		size = (len > h->length) ? len : h->length;
+		if (!(a = malloc(sizeof(*a) + size)))
 			return NULL;
 
-		/* Copy name */
-		t->name = (char *) &t[1];
-		strcpy(t->name, name);
+		a->used = 0;
+		a->size = size;
+		a->next = h->arena;
+		h->arena = a;
+	}
+
+	a->used += len;
 
-		t->value = NULL;
+	return &a->data[a->used - len];
+}
+
+/* Find the index slot of a name, either holding it or empty. */
+static uint32_t * _nvram_slot(nvram_handle_t *h, const char *name, uint32_t hv)
+{
+	uint32_t mask = h->index_size - 1;
+	uint32_t i, *slot;
+	struct nvram_entry *e;
+
+	for (i = hv & mask; ; i = (i + 1) & mask) {
+		slot = &h->index[i];
+		if (!*slot)
+			return slot;
+
+		e = &h->entries[*slot - 1];
+		if (e->hash == hv && !strcmp(e->name, name))
+			return slot;
 	}
+}
 
-	/* Copy value */
-	if (!t->value || strcmp(t->value, value))
-	{
-		if(!(t->value = (char *) realloc(t->value, strlen(value)+1)))
-			return NULL;
+/* Double the index size and reinsert all entries. */
+static int _nvram_grow_index(nvram_handle_t *h)
+{
+	uint32_t size = h->index_size ? h->index_size * 2 : 512;
+	uint32_t *index, i, j;
+
+	if (!(index = calloc(size, sizeof(*index))))
+		return -1;
 
-		strcpy(t->value, value);
-		t->value[strlen(value)] = '\0';
+	for (i = 0; i < h->num_entries; i++) {
+		for (j = h->entries[i].hash & (size - 1); index[j];
+		     j = (j + 1) & (size - 1));
+		index[j] = i + 1;
 	}
 
-	return t;
+	free(h->index);
+	h->index = index;
+	h->index_size = size;
+
+	return 0;
+}
+
+/* Look up an entry by name. */
+static struct nvram_entry * _nvram_find(nvram_handle_t *h, const char *name)
+{
+	uint32_t *slot;
+
+	if (!h->index_size)
+		return NULL;
+
+	slot = _nvram_slot(h, name, hash(name));
+
+	return *slot ? &h->entries[*slot - 1] : NULL;
 }
 
-/* (Re)initialize the hash table. */
-static int _nvram_rehash(nvram_handle_t *h)
+/* Parse the NVRAM contents into the tuple store. */
+static int _nvram_parse(nvram_handle_t *h)
 {
 	nvram_header_t *header = nvram_header(h);
 	char buf[] = "0xXXXXXXXX", *name, *value, *eq;
 
-	/* (Re)initialize hash table */
-	_nvram_free(h);
-
 	/* Parse and set "name=value\0 ... \0\0" */
 	name = (char *) &header[1];
 
@@ -153,55 +187,71 @@ nvram_header_t * nvram_header(nvram_handle_t *h)
 /* Get the value of an NVRAM variable. */
 char * nvram_get(nvram_handle_t *h, const char *name)
 {
-	uint32_t i;
-	nvram_tuple_t *t;
-	char *value;
+	struct nvram_entry *e;
 
 	if (!name)
 		return NULL;
 
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	e = _nvram_find(h, name);
 
-	/* Find the associated tuple in the hash table */
-	for (t = h->nvram_hash[i]; t && strcmp(t->name, name); t = t->next);
-
-	value = t ? t->value : NULL;
-
-	return value;
+	return e ? e->value : NULL;
 }
 
 /* Set the value of an NVRAM variable. */
 int nvram_set(nvram_handle_t *h, const char *name, const char *value)
 {
-	uint32_t i;
-	nvram_tuple_t *t, *u, **prev;
-
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
+	size_t nlen, vlen = strlen(value) + 1;
+	struct nvram_entry *e;
+	uint32_t hv, *slot;
 
-	/* Find the associated tuple in the hash table */
-	for (prev = &h->nvram_hash[i], t = *prev;
-		 t && strcmp(t->name, name); prev = &t->next, t = *prev);
+	if (vlen > h->length - h->offset)
+		return -12; /* -ENOMEM */
 
-	/* (Re)allocate tuple */
-	if (!(u = _nvram_realloc(h, t, name, value)))
+	/* Keep the index at most 3/4 full */
+	if ((h->num_entries + 1) * 4 > h->index_size * 3 &&
+	    _nvram_grow_index(h))
 		return -12; /* -ENOMEM */
 
-	/* Value reallocated */
-	if (t && t == u)
+	hv = hash(name);
+	slot = _nvram_slot(h, name, hv);
+
+	if (*slot) {
+		e = &h->entries[*slot - 1];
+
+		/* Overwrite the value in place if it fits */
+		if (!e->value || vlen > e->space) {
+			if (!(e->value = _nvram_alloc(h, vlen)))
+				return -12; /* -ENOMEM */
+			e->space = vlen;
+		}
+
+		memcpy(e->value, value, vlen);
 		return 0;
+	}
+
+	if (h->num_entries == h->max_entries) {
+		uint32_t max = h->max_entries ? h->max_entries * 2 : 256;
+
+		if (!(e = realloc(h->entries, max * sizeof(*e))))
+			return -12; /* -ENOMEM */
 
-	/* Move old tuple to the dead table */
-	if (t) {
-		*prev = t->next;
-		t->next = h->nvram_dead;
-		h->nvram_dead = t;
+		h->entries = e;
+		h->max_entries = max;
 	}
 
-	/* Add new tuple to the hash table */
-	u->next = h->nvram_hash[i];
-	h->nvram_hash[i] = u;
+	/* Store "name\0value\0" contiguously */
+	nlen = strlen(name) + 1;
+	e = &h->entries[h->num_entries];
+	if (!(e->name = _nvram_alloc(h, nlen + vlen)))
+		return -12; /* -ENOMEM */
+
+	memcpy(e->name, name, nlen);
+	e->value = e->name + nlen;
+	memcpy(e->value, value, vlen);
+	e->hash = hv;
+	e->space = vlen;
+
+	*slot = ++h->num_entries;
 
 	return 0;
 }
@@ -209,24 +259,15 @@ int nvram_set(nvram_handle_t *h, const char *name, const char *value)
 /* Unset the value of an NVRAM variable. */
 int nvram_unset(nvram_handle_t *h, const char *name)
 {
-	uint32_t i;
-	nvram_tuple_t *t, **prev;
+	struct nvram_entry *e;
 
 	if (!name)
 		return 0;
 
-	/* Hash the name */
-	i = hash(name) % NVRAM_ARRAYSIZE(h->nvram_hash);
-
-	/* Find the associated tuple in the hash table */
-	for (prev = &h->nvram_hash[i], t = *prev;
-		 t && strcmp(t->name, name); prev = &t->next, t = *prev);
-
-	/* Move it to the dead table */
-	if (t) {
-		*prev = t->next;
-		t->next = h->nvram_dead;
-		h->nvram_dead = t;
+	/* Keep the entry in the index so a later set can reuse it */
+	if ((e = _nvram_find(h, name)) != NULL) {
+		e->value = NULL;
+		e->space = 0;
 	}
 
 	return 0;
@@ -235,24 +276,25 @@ int nvram_unset(nvram_handle_t *h, const char *name)
 /* Get all NVRAM variables. */
 nvram_tuple_t * nvram_getall(nvram_handle_t *h)
 {
-	int i;
-	nvram_tuple_t *t, *l, *x;
+	uint32_t i;
+	nvram_tuple_t *l, *x;
 
 	l = NULL;
 
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = t->next) {
-			if( (x = (nvram_tuple_t *) malloc(sizeof(nvram_tuple_t))) != NULL )
-			{
-				x->name  = t->name;
-				x->value = t->value;
-				x->next  = l;
-				l = x;
-			}
-			else
-			{
-				break;
-			}
+	for (i = h->num_entries; i > 0; i--) {
+		if (!h->entries[i - 1].value)
+			continue;
+
+		if( (x = (nvram_tuple_t *) malloc(sizeof(nvram_tuple_t))) != NULL )
+		{
+			x->name  = h->entries[i - 1].name;
+			x->value = h->entries[i - 1].value;
+			x->next  = l;
+			l = x;
+		}
+		else
+		{
+			break;
 		}
 	}
 
@@ -265,8 +307,9 @@ int nvram_commit(nvram_handle_t *h)
 	nvram_header_t *header = nvram_header(h);
 	char *init, *config, *refresh, *ncdl;
 	char *ptr, *end;
-	int i;
-	nvram_tuple_t *t;
+	uint32_t i;
+	size_t nlen, vlen;
+	struct nvram_entry *e;
 	nvram_header_t tmp;
 	uint8_t crc;
 
@@ -297,12 +340,19 @@ int nvram_commit(nvram_handle_t *h)
 	end = (char *) header + nvram_part_size - h->offset - 2;
 
 	/* Write out all tuples */
-	for (i = 0; i < NVRAM_ARRAYSIZE(h->nvram_hash); i++) {
-		for (t = h->nvram_hash[i]; t; t = t->next) {
-			if ((ptr + strlen(t->name) + 1 + strlen(t->value) + 1) > end)
-				break;
-			ptr += sprintf(ptr, "%s=%s", t->name, t->value) + 1;
-		}
+	for (i = 0, e = h->entries; i < h->num_entries; i++, e++) {
+		if (!e->value)
+			continue;
+
+		nlen = strlen(e->name);
+		vlen = strlen(e->value) + 1;
+		if ((ptr + nlen + 1 + vlen) > end)
+			break;
+
+		memcpy(ptr, e->name, nlen);
+		ptr[nlen] = '=';
+		memcpy(ptr + nlen + 1, e->value, vlen);
+		ptr += nlen + 1 + vlen;
 	}
 
 	/* End with a double NULL and pad to 4 bytes */
@@ -335,8 +385,7 @@ int nvram_commit(nvram_handle_t *h)
 	msync(h->mmap, h->length, MS_SYNC);
 	fsync(h->fd);
 
-	/* Reinitialize hash table */
-	return _nvram_rehash(h);
+	return 0;
 }
 
 /* Open NVRAM and obtain a handle. */
@@ -402,7 +451,7 @@ nvram_handle_t * nvram_open(const char *file, int rdonly)
 
 				if (header->magic == NVRAM_MAGIC &&
 				    (rdonly || header->len < h->length - h->offset)) {
-					_nvram_rehash(h);
+					_nvram_parse(h);
 					free(mtd);
 					return h;
 				}
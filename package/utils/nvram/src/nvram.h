@@ -43,13 +43,33 @@ struct nvram_tuple {
 	struct nvram_tuple *next;
 };
 
+/* Chunk of the string arena, allocations never move */
+struct nvram_arena {
+	struct nvram_arena *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+/* Variable stored in the arena, value is NULL once unset */
+struct nvram_entry {
+	char *name;
+	char *value;
+	uint32_t hash;
+	uint32_t space;
+};
+
 struct nvram_handle {
 	int fd;
 	char *mmap;
 	unsigned int length;
 	unsigned int offset;
-	struct nvram_tuple *nvram_hash[257];
-	struct nvram_tuple *nvram_dead;
+	struct nvram_arena *arena;
+	struct nvram_entry *entries;
+	uint32_t num_entries;
+	uint32_t max_entries;
+	uint32_t *index;	/* open addressing, entry number + 1 */
+	uint32_t index_size;
 };
 
 typedef struct nvram_handle nvram_handle_t;
@@ -104,7 +124,9 @@ char * nvram_find_staging(void);
 
 
 /* Staging file for NVRAM */
+#ifndef NVRAM_STAGING
 #define NVRAM_STAGING		"/tmp/.nvram"
+#endif
 #define NVRAM_RO			1
 #define NVRAM_RW			0
 
@@ -0,0 +1,665 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Single pass indexer for (gzip compressed) sysupgrade tar archives
+ *
+ * "index" decompresses the archive exactly once, validating every tar
+ * header checksum and (for gzip) the trailer CRC, and prints one line per
+ * regular file member:
+ *
+ *	<size> <offset> <magic> <crc32> <name>
+ *
+ * where <offset> is the position of the data in the uncompressed tar
+ * stream and <magic> the first four bytes in hex. The first line is a
+ * "#" comment identifying the archive, so that an index saved with -c can
+ * be reused as long as the file does not change.
+ *
+ * "extract" streams the given members, in archive order, into the stdin
+ * of a shell command each, again in a single pass. With -i the CRC32 of
+ * each member is checked against a saved index.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define TAR_BLOCK		512
+#define BUF_SIZE		65536
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+struct member {
+	char name[4096];
+	uint64_t size;
+	uint64_t offset;
+	char type;
+};
+
+struct wanted {
+	const char *name;
+	const char *cmd;
+	bool done;
+	bool have_crc;
+	uint32_t crc;
+};
+
+struct scan {
+	gzFile gz;
+	uint64_t pos;
+	unsigned char buf[BUF_SIZE];
+};
+
+static void usage(void)
+{
+	printf("Usage:\n");
+	printf("\n");
+	printf("Index members of a tar archive:\n");
+	printf("\ttarscan index [-c <cache>] <file>\n");
+	printf("\n");
+	printf("Stream members of a tar archive into commands:\n");
+	printf("\ttarscan extract [-i <index>] <file> <member> <command> [<member> <command>]...\n");
+}
+
+/**************************************************
+ * Tar stream
+ **************************************************/
+
+static int scan_read(struct scan *s, void *buf, size_t len)
+{
+	size_t done = 0;
+	int ret;
+
+	while (done < len) {
+		ret = gzread(s->gz, (char *)buf + done, len - done);
+		if (ret < 0) {
+			int err;
+
+			fprintf(stderr, "Failed to read archive: %s\n", gzerror(s->gz, &err));
+			return -EIO;
+		}
+		if (!ret) {
+			fprintf(stderr, "Unexpected end of archive\n");
+			return -EIO;
+		}
+		done += ret;
+	}
+	s->pos += len;
+
+	return 0;
+}
+
+static int scan_skip(struct scan *s, uint64_t len)
+{
+	/* for uncompressed archives this is a plain lseek() */
+	if (len && gzseek(s->gz, len, SEEK_CUR) < 0) {
+		int err;
+
+		fprintf(stderr, "Failed to seek archive: %s\n", gzerror(s->gz, &err));
+		return -EIO;
+	}
+	s->pos += len;
+
+	return 0;
+}
+
+static uint64_t tar_number(const char *field, size_t len)
+{
+	uint64_t val = 0;
+	size_t i;
+
+	/* base-256 encoding used by GNU tar for large values */
+	if (*field & 0x80) {
+		val = *field & 0x7f;
+		for (i = 1; i < len; i++)
+			val = (val << 8) | (unsigned char)field[i];
+		return val;
+	}
+
+	for (i = 0; i < len && (field[i] == ' ' || field[i] == '\0'); i++)
+		;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		val = (val << 3) | (field[i] - '0');
+
+	return val;
+}
+
+static bool tar_chksum_ok(const unsigned char *block)
+{
+	const struct tar_header *hdr = (const struct tar_header *)block;
+	uint64_t expected = tar_number(hdr->chksum, sizeof(hdr->chksum));
+	unsigned int sum = 0;
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++) {
+		if (i >= offsetof(struct tar_header, chksum) &&
+		    i < offsetof(struct tar_header, chksum) + sizeof(hdr->chksum))
+			sum += ' ';
+		else
+			sum += block[i];
+	}
+
+	return sum == expected;
+}
+
+static bool block_is_zero(const unsigned char *block)
+{
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++)
+		if (block[i])
+			return false;
+
+	return true;
+}
+
+/* Read a long name ('L') or the path of a pax header ('x') */
+static int tar_read_ext(struct scan *s, char type, uint64_t size, char *name, size_t name_len)
+{
+	uint64_t padded = (size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1);
+	char *data, *p, *end;
+	int err;
+
+	if (size > 1024 * 1024) {
+		fprintf(stderr, "Extended header too large\n");
+		return -EINVAL;
+	}
+
+	data = malloc(padded + 1);
+	if (!data)
+		return -ENOMEM;
+
+	err = scan_read(s, data, padded);
+	if (err)
+		goto out;
+	data[size] = '\0';
+
+	if (type == 'L') {
+		snprintf(name, name_len, "%s", data);
+		goto out;
+	}
+
+	/* pax records: "<len> <key>=<value>\n" */
+	for (p = data, end = data + size; p < end; ) {
+		char *rec = p;
+		unsigned long len = strtoul(p, &p, 10);
+
+		if (!len || rec + len > end || *p != ' ')
+			break;
+		if (!strncmp(p + 1, "path=", 5))
+			snprintf(name, name_len, "%.*s", (int)(rec + len - p - 7), p + 6);
+		p = rec + len;
+	}
+
+out:
+	free(data);
+	return err;
+}
+
+/*
+ * Read the next member header, skipping extended headers.
+ * Returns 1 at the end of the archive.
+ */
+static int tar_next(struct scan *s, struct member *m)
+{
+	unsigned char block[TAR_BLOCK];
+	struct tar_header *hdr = (struct tar_header *)block;
+	char ext_name[sizeof(m->name)] = "";
+	uint64_t size;
+	int err;
+
+	while (1) {
+		err = scan_read(s, block, TAR_BLOCK);
+		if (err)
+			return err;
+
+		if (block_is_zero(block))
+			return 1;
+
+		if (!tar_chksum_ok(block)) {
+			fprintf(stderr, "Invalid tar header checksum at offset %" PRIu64 "\n",
+				s->pos - TAR_BLOCK);
+			return -EINVAL;
+		}
+
+		size = tar_number(hdr->size, sizeof(hdr->size));
+
+		if (hdr->typeflag == 'L' || hdr->typeflag == 'x') {
+			err = tar_read_ext(s, hdr->typeflag, size, ext_name, sizeof(ext_name));
+			if (err)
+				return err;
+			continue;
+		}
+		if (hdr->typeflag == 'g') {
+			err = scan_skip(s, (size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1));
+			if (err)
+				return err;
+			continue;
+		}
+		break;
+	}
+
+	if (*ext_name)
+		snprintf(m->name, sizeof(m->name), "%s", ext_name);
+	else if (!memcmp(hdr->magic, "ustar", 5) && hdr->prefix[0])
+		snprintf(m->name, sizeof(m->name), "%.*s/%.*s",
+			 (int)strnlen(hdr->prefix, sizeof(hdr->prefix)), hdr->prefix,
+			 (int)strnlen(hdr->name, sizeof(hdr->name)), hdr->name);
+	else
+		snprintf(m->name, sizeof(m->name), "%.*s",
+			 (int)strnlen(hdr->name, sizeof(hdr->name)), hdr->name);
+
+	m->type = hdr->typeflag ? hdr->typeflag : '0';
+	m->size = size;
+	m->offset = s->pos;
+
+	return 0;
+}
+
+/* Read member data, calling out() for every chunk and padding afterwards */
+static int tar_data(struct scan *s, struct member *m, uint32_t *crc,
+		    int (*out)(const void *buf, size_t len, void *priv), void *priv)
+{
+	uint64_t left = m->size;
+	size_t n;
+	int err;
+
+	*crc = crc32(0, NULL, 0);
+	while (left) {
+		n = left < BUF_SIZE ? left : BUF_SIZE;
+		err = scan_read(s, s->buf, n);
+		if (err)
+			return err;
+
+		*crc = crc32(*crc, s->buf, n);
+		if (out) {
+			err = out(s->buf, n, priv);
+			if (err)
+				return err;
+		}
+		left -= n;
+	}
+
+	return scan_skip(s, -m->size & (TAR_BLOCK - 1));
+}
+
+static int scan_open(struct scan *s, const char *file, struct stat *st)
+{
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		return -errno;
+	}
+
+	if (st && fstat(fd, st)) {
+		fprintf(stderr, "Failed to stat %s: %s\n", file, strerror(errno));
+		close(fd);
+		return -errno;
+	}
+
+	/* gzread() reads uncompressed files transparently */
+	s->gz = gzdopen(fd, "rb");
+	if (!s->gz) {
+		close(fd);
+		return -ENOMEM;
+	}
+	gzbuffer(s->gz, BUF_SIZE);
+	s->pos = 0;
+
+	return 0;
+}
+
+/**************************************************
+ * Index
+ **************************************************/
+
+struct magic_out {
+	unsigned char magic[4];
+	size_t len;
+};
+
+static int magic_out(const void *buf, size_t len, void *priv)
+{
+	struct magic_out *mo = priv;
+
+	while (len && mo->len < sizeof(mo->magic)) {
+		mo->magic[mo->len++] = *(const unsigned char *)buf;
+		buf = (const unsigned char *)buf + 1;
+		len--;
+	}
+
+	return 0;
+}
+
+static void index_id(char *buf, size_t len, struct stat *st)
+{
+	snprintf(buf, len, "# tarscan %ju %ju %jd %jd\n", (uintmax_t)st->st_dev,
+		 (uintmax_t)st->st_ino, (intmax_t)st->st_size, (intmax_t)st->st_mtime);
+}
+
+/* Print a saved index if it still describes the archive */
+static bool index_cached(const char *cache, const char *id)
+{
+	char line[4200];
+	bool ok = false;
+	FILE *fp;
+
+	fp = fopen(cache, "r");
+	if (!fp)
+		return false;
+
+	if (fgets(line, sizeof(line), fp) && !strcmp(line, id)) {
+		fputs(line, stdout);
+		while (fgets(line, sizeof(line), fp))
+			fputs(line, stdout);
+		ok = true;
+	}
+	fclose(fp);
+
+	return ok;
+}
+
+static int tarscan_index(int argc, char **argv)
+{
+	const char *cache = NULL;
+	char *tmp = NULL;
+	char id[128];
+	struct scan *s;
+	struct member m;
+	struct stat st;
+	FILE *out = NULL;
+	int err;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:")) != -1) {
+		switch (c) {
+		case 'c':
+			cache = optarg;
+			break;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return -EINVAL;
+	}
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	err = scan_open(s, argv[optind], &st);
+	if (err)
+		goto out_free;
+
+	index_id(id, sizeof(id), &st);
+	if (cache && index_cached(cache, id))
+		goto out_close;
+
+	if (cache) {
+		tmp = malloc(strlen(cache) + 5);
+		if (!tmp) {
+			err = -ENOMEM;
+			goto out_close;
+		}
+		sprintf(tmp, "%s.tmp", cache);
+		out = fopen(tmp, "w");
+	}
+
+	printf("%s", id);
+	if (out)
+		fprintf(out, "%s", id);
+
+	while (!(err = tar_next(s, &m))) {
+		struct magic_out mo = { };
+		uint32_t crc;
+		char line[4200];
+		int i, len;
+
+		err = tar_data(s, &m, &crc, magic_out, &mo);
+		if (err)
+			break;
+
+		if (m.type != '0' && m.type != '7')
+			continue;
+
+		len = snprintf(line, sizeof(line), "%" PRIu64 " %" PRIu64 " ", m.size, m.offset);
+		for (i = 0; i < mo.len; i++)
+			len += snprintf(line + len, sizeof(line) - len, "%02x", mo.magic[i]);
+		if (!mo.len)
+			len += snprintf(line + len, sizeof(line) - len, "-");
+		snprintf(line + len, sizeof(line) - len, " %08x %s\n", crc, m.name);
+
+		fputs(line, stdout);
+		if (out)
+			fputs(line, out);
+	}
+	if (err < 0)
+		goto out_close;
+
+	/* read up to the end, so gzip verifies the trailer CRC */
+	while ((c = gzread(s->gz, s->buf, BUF_SIZE)) > 0)
+		;
+	if (c < 0) {
+		fprintf(stderr, "Failed to read archive: %s\n", gzerror(s->gz, &c));
+		err = -EIO;
+		goto out_close;
+	}
+	err = 0;
+
+	if (out) {
+		if (fclose(out) || rename(tmp, cache))
+			unlink(tmp);
+		out = NULL;
+	}
+
+out_close:
+	if (out) {
+		fclose(out);
+		unlink(tmp);
+	}
+	free(tmp);
+	gzclose(s->gz);
+out_free:
+	free(s);
+	return err;
+}
+
+/**************************************************
+ * Extract
+ **************************************************/
+
+static int pipe_out(const void *buf, size_t len, void *priv)
+{
+	FILE *fp = priv;
+
+	if (fwrite(buf, 1, len, fp) != len) {
+		fprintf(stderr, "Failed to write to command: %s\n", strerror(errno));
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int load_crcs(const char *index, struct wanted *w, int n)
+{
+	char line[4200], name[4097];
+	unsigned int crc;
+	FILE *fp;
+	int i;
+
+	fp = fopen(index, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", index, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%*s %*s %*s %x %4096[^\n]", &crc, name) != 2)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (!strcmp(w[i].name, name)) {
+				w[i].crc = crc;
+				w[i].have_crc = true;
+			}
+		}
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static int tarscan_extract(int argc, char **argv)
+{
+	const char *index = NULL;
+	struct wanted *w;
+	struct scan *s;
+	struct member m;
+	int err = 0;
+	int left;
+	int c, i, n;
+
+	while ((c = getopt(argc, argv, "i:")) != -1) {
+		switch (c) {
+		case 'i':
+			index = optarg;
+			break;
+		}
+	}
+
+	if (argc - optind < 3 || (argc - optind - 1) % 2) {
+		usage();
+		return -EINVAL;
+	}
+
+	n = (argc - optind - 1) / 2;
+	w = calloc(n, sizeof(*w));
+	s = malloc(sizeof(*s));
+	if (!w || !s) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < n; i++) {
+		w[i].name = argv[optind + 1 + 2 * i];
+		w[i].cmd = argv[optind + 2 + 2 * i];
+	}
+
+	if (index) {
+		err = load_crcs(index, w, n);
+		if (err)
+			goto out_free;
+	}
+
+	err = scan_open(s, argv[optind], NULL);
+	if (err)
+		goto out_free;
+
+	/* let failing commands show up as write errors */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (left = n; left && !(err = tar_next(s, &m)); ) {
+		struct wanted *cur = NULL;
+		uint32_t crc;
+		FILE *fp;
+		int ret;
+
+		for (i = 0; i < n; i++)
+			if (!w[i].done && !strcmp(w[i].name, m.name))
+				cur = &w[i];
+
+		if (!cur) {
+			err = scan_skip(s, (m.size + TAR_BLOCK - 1) & ~(uint64_t)(TAR_BLOCK - 1));
+			if (err)
+				break;
+			continue;
+		}
+
+		fflush(stdout);
+		fp = popen(cur->cmd, "w");
+		if (!fp) {
+			fprintf(stderr, "Failed to run %s: %s\n", cur->cmd, strerror(errno));
+			err = -errno;
+			break;
+		}
+
+		err = tar_data(s, &m, &crc, pipe_out, fp);
+		ret = pclose(fp);
+		if (err)
+			break;
+
+		if (ret == -1 || !WIFEXITED(ret) || WEXITSTATUS(ret)) {
+			fprintf(stderr, "Command for %s failed\n", cur->name);
+			err = -EIO;
+			break;
+		}
+
+		if (cur->have_crc && cur->crc != crc) {
+			fprintf(stderr, "CRC mismatch for %s: expected %08x, got %08x\n",
+				cur->name, cur->crc, crc);
+			err = -EINVAL;
+			break;
+		}
+
+		cur->done = true;
+		left--;
+	}
+
+	if (err > 0) {
+		for (i = 0; i < n; i++)
+			if (!w[i].done)
+				fprintf(stderr, "Member %s not found\n", w[i].name);
+		err = -ENOENT;
+	}
+
+	gzclose(s->gz);
+out_free:
+	free(s);
+	free(w);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		optind++;
+		if (!strcmp(argv[1], "index"))
+			return -tarscan_index(argc, argv);
+		else if (!strcmp(argv[1], "extract"))
+			return -tarscan_extract(argc, argv);
+	}
+
+	usage();
+	return 0;
+}
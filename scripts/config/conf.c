@@ -35,6 +35,7 @@ enum input_mode {
 	olddefconfig,
 	yes2modconfig,
 	mod2yesconfig,
+	benchmark,
 	fatalrecursive,
 };
 static enum input_mode input_mode = oldaskconfig;
@@ -679,6 +680,75 @@ static void check_conf(struct menu *menu)
 		check_conf(child);
 }
 
+#define BENCHMARK_TOGGLES	100
+
+static double benchmark_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void benchmark_calc_all(void)
+{
+	struct symbol *sym;
+	int i;
+
+	for_all_symbols(i, sym)
+		sym_calc_value(sym);
+}
+
+/*
+ * Time a full evaluation of all symbols and the re-evaluation after changing
+ * a single symbol, as done by the interactive front ends for every toggle.
+ * Nothing is written.
+ */
+static void conf_benchmark(double parse_time)
+{
+	struct symbol *sym;
+	tristate oldval, newval;
+	double start, full_time, toggle_time = 0;
+	int i, nsyms = 0, toggles = 0;
+
+	for_all_symbols(i, sym)
+		nsyms++;
+
+	start = benchmark_time();
+	sym_clear_all_valid();
+	benchmark_calc_all();
+	full_time = benchmark_time() - start;
+
+	for_all_symbols(i, sym) {
+		if (toggles >= BENCHMARK_TOGGLES)
+			goto done;
+		if (sym_get_type(sym) != S_BOOLEAN && sym_get_type(sym) != S_TRISTATE)
+			continue;
+		if (sym_is_choice(sym) || sym_is_choice_value(sym) ||
+		    !sym_is_changeable(sym))
+			continue;
+
+		oldval = sym_get_tristate_value(sym);
+		newval = oldval == no ? yes : no;
+
+		start = benchmark_time();
+		if (!sym_set_tristate_value(sym, newval))
+			continue;
+		benchmark_calc_all();
+		toggle_time += benchmark_time() - start;
+		toggles++;
+
+		sym_set_tristate_value(sym, oldval);
+		benchmark_calc_all();
+	}
+done:
+	printf("symbols:            %d\n", nsyms);
+	printf("parse:              %.3f ms\n", parse_time);
+	printf("full evaluation:    %.3f ms\n", full_time);
+	printf("single change:      %.3f ms (average of %d)\n",
+	       toggles ? toggle_time / toggles : 0, toggles);
+}
+
 static const struct option long_opts[] = {
 	{"help",          no_argument,       NULL,            'h'},
 	{"silent",        no_argument,       NULL,            's'},
@@ -697,6 +767,7 @@ static const struct option long_opts[] = {
 	{"olddefconfig",  no_argument,       &input_mode_opt, olddefconfig},
 	{"yes2modconfig", no_argument,       &input_mode_opt, yes2modconfig},
 	{"mod2yesconfig", no_argument,       &input_mode_opt, mod2yesconfig},
+	{"benchmark",     no_argument,       &input_mode_opt, benchmark},
 	{"fatalrecursive",no_argument,       NULL, fatalrecursive},
 	{NULL, 0, NULL, 0}
 };
@@ -727,6 +798,7 @@ static void conf_usage(const char *progname)
 	printf("  --randconfig            New config with random answer to all options\n");
 	printf("  --yes2modconfig         Change answers from yes to mod if possible\n");
 	printf("  --mod2yesconfig         Change answers from mod to yes if possible\n");
+	printf("  --benchmark             Time parsing, evaluation and changes of single symbols\n");
 	printf("  (If none of the above is given, --oldaskconfig is the default)\n");
 }
 
@@ -737,6 +809,7 @@ int main(int ac, char **av)
 	const char *name, *defconfig_file = NULL /* gcc uninit */;
 	const char *input_file = NULL, *output_file = NULL;
 	int no_conf_write = 0;
+	double parse_time;
 
 	tty_stdio = isatty(0) && isatty(1);
 
@@ -789,7 +862,9 @@ int main(int ac, char **av)
 		conf_usage(progname);
 		exit(1);
 	}
+	parse_time = benchmark_time();
 	conf_parse(av[optind]);
+	parse_time = benchmark_time() - parse_time;
 	//zconfdump(stdout);
 
 	switch (input_mode) {
@@ -817,6 +892,7 @@ int main(int ac, char **av)
 	case allmodconfig:
 	case alldefconfig:
 	case randconfig:
+	case benchmark:
 		conf_read(input_file);
 		break;
 	default:
@@ -863,6 +939,9 @@ int main(int ac, char **av)
 	case mod2yesconfig:
 		conf_rewrite_mod_or_yes(def_m2y);
 		break;
+	case benchmark:
+		conf_benchmark(parse_time);
+		return 0;
 	case oldaskconfig:
 		rootEntry = &rootmenu;
 		conf(&rootmenu);
@@ -39,6 +39,13 @@ struct symbol *modules_sym;
 static tristate modules_val;
 int recursive_is_error;
 
+struct symbol **symbol_hash;
+unsigned int symbol_hash_size;
+static unsigned int symbol_hash_count;
+
+/* set once the dependents of all symbols have been collected */
+static bool sym_dependents_valid;
+
 enum symbol_type sym_get_type(struct symbol *sym)
 {
 	enum symbol_type type = sym->type;
@@ -456,6 +463,140 @@ void sym_clear_all_valid(void)
 	sym_calc_value(modules_sym);
 }
 
+static void sym_add_dependent(struct symbol *sym, struct symbol *dep)
+{
+	if (!sym || sym == dep || sym->flags & SYMBOL_CONST)
+		return;
+	/* the expressions of a symbol are walked in one go, skip repeats */
+	if (sym->dependents_num && sym->dependents[sym->dependents_num - 1] == dep)
+		return;
+	if (sym->dependents_num == sym->dependents_max) {
+		sym->dependents_max = sym->dependents_max ? sym->dependents_max * 2 : 4;
+		sym->dependents = xrealloc(sym->dependents,
+					   sym->dependents_max * sizeof(*sym->dependents));
+	}
+	sym->dependents[sym->dependents_num++] = dep;
+}
+
+static void expr_add_dependent(struct expr *e, struct symbol *dep)
+{
+	if (!e)
+		return;
+
+	switch (e->type) {
+	case E_SYMBOL:
+		sym_add_dependent(e->left.sym, dep);
+		break;
+	case E_NOT:
+		expr_add_dependent(e->left.expr, dep);
+		break;
+	case E_OR:
+	case E_AND:
+		expr_add_dependent(e->left.expr, dep);
+		expr_add_dependent(e->right.expr, dep);
+		break;
+	case E_LIST:
+		expr_add_dependent(e->left.expr, dep);
+		sym_add_dependent(e->right.sym, dep);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_LTH:
+	case E_LEQ:
+	case E_GTH:
+	case E_GEQ:
+	case E_RANGE:
+		sym_add_dependent(e->left.sym, dep);
+		sym_add_dependent(e->right.sym, dep);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Collect for every symbol the symbols whose value is calculated from it:
+ * all symbols referencing it in their dependencies, reverse dependencies,
+ * prompts, defaults, ranges and choice relations.
+ */
+static void sym_calc_dependents(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym)
+		sym->dependents_num = 0;
+
+	for_all_symbols(i, sym) {
+		if (sym->flags & SYMBOL_CONST)
+			continue;
+		for (prop = sym->prop; prop; prop = prop->next) {
+			/* select and imply are part of the target's rev_dep/implied */
+			if (prop->type == P_SELECT || prop->type == P_IMPLY)
+				continue;
+			expr_add_dependent(prop->expr, sym);
+			expr_add_dependent(prop->visible.expr, sym);
+		}
+		expr_add_dependent(sym->dir_dep.expr, sym);
+		expr_add_dependent(sym->rev_dep.expr, sym);
+		expr_add_dependent(sym->implied.expr, sym);
+	}
+
+	sym_dependents_valid = true;
+}
+
+/*
+ * Like sym_clear_all_valid(), but only invalidates sym and the symbols
+ * depending on it directly or indirectly.
+ */
+void sym_clear_dependents_valid(struct symbol *sym)
+{
+	static struct symbol **queue;
+	static unsigned int queue_size;
+	unsigned int i, head = 0, tail = 0;
+	struct symbol *cur, *dep;
+	bool all = false;
+
+	if (!sym_dependents_valid)
+		sym_calc_dependents();
+
+	if (queue_size < symbol_hash_count) {
+		queue_size = symbol_hash_count;
+		queue = xrealloc(queue, queue_size * sizeof(*queue));
+	}
+
+	sym->flags |= SYMBOL_QUEUED;
+	queue[tail++] = sym;
+	while (head < tail) {
+		cur = queue[head++];
+		/* the type of all tristate symbols depends on MODULES */
+		if (cur == modules_sym) {
+			all = true;
+			break;
+		}
+		cur->flags &= ~SYMBOL_VALID;
+		for (i = 0; i < cur->dependents_num; i++) {
+			dep = cur->dependents[i];
+			if (dep->flags & SYMBOL_QUEUED)
+				continue;
+			dep->flags |= SYMBOL_QUEUED;
+			queue[tail++] = dep;
+		}
+	}
+
+	for (i = 0; i < tail; i++)
+		queue[i]->flags &= ~SYMBOL_QUEUED;
+
+	if (all) {
+		sym_clear_all_valid();
+		return;
+	}
+
+	conf_set_changed(true);
+	sym_calc_value(modules_sym);
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -506,7 +647,7 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_clear_dependents_valid(sym);
 
 	return true;
 }
@@ -663,7 +804,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_dependents_valid(sym);
 
 	return true;
 }
@@ -783,6 +924,29 @@ static unsigned strhash(const char *s)
 	return hash;
 }
 
+/* Double the number of hash buckets, keeping the chains short */
+static void sym_hash_grow(void)
+{
+	unsigned int i, hash, size;
+	struct symbol **table, *sym, *next;
+
+	size = symbol_hash_size ? symbol_hash_size * 2 : SYMBOL_HASHSIZE;
+	table = xcalloc(size, sizeof(*table));
+
+	for (i = 0; i < symbol_hash_size; i++) {
+		for (sym = symbol_hash[i]; sym; sym = next) {
+			next = sym->next;
+			hash = sym->name ? strhash(sym->name) & (size - 1) : 0;
+			sym->next = table[hash];
+			table[hash] = sym;
+		}
+	}
+
+	free(symbol_hash);
+	symbol_hash = table;
+	symbol_hash_size = size;
+}
+
 struct symbol *sym_lookup(const char *name, int flags)
 {
 	struct symbol *symbol;
@@ -797,7 +961,9 @@ struct symbol *sym_lookup(const char *name, int flags)
 			case 'n': return &symbol_no;
 			}
 		}
-		hash = strhash(name) % SYMBOL_HASHSIZE;
+		if (symbol_hash_count >= symbol_hash_size)
+			sym_hash_grow();
+		hash = strhash(name) & (symbol_hash_size - 1);
 
 		for (symbol = symbol_hash[hash]; symbol; symbol = symbol->next) {
 			if (symbol->name &&
@@ -808,6 +974,8 @@ struct symbol *sym_lookup(const char *name, int flags)
 		}
 		new_name = xstrdup(name);
 	} else {
+		if (symbol_hash_count >= symbol_hash_size)
+			sym_hash_grow();
 		new_name = NULL;
 		hash = 0;
 	}
@@ -820,6 +988,8 @@ struct symbol *sym_lookup(const char *name, int flags)
 
 	symbol->next = symbol_hash[hash];
 	symbol_hash[hash] = symbol;
+	symbol_hash_count++;
+	sym_dependents_valid = false;
 
 	return symbol;
 }
@@ -839,7 +1009,9 @@ struct symbol *sym_find(const char *name)
 		case 'n': return &symbol_no;
 		}
 	}
-	hash = strhash(name) % SYMBOL_HASHSIZE;
+	if (!symbol_hash_size)
+		return NULL;
+	hash = strhash(name) & (symbol_hash_size - 1);
 
 	for (symbol = symbol_hash[hash]; symbol; symbol = symbol->next) {
 		if (symbol->name &&
@@ -25,6 +25,8 @@ STAGING_DIR_HOST_TMPL="$DIR/staging_dir_host_tmpl"
 BIN_DIR="$DIR/staging_dir/bin_dir"
 LOG_DIR_NAME="logs"
 LOG_DIR="$DIR/$LOG_DIR_NAME"
+SLOT_DIR="$DIR/slots"
+REPORT="$DIR/report"
 
 die()
 {
@@ -41,6 +43,10 @@ usage()
 	echo "               package test."
 	echo "  --force      Force a test, even if a success/blacklist stamp is available"
 	echo "  -j X         Number of make jobs"
+	echo "  -p X         Test X packages concurrently, each in its own snapshot of the"
+	echo "               build environment. The -j jobs are shared between all tests."
+	echo "  --snapshot M How to create the snapshots for -p: reflink, overlay (needs"
+	echo "               root) or copy. Default: the first one that works."
 	echo
 	echo "PACKAGES are packages to test. If not specified, all installed packages"
 	echo "will be tested."
@@ -52,13 +58,14 @@ deptest_make()
 	shift
 	local logfile="$1"
 	shift
-	make -j$nrjobs "$target" \
+	make $jobflags "$target" \
 		BUILD_DIR="$BUILD_DIR" \
 		BUILD_DIR_HOST="$BUILD_DIR_HOST" \
 		KERNEL_BUILD_DIR="$KERNEL_BUILD_DIR" \
 		BIN_DIR="$BIN_DIR" \
 		STAGING_DIR="$STAGING_DIR" \
 		STAGING_DIR_HOST="$STAGING_DIR_HOST" \
+		${SLOT_TMP_DIR:+"TMP_DIR=$SLOT_TMP_DIR"} \
 		FORCE_HOST_INSTALL=1 \
 		V=99 "$@" >"$LOG_DIR/$logfile" 2>&1
 }
@@ -104,29 +111,201 @@ test_package() # $1=pkgname
 		return
 	}
 	echo "Testing package $pkg..."
-	rm -rf "$STAGING_DIR" "$STAGING_DIR_HOST"
-	mkdir -p "$STAGING_DIR"
-	cp -al "$STAGING_DIR_HOST_TMPL" "$STAGING_DIR_HOST"
-	[ $lean_test -eq 0 ] && {
-		rm -rf "$BUILD_DIR" "$BUILD_DIR_HOST"
-		clean_kernel_build_dir
-	}
-	mkdir -p "$BUILD_DIR" "$BUILD_DIR_HOST"
+	if [ -n "$current_slot" ]; then
+		prepare_slot
+	else
+		rm -rf "$STAGING_DIR" "$STAGING_DIR_HOST"
+		mkdir -p "$STAGING_DIR"
+		cp -al "$STAGING_DIR_HOST_TMPL" "$STAGING_DIR_HOST"
+		[ $lean_test -eq 0 ] && {
+			rm -rf "$BUILD_DIR" "$BUILD_DIR_HOST"
+			clean_kernel_build_dir
+		}
+		mkdir -p "$BUILD_DIR" "$BUILD_DIR_HOST"
+	fi
 	local logfile="$(basename $pkg).log"
+	local start=$SECONDS
 	deptest_make "package/$pkg/compile" "$logfile"
 	if [ $? -eq 0 ]; then
 		( cd "$STAMP_DIR_SUCCESS"; ln -s "../$LOG_DIR_NAME/$logfile" "./$pkg" )
+		echo "ok $((SECONDS - start)) $pkg" >> "$REPORT"
 	else
 		( cd "$STAMP_DIR_FAILED"; ln -s "../$LOG_DIR_NAME/$logfile" "./$pkg" )
+		echo "failed $((SECONDS - start)) $pkg" >> "$REPORT"
 		echo "Building package $pkg FAILED"
 	fi
 }
 
+snapshot_works() # $1=method
+{
+	local tmp="$DIR/snapshot-test"
+	local ret=1
+
+	rm -rf "$tmp"
+	mkdir -p "$tmp/lower" "$tmp/upper" "$tmp/work" "$tmp/merged"
+	touch "$tmp/lower/file"
+	case "$1" in
+	reflink)
+		cp --reflink=always "$tmp/lower/file" "$tmp/copy" 2>/dev/null && ret=0
+		;;
+	overlay)
+		mount -t overlay overlay -o "lowerdir=$tmp/lower,upperdir=$tmp/upper,workdir=$tmp/work" \
+			"$tmp/merged" 2>/dev/null && umount "$tmp/merged" && ret=0
+		;;
+	copy)
+		ret=0
+		;;
+	esac
+	rm -rf "$tmp"
+	return $ret
+}
+
+snapshot_create() # $1=template $2=destination
+{
+	case "$snapshot" in
+	reflink)
+		cp -a --reflink=always "$1" "$2"
+		;;
+	overlay)
+		mkdir -p "$2" "$2.upper" "$2.work"
+		mount -t overlay overlay -o "lowerdir=$1,upperdir=$2.upper,workdir=$2.work" "$2"
+		;;
+	*)
+		# no hardlinks, the kernel build dir gets modified in place
+		cp -a "$1" "$2"
+		;;
+	esac
+}
+
+snapshot_remove() # $1=snapshot
+{
+	[ "$snapshot" = "overlay" ] && mountpoint -q "$1" && umount "$1"
+	rm -rf "$1" "$1.upper" "$1.work"
+}
+
+# Give the current slot fresh copy-on-write snapshots of the templates
+prepare_slot()
+{
+	snapshot_remove "$STAGING_DIR_HOST"
+	rm -rf "$STAGING_DIR"
+	mkdir -p "$STAGING_DIR" "$(dirname "$STAGING_DIR_HOST")"
+	snapshot_create "$STAGING_DIR_HOST_TMPL" "$STAGING_DIR_HOST" || \
+		die "Failed to create snapshot of $STAGING_DIR_HOST_TMPL"
+	[ $lean_test -eq 0 -o ! -d "$KERNEL_BUILD_DIR" ] && {
+		rm -rf "$BUILD_DIR" "$BUILD_DIR_HOST"
+		snapshot_remove "$KERNEL_BUILD_DIR"
+		mkdir -p "$(dirname "$KERNEL_BUILD_DIR")"
+		snapshot_create "$KERNEL_BUILD_DIR_TMPL" "$KERNEL_BUILD_DIR" || \
+			die "Failed to create snapshot of $KERNEL_BUILD_DIR_TMPL"
+	}
+	mkdir -p "$BUILD_DIR" "$BUILD_DIR_HOST" "$BIN_DIR"
+	[ -f "$SLOT_TMP_DIR/.packagedeps" ] || {
+		# private copy of the package metadata, without the deptest dir itself
+		mkdir -p "$SLOT_TMP_DIR"
+		for entry in "$BASEDIR"/tmp/* "$BASEDIR"/tmp/.[!.]*; do
+			[ -e "$entry" ] && [ "$(basename "$entry")" != "deptest" ] || continue
+			cp -a "$entry" "$SLOT_TMP_DIR/" || \
+				die "Failed to copy $entry to $SLOT_TMP_DIR"
+		done
+	}
+}
+
+# Run test_package in slot $1 with its own build and staging directories
+test_package_slot() # $1=slot $2=pkgname
+{
+	local slot="$SLOT_DIR/$1"
+
+	current_slot="$1"
+	BUILD_DIR="$slot/build_dir/target"
+	BUILD_DIR_HOST="$slot/build_dir/host"
+	KERNEL_BUILD_DIR="$slot/build_dir/linux"
+	STAGING_DIR="$slot/staging_dir/target"
+	STAGING_DIR_HOST="$slot/staging_dir/host"
+	BIN_DIR="$slot/bin_dir"
+	SLOT_TMP_DIR="$slot/tmp"
+	test_package "$2"
+}
+
+# Shared GNU make jobserver: every make instance owns one implicit job
+# slot, the remaining ones are handed out as tokens through fd 3.
+jobserver_init()
+{
+	local fifo="$DIR/jobserver"
+	local tokens=$((nrjobs - parallel))
+
+	rm -f "$fifo"
+	mkfifo "$fifo" || die "Failed to create jobserver fifo"
+	exec 3<>"$fifo"
+	rm -f "$fifo"
+	while [ $tokens -gt 0 ]; do
+		printf "+" >&3
+		tokens=$((tokens - 1))
+	done
+	export MAKEFLAGS=" -j --jobserver-fds=3,3 --jobserver-auth=3,3"
+	jobflags=
+}
+
+test_packages() # $@=pkgnames
+{
+	local pkg slot pid
+	local -a slot_pid
+
+	[ $parallel -gt 1 ] || {
+		for pkg in "$@"; do
+			test_package "$pkg"
+		done
+		return
+	}
+
+	for pkg in "$@"; do
+		while true; do
+			for ((slot = 0; slot < parallel; slot++)); do
+				pid="${slot_pid[$slot]}"
+				[ -z "$pid" ] && break 2
+				kill -0 "$pid" 2>/dev/null || break 2
+			done
+			wait -n
+		done
+		test_package_slot "$slot" "$pkg" &
+		slot_pid[$slot]=$!
+	done
+	wait
+
+	[ "$snapshot" = "overlay" ] && {
+		for ((slot = 0; slot < parallel; slot++)); do
+			snapshot_remove "$SLOT_DIR/$slot/staging_dir/host"
+			snapshot_remove "$SLOT_DIR/$slot/build_dir/linux"
+		done
+	}
+}
+
+report()
+{
+	local total=$((SECONDS - report_start))
+
+	[ -s "$REPORT" ] || return
+	echo
+	echo "Summary: $(grep -c '^ok ' "$REPORT") succeeded," \
+		"$(grep -c '^failed ' "$REPORT") failed, wall time ${total}s"
+	echo "Slowest packages:"
+	sort -k2,2nr "$REPORT" | head -n 10 | \
+		while read -r result time pkg; do
+			printf "  %6ss  %-6s  %s\n" "$time" "$result" "$pkg"
+		done
+	grep -q '^failed ' "$REPORT" && {
+		echo "Failed packages:"
+		grep '^failed ' "$REPORT" | cut -d' ' -f3 | sed -e 's/^/  /'
+	}
+	echo "Full report: $REPORT"
+}
+
 # parse commandline options
 packages=
 lean_test=0
 force=0
 nrjobs=1
+parallel=1
+snapshot=
 while [ $# -ne 0 ]; do
 	case "$1" in
 	--help|-h)
@@ -147,6 +326,18 @@ while [ $# -ne 0 ]; do
 			nrjobs="$1"
 		fi
 		;;
+	-p*)
+		if [ -n "${1:2}" ]; then
+			parallel="${1:2}"
+		else
+			shift
+			parallel="$1"
+		fi
+		;;
+	--snapshot)
+		shift
+		snapshot="$1"
+		;;
 	*)
 		packages="$packages $1"
 		;;
@@ -163,6 +354,8 @@ cd "$BASEDIR" || die "Failed to enter base directory"
 mkdir -p "$STAMP_DIR_SUCCESS" "$STAMP_DIR_FAILED" "$STAMP_DIR_BLACKLIST" \
 	"$BIN_DIR" "$LOG_DIR"
 
+jobflags="-j$nrjobs"
+
 bootstrap_deptest_make()
 {
 	local target="$1"
@@ -198,14 +391,36 @@ bootstrap_native_make()
 	echo "Build environment OK."
 }
 
+[ $parallel -gt 1 ] && {
+	if [ -n "$snapshot" ]; then
+		snapshot_works "$snapshot" || die "Snapshot method $snapshot is not available"
+	else
+		for snapshot in reflink overlay copy; do
+			snapshot_works "$snapshot" && break
+		done
+	fi
+	echo "Testing $parallel packages in parallel using $snapshot snapshots"
+
+	# the kernel build dir of the bootstrap is the template for all slots
+	KERNEL_BUILD_DIR_TMPL="$KERNEL_BUILD_DIR"
+	clean_kernel_build_dir
+
+	# each slot has its own tmp dir and thus its own download locks,
+	# fetch all sources up front so that slots never download concurrently
+	echo "Downloading sources..."
+	bootstrap_native_make download
+
+	[ $nrjobs -ge $parallel ] || nrjobs=$parallel
+	jobserver_init
+}
+
+rm -f "$REPORT"
+report_start=$SECONDS
 if [ -z "$packages" ]; then
 	# iterate over all packages
-	for pkg in `cat tmp/.packagedeps  | grep CONFIG_PACKAGE | grep -v curdir | sed -e 's,.*[/=]\s*,,' | sort -u`; do
-		test_package "$pkg"
-	done
+	test_packages `cat tmp/.packagedeps  | grep CONFIG_PACKAGE | grep -v curdir | sed -e 's,.*[/=]\s*,,' | sort -u`
 else
 	# only check the specified packages
-	for pkg in $packages; do
-		test_package "$pkg"
-	done
+	test_packages $packages
 fi
+report
@@ -0,0 +1,210 @@
+#!/usr/bin/env perl
+#
+# Copyright (C) 2026 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Tests the batch mode of download.pl against a local HTTP server. The
+# server answers below these paths:
+#
+#   /good/<file>     the file
+#   /corrupt/<file>  the file with a wrong hash
+#   /missing/<file>  404
+#   /stall/<file>    nothing, the connection is kept open
+#
+# Downloads from anywhere else, e.g. the default OpenWrt mirrors, are
+# refused by the download tool, so no network access is needed.
+#
+# usage: scripts/download-test.pl
+#
+
+use strict;
+use warnings;
+use Cwd qw(abs_path);
+use Digest::SHA qw(sha256_hex);
+use File::Basename;
+use File::Temp qw(tempdir);
+use IO::Socket::INET;
+use POSIX qw(_exit);
+
+my $scriptdir = dirname(abs_path($0));
+my $tmp = tempdir("download-test.XXXXXX", TMPDIR => 1, CLEANUP => 1);
+my %content = map { ("file$_.tar.gz" => "content of file $_\n" x (1000 * $_)) } 1 .. 6;
+my $failed = 0;
+my $case = 0;
+
+sub serve($) {
+	my $conn = shift;
+	my $request = <$conn>;
+	my ($kind, $name) = ($request || "") =~ m!^GET /(\w+)/([^/ ]+) ! or return;
+	my $data = $content{$name};
+
+	while (defined(my $line = <$conn>)) {
+		$line =~ /^\r?\n$/ and last;
+	}
+
+	if ($kind eq "stall") {
+		sleep 3600;
+		return;
+	}
+	if ($kind eq "missing" || !defined $data) {
+		print $conn "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+		return;
+	}
+	$kind eq "corrupt" and $data .= "garbage";
+	print $conn "HTTP/1.0 200 OK\r\nContent-Length: ".length($data)."\r\n\r\n$data";
+}
+
+# Forking HTTP/1.0 server in its own process group, returns its port
+sub server_start() {
+	my $sock = IO::Socket::INET->new(
+		LocalAddr => "127.0.0.1",
+		LocalPort => 0,
+		Listen => 16,
+		ReuseAddr => 1,
+	) or die "Cannot listen: $!\n";
+	my $pid = fork();
+
+	defined $pid or die "fork: $!\n";
+	if (!$pid) {
+		setpgrp(0, 0);
+		$SIG{CHLD} = 'IGNORE';
+		while (my $conn = $sock->accept) {
+			my $child = fork();
+			if (defined $child && !$child) {
+				serve($conn);
+				close $conn;
+				_exit(0);
+			}
+			close $conn;
+		}
+		_exit(0);
+	}
+	my $port = $sock->sockport;
+	close $sock;
+	return ($pid, $port);
+}
+
+my ($server, $port) = server_start();
+my $base = "http://127.0.0.1:$port";
+
+END {
+	kill 'TERM', -$server if $server;
+}
+
+# only talk to the local server
+open my $tool, '>', "$tmp/fetch" or die "Cannot create $tmp/fetch: $!\n";
+print $tool <<"EOF";
+#!/bin/sh
+case "\$1" in
+	$base/*) exec curl -f -s -S "\$1";;
+esac
+echo "refusing to fetch \$1" >&2
+exit 1
+EOF
+close $tool;
+chmod 0755, "$tmp/fetch";
+
+$ENV{DOWNLOAD_TOOL_CUSTOM} = "$tmp/fetch";
+$ENV{TOPDIR} = $tmp;
+$ENV{TMPDIR} = $tmp;
+delete $ENV{DOWNLOAD_MIRROR};
+delete $ENV{DOWNLOAD_CACHE};
+
+# Run download.pl --batch for the given lines of [ file, mirror kinds ... ]
+sub batch($$@) {
+	my ($dir, $opts, @files) = @_;
+	my $list = "$tmp/$dir.list";
+
+	open my $fh, '>', $list or die "Cannot create $list: $!\n";
+	foreach my $file (@files) {
+		my ($name, @kinds) = @$file;
+		print $fh join(" ", "$tmp/$dir", $name, sha256_hex($content{$name}),
+			map { "$base/$_" } @kinds)."\n";
+	}
+	close $fh;
+
+	my $ret = system("$^X '$scriptdir/download.pl' $opts --batch '$list' >'$tmp/$dir.log' 2>&1");
+	return $ret == 0;
+}
+
+sub check($$) {
+	my ($ok, $desc) = @_;
+
+	$case++;
+	print(($ok ? "ok" : "not ok")." $case - $desc\n");
+	$ok or $failed++;
+}
+
+sub log_has($$) {
+	my ($dir, $pattern) = @_;
+
+	open my $fh, '<', "$tmp/$dir.log" or return 0;
+	my $log = join("", <$fh>);
+	close $fh;
+	return $log =~ $pattern;
+}
+
+sub file_ok($$) {
+	my ($dir, $name) = @_;
+
+	open my $fh, '<:raw', "$tmp/$dir/$name" or return 0;
+	my $data = join("", <$fh>);
+	close $fh;
+	return $data eq $content{$name};
+}
+
+sub leftovers($) {
+	my $dir = shift;
+
+	return grep { /\.dl\.\d+/ } glob("$tmp/$dir/*");
+}
+
+# mirror: the first mirror has no copy, the next one has
+check(batch("mirror", "", [ "file1.tar.gz", "missing", "good" ]) &&
+	file_ok("mirror", "file1.tar.gz"), "falls back to the next mirror");
+
+# corrupt: a copy with a wrong hash is discarded
+check(batch("corrupt", "--race 1", [ "file2.tar.gz", "corrupt", "good" ]) &&
+	file_ok("corrupt", "file2.tar.gz") &&
+	log_has("corrupt", qr/does not match/), "skips a corrupt copy");
+check(!batch("corrupt-only", "", [ "file2.tar.gz", "corrupt" ]) &&
+	! -e "$tmp/corrupt-only/file2.tar.gz" && !leftovers("corrupt-only"),
+	"fails without a good copy, leaves nothing behind");
+
+# 404: no mirror has the file
+check(!batch("404", "", [ "file3.tar.gz", "missing", "missing" ]) &&
+	! -e "$tmp/404/file3.tar.gz" &&
+	log_has("404", qr/Failed to download file3\.tar\.gz/), "fails when all mirrors 404");
+
+# stalled: a hanging mirror loses the race and does not block the batch
+{
+	my $start = time;
+	local $SIG{ALRM} = sub { die "timeout\n" };
+	my $ok = eval {
+		alarm 60;
+		my $ret = batch("stalled", "--race 2", [ "file4.tar.gz", "stall", "good" ],
+			[ "file5.tar.gz", "good" ]);
+		alarm 0;
+		$ret;
+	};
+	check($ok && file_ok("stalled", "file4.tar.gz") && file_ok("stalled", "file5.tar.gz") &&
+		!leftovers("stalled"), "races past a stalled mirror (".(time - $start)."s)");
+}
+
+# cache: a second download of the same hash is linked from the cache
+check(batch("cache1", "--cache '$tmp/cache'", [ "file6.tar.gz", "good" ]) &&
+	batch("cache2", "--cache '$tmp/cache'", [ "file6.tar.gz", "missing" ]) &&
+	file_ok("cache2", "file6.tar.gz") &&
+	log_has("cache2", qr/Linked file6\.tar\.gz from download cache/),
+	"links cached files without downloading");
+
+# a cache that cannot be written does not fail the download
+open my $blocker, '>', "$tmp/blocker" or die "Cannot create $tmp/blocker: $!\n";
+close $blocker;
+check(batch("nocache", "--cache '$tmp/blocker/cache'", [ "file1.tar.gz", "good" ]) &&
+	file_ok("nocache", "file1.tar.gz"), "ignores an unusable cache");
+
+print "$failed of $case tests failed\n" if $failed;
+exit($failed ? 1 : 0);
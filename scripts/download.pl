@@ -6,29 +6,57 @@
 # This is free software, licensed under the GNU General Public License v2.
 # See /LICENSE for more information.
 #
+# With --batch, all downloads listed in a file (one set of the usual
+# arguments per line) are fetched concurrently. With --cache or
+# DOWNLOAD_CACHE set, verified files are kept in a directory keyed by their
+# hash and linked into place on later requests for the same hash.
+#
 
 use strict;
 use warnings;
+use Digest::MD5;
+use Digest::SHA;
 use File::Basename;
 use File::Copy;
+use File::Find;
+use File::Path qw(make_path);
+use Getopt::Long qw(:config no_ignore_case require_order);
 use Text::ParseWords;
 
-@ARGV > 2 or die "Syntax: $0 <target dir> <filename> <hash> <url filename> [<mirror> ...]\n";
+my $batch_list;
+my $download_cache = $ENV{DOWNLOAD_CACHE};
+my $download_jobs = $ENV{DOWNLOAD_JOBS} || 8;
+my $download_host_jobs = $ENV{DOWNLOAD_HOST_JOBS} || 2;
+my $download_race = $ENV{DOWNLOAD_RACE} || 2;
+
+GetOptions(
+	'batch=s' => \$batch_list,
+	'cache=s' => \$download_cache,
+	'j|jobs=i' => \$download_jobs,
+	'host-jobs=i' => \$download_host_jobs,
+	'race=i' => \$download_race,
+) or die "Syntax: $0 [--cache <dir>] --batch <list> [-j <jobs>] [--host-jobs <n>] [--race <n>]\n";
+
+defined($batch_list) or @ARGV > 2 or die "Syntax: $0 [--cache <dir>] <target dir> <filename> <hash> <url filename> [<mirror> ...]\n" .
+	"       $0 [--cache <dir>] --batch <list> [-j <jobs>] [--host-jobs <n>] [--race <n>]\n";
 
 my $url_filename;
-my $target = glob(shift @ARGV);
+my $target = @ARGV ? glob(shift @ARGV) : undef;
 my $filename = shift @ARGV;
 my $file_hash = shift @ARGV;
-$url_filename = shift @ARGV unless $ARGV[0] =~ /:\/\//;
+$url_filename = shift @ARGV if @ARGV && $ARGV[0] !~ /:\/\//;
 my $scriptdir = dirname($0);
 my @mirrors;
 my $ok;
 
-my $check_certificate = $ENV{DOWNLOAD_CHECK_CERTIFICATE} eq "y";
-my $custom_tool = $ENV{DOWNLOAD_TOOL_CUSTOM};
+my $check_certificate = ($ENV{DOWNLOAD_CHECK_CERTIFICATE} || "") eq "y";
+my $custom_tool = $ENV{DOWNLOAD_TOOL_CUSTOM} || "";
 my $download_tool;
+my $local_mirrors;
 
 $url_filename or $url_filename = $filename;
+$download_cache and $download_cache =~ s!/+$!!;
+$_ >= 1 or die "Job limits must be at least 1\n" for ($download_jobs, $download_host_jobs, $download_race);
 
 sub localmirrors {
 	my @mlist;
@@ -138,6 +166,398 @@ sub download_cmd {
 	}
 }
 
+sub expand_mirrors {
+	my $filename = shift;
+	$local_mirrors ||= [ localmirrors() ];
+	my @mlist = @$local_mirrors;
+
+	foreach my $mirror (@_) {
+		if ($mirror =~ /^\@SF\/(.+)$/) {
+			# give sourceforge a few more tries, because it redirects to different mirrors
+			for (1 .. 5) {
+				push @mlist, "https://downloads.sourceforge.net/$1";
+			}
+		} elsif ($mirror =~ /^\@OPENWRT$/) {
+			# use OpenWrt source server directly
+		} elsif ($mirror =~ /^\@DEBIAN\/(.+)$/) {
+			push @mlist, "https://ftp.debian.org/debian/$1";
+			push @mlist, "https://mirror.leaseweb.com/debian/$1";
+			push @mlist, "https://mirror.netcologne.de/debian/$1";
+			push @mlist, "https://mirrors.tuna.tsinghua.edu.cn/debian/$1";
+			push @mlist, "https://mirrors.ustc.edu.cn/debian/$1"
+		} elsif ($mirror =~ /^\@APACHE\/(.+)$/) {
+			push @mlist, "https://mirror.netcologne.de/apache.org/$1";
+			push @mlist, "https://mirror.aarnet.edu.au/pub/apache/$1";
+			push @mlist, "https://mirror.csclub.uwaterloo.ca/apache/$1";
+			push @mlist, "https://archive.apache.org/dist/$1";
+			push @mlist, "http://mirror.cogentco.com/pub/apache/$1";
+			push @mlist, "http://mirror.navercorp.com/apache/$1";
+			push @mlist, "http://ftp.jaist.ac.jp/pub/apache/$1";
+			push @mlist, "ftp://apache.cs.utah.edu/apache.org/$1";
+			push @mlist, "ftp://apache.mirrors.ovh.net/ftp.apache.org/dist/$1";
+			push @mlist, "https://mirrors.tuna.tsinghua.edu.cn/apache/$1";
+			push @mlist, "https://mirrors.ustc.edu.cn/apache/$1";
+		} elsif ($mirror =~ /^\@GITHUB\/(.+)$/) {
+			# give github a few more tries (different mirrors)
+			for (1 .. 5) {
+				push @mlist, "https://raw.githubusercontent.com/$1";
+			}
+		} elsif ($mirror =~ /^\@GNU\/(.+)$/) {
+			push @mlist, "https://mirror.csclub.uwaterloo.ca/gnu/$1";
+			push @mlist, "https://mirror.netcologne.de/gnu/$1";
+			push @mlist, "http://ftp.kddilabs.jp/GNU/gnu/$1";
+			push @mlist, "http://www.nic.funet.fi/pub/gnu/gnu/$1";
+			push @mlist, "http://mirror.internode.on.net/pub/gnu/$1";
+			push @mlist, "http://mirror.navercorp.com/gnu/$1";
+			push @mlist, "ftp://mirrors.rit.edu/gnu/$1";
+			push @mlist, "ftp://download.xs4all.nl/pub/gnu/$1";
+			push @mlist, "https://ftp.gnu.org/gnu/$1";
+			push @mlist, "https://mirrors.tuna.tsinghua.edu.cn/gnu/$1";
+			push @mlist, "https://mirrors.ustc.edu.cn/gnu/$1";
+		} elsif ($mirror =~ /^\@SAVANNAH\/(.+)$/) {
+			push @mlist, "https://mirror.netcologne.de/savannah/$1";
+			push @mlist, "https://mirror.csclub.uwaterloo.ca/nongnu/$1";
+			push @mlist, "http://ftp.acc.umu.se/mirror/gnu.org/savannah/$1";
+			push @mlist, "http://nongnu.uib.no/$1";
+			push @mlist, "http://ftp.igh.cnrs.fr/pub/nongnu/$1";
+			push @mlist, "ftp://cdimage.debian.org/mirror/gnu.org/savannah/$1";
+			push @mlist, "ftp://ftp.acc.umu.se/mirror/gnu.org/savannah/$1";
+		} elsif ($mirror =~ /^\@KERNEL\/(.+)$/) {
+			my @extra = ( $1 );
+			if ($filename =~ /linux-\d+\.\d+(?:\.\d+)?-rc/) {
+				push @extra, "$extra[0]/testing";
+			} elsif ($filename =~ /linux-(\d+\.\d+(?:\.\d+)?)/) {
+				push @extra, "$extra[0]/longterm/v$1";
+			}
+			foreach my $dir (@extra) {
+				push @mlist, "https://cdn.kernel.org/pub/$dir";
+				push @mlist, "https://download.xs4all.nl/ftp.kernel.org/pub/$dir";
+				push @mlist, "https://mirrors.mit.edu/kernel/$dir";
+				push @mlist, "http://ftp.nara.wide.ad.jp/pub/kernel.org/$dir";
+				push @mlist, "http://www.ring.gr.jp/archives/linux/kernel.org/$dir";
+				push @mlist, "ftp://ftp.riken.jp/Linux/kernel.org/$dir";
+				push @mlist, "ftp://www.mirrorservice.org/sites/ftp.kernel.org/pub/$dir";
+				push @mlist, "https://mirrors.tuna.tsinghua.edu.cn/kernel/$dir";
+				push @mlist, "https://mirrors.ustc.edu.cn/kernel.org/$dir";
+			}
+		} elsif ($mirror =~ /^\@GNOME\/(.+)$/) {
+			push @mlist, "https://download.gnome.org/sources/$1";
+			push @mlist, "https://mirror.csclub.uwaterloo.ca/gnome/sources/$1";
+			push @mlist, "http://ftp.acc.umu.se/pub/GNOME/sources/$1";
+			push @mlist, "http://ftp.kaist.ac.kr/gnome/sources/$1";
+			push @mlist, "http://www.mirrorservice.org/sites/ftp.gnome.org/pub/GNOME/sources/$1";
+			push @mlist, "http://mirror.internode.on.net/pub/gnome/sources/$1";
+			push @mlist, "http://ftp.belnet.be/ftp.gnome.org/sources/$1";
+			push @mlist, "ftp://ftp.cse.buffalo.edu/pub/Gnome/sources/$1";
+			push @mlist, "ftp://ftp.nara.wide.ad.jp/pub/X11/GNOME/sources/$1";
+			push @mlist, "https://mirrors.ustc.edu.cn/gnome/sources/$1";
+		} else {
+			push @mlist, $mirror;
+		}
+	}
+
+	push @mlist, 'https://sources.cdn.openwrt.org';
+	push @mlist, 'https://sources.openwrt.org';
+	push @mlist, 'https://mirror2.openwrt.org/sources';
+
+	return @mlist;
+}
+
+sub cache_path($) {
+	my $hash = shift;
+
+	$download_cache or return undef;
+	$hash =~ /^[0-9a-f]{32}(?:[0-9a-f]{32})?$/ or return undef;
+	return "$download_cache/".substr($hash, 0, 2)."/$hash";
+}
+
+# Place a copy of $src at $dest, hardlinking where possible
+sub link_or_copy($$) {
+	my ($src, $dest) = @_;
+
+	unlink "$dest.tmp";
+	link($src, "$dest.tmp") or copy($src, "$dest.tmp") or return 0;
+	rename("$dest.tmp", $dest) and return 1;
+	unlink "$dest.tmp";
+	return 0;
+}
+
+# Fetch $name from the content-addressed download cache
+sub cache_fetch($$) {
+	my ($hash, $dest) = @_;
+	my $path = cache_path($hash);
+
+	$path and -f $path or return 0;
+	make_path(dirname($dest));
+	return link_or_copy($path, $dest);
+}
+
+# Add a file with a verified hash to the download cache. Failing to do so
+# only costs the cache entry, the download itself succeeded.
+sub cache_store($$) {
+	my ($hash, $src) = @_;
+	my $path = cache_path($hash);
+	my $err;
+
+	$path and ! -f $path or return;
+	make_path(dirname($path), { error => \$err });
+	if (@$err) {
+		print STDERR "Cannot create download cache directory for $hash - not caching.\n";
+		return;
+	}
+	link_or_copy($src, $path);
+}
+
+sub file_digest($) {
+	my $len = length(shift);
+
+	$len == 64 and return Digest::SHA->new(256);
+	$len == 32 and return Digest::MD5->new;
+	return undef;
+}
+
+sub url_host($) {
+	my $url = shift;
+
+	$url =~ m!^\w+://([^/]+)! or return "";
+	return $1;
+}
+
+# Map file names below each file:// mirror to their paths, walking every
+# mirror only once instead of once per file
+sub local_mirror_index(@) {
+	my %index;
+
+	foreach my $dir (@_) {
+		my %files;
+
+		-d $dir or next;
+		find({
+			follow_fast => 1,
+			no_chdir => 1,
+			wanted => sub { -f $_ and push @{$files{basename($_)}}, $File::Find::name },
+		}, $dir);
+		$index{$dir} = \%files;
+	}
+
+	return %index;
+}
+
+my %local_index;
+
+# Runs in a forked child: fetch $url into $out and verify it against the
+# expected hash. The exit code tells the parent whether the file is usable.
+sub batch_fetch($$$) {
+	my ($dl, $attempt, $out) = @_;
+	my $digest = file_digest($dl->{hash});
+	my $url = $attempt->{url};
+	my $buffer;
+
+	if ($url =~ m!^file://(.*)/([^/]+)$!) {
+		my $files = $local_index{$1} && $local_index{$1}{$2};
+
+		$files && @$files == 1 or do {
+			print STDERR "No unique instance of $2 found in $1\n";
+			return 1;
+		};
+		copy($files->[0], $out) or return 1;
+		if ($digest) {
+			open my $fh, '<:raw', $out or return 1;
+			$digest->addfile($fh);
+			close $fh;
+		}
+	} else {
+		my @cmd = download_cmd($url, $attempt->{name});
+		print STDERR "+ ".join(" ",@cmd)."\n";
+		open my $fetch, '-|', @cmd or return 1;
+		open my $fh, '>:raw', $out or return 1;
+		while (read $fetch, $buffer, 1048576) {
+			$digest and $digest->add($buffer);
+			print $fh $buffer;
+		}
+		close $fh or return 1;
+		close $fetch;
+		$? and return 1;
+	}
+
+	$digest or return 0;
+	my $sum = $digest->hexdigest;
+	$sum eq $dl->{hash} and return 0;
+	print STDERR "Hash of the downloaded file does not match (file: $sum, requested: $dl->{hash})\n";
+	return 1;
+}
+
+sub batch_start($$) {
+	my ($dl, $attempt) = @_;
+	my %used = map { $_->{out} => 1 } values %{$dl->{active}};
+	my $n = 0;
+
+	# racing attempts for the same file each get their own output file
+	$n++ while $used{"$dl->{target}/$dl->{filename}.dl.$n"};
+	my $out = "$dl->{target}/$dl->{filename}.dl.$n";
+
+	my $pid = fork();
+	defined $pid or die "fork: $!\n";
+	if (!$pid) {
+		setpgrp(0, 0);
+		open STDERR, '>', "$out.log";
+		open STDOUT, '>&', \*STDERR;
+		exit batch_fetch($dl, $attempt, $out);
+	}
+
+	$attempt->{out} = $out;
+	$attempt->{dl} = $dl;
+	$dl->{active}{$pid} = $attempt;
+	return $pid;
+}
+
+sub batch_log($) {
+	my $log = shift;
+	my $last = "";
+
+	open my $fh, '<', $log or return "";
+	while (<$fh>) {
+		# skip over curl progress meter updates
+		foreach my $line (split /[\r\n]+/) {
+			$line =~ /\S/ and $line !~ /^[\s\d.:kMG%-]+$/ and $last = $line;
+		}
+	}
+	close $fh;
+	return $last;
+}
+
+# Download all files listed in $list. Each line holds the same arguments as
+# a single download.pl invocation. Files already present in the download
+# cache are linked into place; the remaining ones are fetched concurrently,
+# racing up to $race mirrors per file with at most $host_jobs connections
+# to any one server.
+sub batch_download($) {
+	my $list = shift;
+	my (@queue, %seen, %running, %host_active, @failed);
+	my $fh;
+
+	if ($list eq '-') {
+		$fh = \*STDIN;
+	} else {
+		open $fh, '<', $list or die "Cannot open $list: $!\n";
+	}
+
+	while (<$fh>) {
+		chomp;
+		/\S/ or next;
+		my @args = shellwords($_);
+		@args > 2 or die "$list:$.: Syntax: <target dir> <filename> <hash> <url filename> [<mirror> ...]\n";
+
+		my %dl = (target => shift @args, filename => shift @args, hash => shift @args);
+		my $url_filename = (@args && $args[0] !~ /:\/\//) ? shift @args : undef;
+		$url_filename or $url_filename = $dl{filename};
+		$dl{hash} eq 'skip' or file_digest($dl{hash}) or die "$list:$.: Invalid hash for $dl{filename}\n";
+		$seen{"$dl{target}/$dl{filename}"}++ and next;
+
+		foreach my $mirror (expand_mirrors($dl{filename}, @args)) {
+			$mirror =~ s!/$!!;
+			foreach my $name ($url_filename eq $dl{filename} ? ($url_filename) : ($url_filename, $dl{filename})) {
+				push @{$dl{mirrors}}, { url => "$mirror/$name", name => $name, host => url_host($mirror) };
+			}
+		}
+		$dl{active} = {};
+		push @queue, \%dl;
+	}
+	close $fh unless $list eq '-';
+
+	my (@todo, %local_dirs);
+	foreach my $dl (@queue) {
+		my $dest = "$dl->{target}/$dl->{filename}";
+
+		make_path($dl->{target});
+		if (-f $dest) {
+			my $digest = file_digest($dl->{hash});
+			$digest or next;
+			open my $in, '<:raw', $dest or die "Cannot open $dest: $!\n";
+			$digest->addfile($in);
+			close $in;
+			if ($digest->hexdigest eq $dl->{hash}) {
+				cache_store($dl->{hash}, $dest);
+				next;
+			}
+			print STDERR "Hash of the local file $dl->{filename} does not match - skipping.\n";
+			push @failed, $dl;
+			next;
+		}
+
+		if (cache_fetch($dl->{hash}, $dest)) {
+			print "Linked $dl->{filename} from download cache\n";
+			next;
+		}
+
+		foreach my $m (@{$dl->{mirrors}}) {
+			$m->{url} =~ m!^file://(.*)/[^/]+$! and $local_dirs{$1} = 1;
+		}
+		push @todo, $dl;
+	}
+
+	%local_index = local_mirror_index(keys %local_dirs);
+	$download_tool = select_tool();
+
+	while (@todo || %running) {
+		# start as many attempts as the job, race and host limits allow
+		foreach my $dl (@todo) {
+			keys %running < $download_jobs or last;
+			while (keys %{$dl->{active}} < $download_race && keys %running < $download_jobs) {
+				my %busy = map { $_->{url} => 1 } values %{$dl->{active}};
+				my ($i) = grep {
+					my $m = $dl->{mirrors}[$_];
+					!$busy{$m->{url}} && (!$m->{host} || ($host_active{$m->{host}} || 0) < $download_host_jobs);
+				} 0 .. $#{$dl->{mirrors}};
+				defined $i or last;
+
+				my $attempt = splice(@{$dl->{mirrors}}, $i, 1);
+				my $pid = batch_start($dl, $attempt);
+				$running{$pid} = $attempt;
+				$host_active{$attempt->{host}}++;
+			}
+		}
+
+		foreach my $dl (grep { !$_->{done} && !%{$_->{active}} && !@{$_->{mirrors}} } @todo) {
+			print STDERR "No more mirrors to try for $dl->{filename} - giving up.\n";
+			push @failed, $dl;
+		}
+		@todo = grep { %{$_->{active}} || @{$_->{mirrors}} } @todo;
+		%running or next;
+
+		my $pid = wait();
+		my $attempt = delete $running{$pid} or next;
+		my $dl = $attempt->{dl};
+		my $dest = "$dl->{target}/$dl->{filename}";
+
+		delete $dl->{active}{$pid};
+		$host_active{$attempt->{host}}--;
+
+		if (!$? && !$dl->{done}) {
+			$dl->{done} = 1;
+			unlink $dest;
+			rename($attempt->{out}, $dest) or die "Cannot rename $attempt->{out}: $!\n";
+			cache_store($dl->{hash}, $dest);
+			print "Downloaded $dl->{filename} from $attempt->{url}\n";
+
+			# the race is won, stop the remaining attempts for this file
+			kill 'TERM', -$_, $_ for keys %{$dl->{active}};
+			$dl->{mirrors} = [];
+		} elsif (!$dl->{done}) {
+			my $err = batch_log("$attempt->{out}.log");
+			print STDERR "Download of $dl->{filename} from $attempt->{url} failed".($err ? ": $err" : "")."\n";
+		}
+		unlink $attempt->{out}, "$attempt->{out}.log";
+	}
+
+	foreach my $dl (@failed) {
+		print STDERR "Failed to download $dl->{filename}\n";
+	}
+	return @failed ? 1 : 0;
+}
+
+exit batch_download($batch_list) if defined $batch_list;
+
 my $hash_cmd = hash_cmd();
 $hash_cmd or ($file_hash eq "skip") or die "Cannot find appropriate hash command, ensure the provided hash is either a MD5 or SHA256 checksum.\n";
 
@@ -238,96 +658,7 @@ sub cleanup
 	unlink "$target/$filename.hash";
 }
 
-@mirrors = localmirrors();
-
-foreach my $mirror (@ARGV) {
-	if ($mirror =~ /^\@SF\/(.+)$/) {
-		# give sourceforge a few more tries, because it redirects to different mirrors
-		for (1 .. 5) {
-			push @mirrors, "https://downloads.sourceforge.net/$1";
-		}
-	} elsif ($mirror =~ /^\@OPENWRT$/) {
-		# use OpenWrt source server directly
-	} elsif ($mirror =~ /^\@DEBIAN\/(.+)$/) {
-		push @mirrors, "https://ftp.debian.org/debian/$1";
-		push @mirrors, "https://mirror.leaseweb.com/debian/$1";
-		push @mirrors, "https://mirror.netcologne.de/debian/$1";
-		push @mirrors, "https://mirrors.tuna.tsinghua.edu.cn/debian/$1";
-		push @mirrors, "https://mirrors.ustc.edu.cn/debian/$1"
-	} elsif ($mirror =~ /^\@APACHE\/(.+)$/) {
-		push @mirrors, "https://mirror.netcologne.de/apache.org/$1";
-		push @mirrors, "https://mirror.aarnet.edu.au/pub/apache/$1";
-		push @mirrors, "https://mirror.csclub.uwaterloo.ca/apache/$1";
-		push @mirrors, "https://archive.apache.org/dist/$1";
-		push @mirrors, "http://mirror.cogentco.com/pub/apache/$1";
-		push @mirrors, "http://mirror.navercorp.com/apache/$1";
-		push @mirrors, "http://ftp.jaist.ac.jp/pub/apache/$1";
-		push @mirrors, "ftp://apache.cs.utah.edu/apache.org/$1";
-		push @mirrors, "ftp://apache.mirrors.ovh.net/ftp.apache.org/dist/$1";
-		push @mirrors, "https://mirrors.tuna.tsinghua.edu.cn/apache/$1";
-		push @mirrors, "https://mirrors.ustc.edu.cn/apache/$1";
-	} elsif ($mirror =~ /^\@GITHUB\/(.+)$/) {
-		# give github a few more tries (different mirrors)
-		for (1 .. 5) {
-			push @mirrors, "https://raw.githubusercontent.com/$1";
-		}
-	} elsif ($mirror =~ /^\@GNU\/(.+)$/) {
-		push @mirrors, "https://mirror.csclub.uwaterloo.ca/gnu/$1";
-		push @mirrors, "https://mirror.netcologne.de/gnu/$1";
-		push @mirrors, "http://ftp.kddilabs.jp/GNU/gnu/$1";
-		push @mirrors, "http://www.nic.funet.fi/pub/gnu/gnu/$1";
-		push @mirrors, "http://mirror.internode.on.net/pub/gnu/$1";
-		push @mirrors, "http://mirror.navercorp.com/gnu/$1";
-		push @mirrors, "ftp://mirrors.rit.edu/gnu/$1";
-		push @mirrors, "ftp://download.xs4all.nl/pub/gnu/$1";
-		push @mirrors, "https://ftp.gnu.org/gnu/$1";
-		push @mirrors, "https://mirrors.tuna.tsinghua.edu.cn/gnu/$1";
-		push @mirrors, "https://mirrors.ustc.edu.cn/gnu/$1";
-	} elsif ($mirror =~ /^\@SAVANNAH\/(.+)$/) {
-		push @mirrors, "https://mirror.netcologne.de/savannah/$1";
-		push @mirrors, "https://mirror.csclub.uwaterloo.ca/nongnu/$1";
-		push @mirrors, "http://ftp.acc.umu.se/mirror/gnu.org/savannah/$1";
-		push @mirrors, "http://nongnu.uib.no/$1";
-		push @mirrors, "http://ftp.igh.cnrs.fr/pub/nongnu/$1";
-		push @mirrors, "ftp://cdimage.debian.org/mirror/gnu.org/savannah/$1";
-		push @mirrors, "ftp://ftp.acc.umu.se/mirror/gnu.org/savannah/$1";
-	} elsif ($mirror =~ /^\@KERNEL\/(.+)$/) {
-		my @extra = ( $1 );
-		if ($filename =~ /linux-\d+\.\d+(?:\.\d+)?-rc/) {
-			push @extra, "$extra[0]/testing";
-		} elsif ($filename =~ /linux-(\d+\.\d+(?:\.\d+)?)/) {
-			push @extra, "$extra[0]/longterm/v$1";
-		}
-		foreach my $dir (@extra) {
-			push @mirrors, "https://cdn.kernel.org/pub/$dir";
-			push @mirrors, "https://download.xs4all.nl/ftp.kernel.org/pub/$dir";
-			push @mirrors, "https://mirrors.mit.edu/kernel/$dir";
-			push @mirrors, "http://ftp.nara.wide.ad.jp/pub/kernel.org/$dir";
-			push @mirrors, "http://www.ring.gr.jp/archives/linux/kernel.org/$dir";
-			push @mirrors, "ftp://ftp.riken.jp/Linux/kernel.org/$dir";
-			push @mirrors, "ftp://www.mirrorservice.org/sites/ftp.kernel.org/pub/$dir";
-			push @mirrors, "https://mirrors.tuna.tsinghua.edu.cn/kernel/$dir";
-			push @mirrors, "https://mirrors.ustc.edu.cn/kernel.org/$dir";
-		}
-	} elsif ($mirror =~ /^\@GNOME\/(.+)$/) {
-		push @mirrors, "https://download.gnome.org/sources/$1";
-		push @mirrors, "https://mirror.csclub.uwaterloo.ca/gnome/sources/$1";
-		push @mirrors, "http://ftp.acc.umu.se/pub/GNOME/sources/$1";
-		push @mirrors, "http://ftp.kaist.ac.kr/gnome/sources/$1";
-		push @mirrors, "http://www.mirrorservice.org/sites/ftp.gnome.org/pub/GNOME/sources/$1";
-		push @mirrors, "http://mirror.internode.on.net/pub/gnome/sources/$1";
-		push @mirrors, "http://ftp.belnet.be/ftp.gnome.org/sources/$1";
-		push @mirrors, "ftp://ftp.cse.buffalo.edu/pub/Gnome/sources/$1";
-		push @mirrors, "ftp://ftp.nara.wide.ad.jp/pub/X11/GNOME/sources/$1";
-		push @mirrors, "https://mirrors.ustc.edu.cn/gnome/sources/$1";
-	} else {
-		push @mirrors, $mirror;
-	}
-}
-
-push @mirrors, 'https://sources.cdn.openwrt.org';
-push @mirrors, 'https://sources.openwrt.org';
-push @mirrors, 'https://mirror2.openwrt.org/sources';
+@mirrors = expand_mirrors($filename, @ARGV);
 
 if (-f "$target/$filename") {
 	$hash_cmd and do {
@@ -340,13 +671,21 @@ if (-f "$target/$filename") {
 		$sum = $1;
 
 		cleanup();
-		exit 0 if $sum eq $file_hash;
+		if ($sum eq $file_hash) {
+			cache_store($file_hash, "$target/$filename");
+			exit 0;
+		}
 
 		die "Hash of the local file $filename does not match (file: $sum, requested: $file_hash) - deleting download.\n";
 		unlink "$target/$filename";
 	};
 }
 
+if (cache_fetch($file_hash, "$target/$filename")) {
+	print("Linked $filename from download cache\n");
+	exit 0;
+}
+
 $download_tool = select_tool();
 
 while (!-f "$target/$filename") {
@@ -359,4 +698,6 @@ while (!-f "$target/$filename") {
 	}
 }
 
+cache_store($file_hash, "$target/$filename");
+
 $SIG{INT} = \&cleanup;
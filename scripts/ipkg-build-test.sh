@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Copyright (C) 2026 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+# Checks that ipkg-build output is reproducible: a package built twice with
+# the same SOURCE_DATE_EPOCH must be byte-identical, even when the file
+# timestamps of the package directory differ between the builds. This is
+# repeated with pigz as IPKG_GZIP when it is installed.
+#
+# usage: scripts/ipkg-build-test.sh
+#
+
+SCRIPTDIR="$(cd "$(dirname "$0")" && pwd)"
+TMP="$(mktemp -d "${TMPDIR:-/tmp}/ipkg-build-test.XXXXXX")" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+failed=0
+
+make_pkg() {
+	local dir="$1"
+
+	mkdir -p "$dir/CONTROL" "$dir/usr/bin" "$dir/lib/firmware"
+	cat > "$dir/CONTROL/control" <<EOF
+Package: ipkg-build-test
+Version: 1.0-1
+Architecture: all
+Installed-Size: 0
+Description: ipkg-build reproducibility test
+EOF
+	echo "#!/bin/sh" > "$dir/usr/bin/test"
+	chmod 0755 "$dir/usr/bin/test"
+	# compressible and incompressible data
+	seq 1 200000 > "$dir/lib/firmware/text.bin"
+	head -c 1048576 /dev/urandom > "$dir/lib/firmware/random.bin"
+}
+
+# build $1 into $2 with the file times set to $3
+build() {
+	local src="$1" out="$2" mtime="$3"
+
+	rm -rf "$TMP/pkg"
+	cp -a "$src" "$TMP/pkg"
+	find "$TMP/pkg" -exec touch -d "@$mtime" {} +
+	mkdir -p "$out"
+	"$SCRIPTDIR/ipkg-build" "$TMP/pkg" "$out" > /dev/null
+}
+
+check() {
+	local desc="$1"
+
+	build "$TMP/src" "$TMP/a" 1000000000 &&
+	build "$TMP/src" "$TMP/b" 1500000000 || {
+		echo "not ok - $desc: ipkg-build failed"
+		failed=1
+		return
+	}
+
+	if cmp -s "$TMP"/a/*.ipk "$TMP"/b/*.ipk; then
+		echo "ok - $desc"
+	else
+		echo "not ok - $desc: the packages differ"
+		failed=1
+	fi
+	rm -rf "$TMP/a" "$TMP/b"
+}
+
+make_pkg "$TMP/src"
+
+export SOURCE_DATE_EPOCH=1600000000
+unset PKG_SOURCE_DATE_EPOCH
+
+unset IPKG_GZIP
+check "gzip"
+
+if command -v pigz > /dev/null; then
+	export IPKG_GZIP="pigz -p 4"
+	check "pigz"
+else
+	echo "skip - pigz: not installed"
+fi
+
+exit $failed
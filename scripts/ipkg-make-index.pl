@@ -0,0 +1,212 @@
+#!/usr/bin/env perl
+#
+# Generate an opkg "Packages" index for all .ipk files below a directory.
+#
+# Each package is read exactly once: the SHA256 sum is calculated over the
+# file contents in memory and the control file is extracted from the same
+# buffer. Packages are processed by several worker processes and results
+# can be cached across runs, keyed by path, size and mtime.
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+#
+
+use strict;
+use warnings;
+use Cwd qw(abs_path);
+use Digest::SHA;
+use File::Find;
+use File::Temp qw(tempdir);
+use Getopt::Std;
+use IO::Uncompress::Gunzip qw($GunzipError);
+use Storable qw(nstore retrieve);
+use Time::HiRes qw(stat);
+
+my %opts;
+getopts('c:j:', \%opts);
+
+my $pkg_dir = shift @ARGV;
+unless (defined($pkg_dir) && -d $pkg_dir) {
+	print STDERR "Usage: $0 [-j <jobs>] [-c <cache file>] <package_directory>\n";
+	exit 1;
+}
+
+my $jobs = $opts{j} || $ENV{IPKG_INDEX_JOBS} || `getconf _NPROCESSORS_ONLN 2>/dev/null` || 1;
+$jobs = int($jobs) || 1;
+my $cache_file = $opts{c} || $ENV{IPKG_INDEX_CACHE};
+
+sub gunzip_read($$) {
+	my ($z, $len) = @_;
+	my $data = '';
+
+	while (length($data) < $len) {
+		my $ret = $z->read($data, $len - length($data), length($data));
+		die "gunzip: $GunzipError\n" if $ret < 0;
+		last if $ret == 0;
+	}
+
+	return $data;
+}
+
+# Return the contents of member $want from a gzip compressed tar archive
+sub tar_gz_member($$) {
+	my ($in, $want) = @_;
+	my $z = IO::Uncompress::Gunzip->new($in, Transparent => 0)
+		or die "gunzip: $GunzipError\n";
+	my $longname;
+
+	while (1) {
+		my $hdr = gunzip_read($z, 512);
+		last if length($hdr) < 512 || $hdr =~ /^\0{512}$/;
+
+		my ($name, $size, $type, $magic, $prefix) =
+			unpack('Z100 x24 Z12 x20 a1 x100 a6 x82 Z155', $hdr);
+		$size = oct($size =~ s/[\s\0]+//gr || 0);
+		my $blocks = int(($size + 511) / 512) * 512;
+
+		if ($type eq 'L') {
+			($longname) = unpack('Z*', gunzip_read($z, $blocks));
+			next;
+		}
+
+		if (defined $longname) {
+			$name = $longname;
+			undef $longname;
+		} elsif ($magic eq "ustar\0" && length($prefix)) {
+			$name = "$prefix/$name";
+		}
+
+		if ($name eq $want || "./$name" eq $want) {
+			return substr(gunzip_read($z, $blocks), 0, $size);
+		}
+
+		gunzip_read($z, $blocks);
+	}
+
+	return undef;
+}
+
+sub index_package($$) {
+	my ($pkg, $size) = @_;
+	my $data;
+
+	open my $fh, '<:raw', $pkg or die "Failed to open $pkg: $!\n";
+	local $/;
+	$data = <$fh>;
+	close $fh;
+	die "Failed to read $pkg\n" unless length($data) == $size;
+
+	my $control_tgz = tar_gz_member(\$data, './control.tar.gz');
+	my $control = defined($control_tgz) ? tar_gz_member(\$control_tgz, './control') : undef;
+	defined($control) or die "No control file found in $pkg\n";
+
+	return {
+		sha256 => Digest::SHA::sha256_hex($data),
+		control => $control,
+	};
+}
+
+my @pkgs;
+find({
+	no_chdir => 1,
+	wanted => sub { push @pkgs, $File::Find::name if /\.ipk$/ },
+}, $pkg_dir);
+@pkgs = sort @pkgs;
+
+my $empty = @pkgs ? 0 : 1;
+my %cache;
+my @todo;
+my @entries;
+
+if ($cache_file && -f $cache_file) {
+	my $ref = eval { retrieve($cache_file) };
+	%cache = %$ref if ref($ref) eq 'HASH';
+}
+
+@pkgs = grep {
+	my $name = $_;
+	$name =~ s!^.*/!!;
+	$name =~ s!_.*$!!;
+	$name ne 'kernel' && $name ne 'libc';
+} @pkgs;
+
+for my $i (0 .. $#pkgs) {
+	my $pkg = $pkgs[$i];
+	my @st = stat($pkg) or die "Failed to stat $pkg: $!\n";
+	my $key = abs_path($pkg);
+	my $ent = $cache{$key};
+
+	print STDERR "Generating index for package $pkg\n";
+
+	$entries[$i] = { size => $st[7], key => $key, mtime => "$st[9]" };
+	if ($ent && $ent->{size} == $st[7] && $ent->{mtime} eq $st[9]) {
+		$entries[$i]{$_} = $ent->{$_} for qw(sha256 control);
+	} else {
+		push @todo, $i;
+	}
+}
+
+$jobs = @todo if $jobs > @todo;
+
+if ($jobs > 1) {
+	my $tmp = tempdir(CLEANUP => 1);
+	my %pids;
+
+	for my $job (0 .. $jobs - 1) {
+		my $pid = fork();
+		die "fork: $!\n" unless defined $pid;
+
+		if (!$pid) {
+			my %res;
+
+			for (my $n = $job; $n < @todo; $n += $jobs) {
+				my $i = $todo[$n];
+				$res{$i} = index_package($pkgs[$i], $entries[$i]{size});
+			}
+			nstore(\%res, "$tmp/$job");
+			exit 0;
+		}
+		$pids{$pid} = $job;
+	}
+
+	while ((my $pid = wait()) > 0) {
+		my $job = delete $pids{$pid};
+		next unless defined $job;
+		die "Indexing packages failed\n" if $?;
+
+		my $res = retrieve("$tmp/$job");
+		for my $i (keys %$res) {
+			$entries[$i]{$_} = $res->{$i}{$_} for qw(sha256 control);
+		}
+	}
+} else {
+	for my $i (@todo) {
+		my $res = index_package($pkgs[$i], $entries[$i]{size});
+		$entries[$i]{$_} = $res->{$_} for qw(sha256 control);
+	}
+}
+
+for my $i (0 .. $#pkgs) {
+	my $ent = $entries[$i];
+	my $filename = $pkgs[$i];
+	my $control = $ent->{control};
+
+	$filename =~ s!^\./!!;
+	$control =~ s/^Description:/Filename: $filename\nSize: $ent->{size}\nSHA256sum: $ent->{sha256}\nDescription:/mg;
+	print $control, "\n";
+
+	$cache{$ent->{key}} = { map { $_ => $ent->{$_} } qw(size mtime sha256 control) };
+}
+print "\n" if $empty;
+
+if ($cache_file && @todo) {
+	# Drop entries of packages that no longer exist
+	for my $key (keys %cache) {
+		delete $cache{$key} unless -f $key;
+	}
+
+	nstore(\%cache, "$cache_file.$$");
+	rename("$cache_file.$$", $cache_file) or unlink("$cache_file.$$");
+}
+
+exit 0;
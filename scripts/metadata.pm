@@ -2,6 +2,7 @@ package metadata;
 use base 'Exporter';
 use strict;
 use warnings;
+use Storable qw(nstore retrieve);
 our @EXPORT = qw(%package %vpackage %srcpackage %category %overrides clear_packages parse_package_metadata parse_target_metadata get_multiline @ignore %usernames %groupnames);
 
 our %package;
@@ -196,7 +197,77 @@ sub clear_packages() {
 	%groupnames = ();
 }
 
+# The parsed metadata is cached in <file>.cache, which is only used while
+# size and mtime of <file> and the ignore list match the stored stamp.
+my $cache_version = 1;
+
+sub package_metadata_stamp($) {
+	my $file = shift;
+	my @st = stat($file) or return undef;
+
+	return join(":", $cache_version, $st[7], $st[9], sort @ignore);
+}
+
+sub load_package_metadata_cache($) {
+	my $file = shift;
+	my $stamp = package_metadata_stamp($file);
+	my $cache;
+
+	return 0 unless $stamp and -f "$file.cache";
+	return 0 if %package or %srcpackage;
+
+	$cache = eval { retrieve("$file.cache") };
+	return 0 unless $cache and $cache->{stamp} eq $stamp;
+
+	%package = %{$cache->{package}};
+	%vpackage = %{$cache->{vpackage}};
+	%srcpackage = %{$cache->{srcpackage}};
+	%category = %{$cache->{category}};
+	%overrides = %{$cache->{overrides}};
+	%usernames = %{$cache->{usernames}};
+	%groupnames = %{$cache->{groupnames}};
+	%userids = %{$cache->{userids}};
+	%groupids = %{$cache->{groupids}};
+
+	return 1;
+}
+
+sub save_package_metadata_cache($) {
+	my $file = shift;
+	my $stamp = package_metadata_stamp($file) or return;
+	my $tmp = "$file.cache.$$";
+
+	eval {
+		nstore({
+			stamp => $stamp,
+			package => \%package,
+			vpackage => \%vpackage,
+			srcpackage => \%srcpackage,
+			category => \%category,
+			overrides => \%overrides,
+			usernames => \%usernames,
+			groupnames => \%groupnames,
+			userids => \%userids,
+			groupids => \%groupids,
+		}, $tmp);
+		rename($tmp, "$file.cache");
+	} or unlink($tmp);
+}
+
 sub parse_package_metadata($) {
+	my $file = shift;
+	my $cacheable = !(%package or %srcpackage);
+	my $ret;
+
+	return 1 if load_package_metadata_cache($file);
+
+	$ret = parse_package_metadata_file($file);
+	save_package_metadata_cache($file) if $ret and $cacheable;
+
+	return $ret;
+}
+
+sub parse_package_metadata_file($) {
 	my $file = shift;
 	my $pkg;
 	my $src;
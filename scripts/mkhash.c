@@ -86,12 +86,28 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_X86_SHA
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#define SHA256_ARM_SHA2
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #define ARRAY_SIZE(_n) (sizeof(_n) / sizeof((_n)[0]))
 
 #ifndef __FreeBSD__
@@ -451,6 +467,26 @@ be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
 #define Maj(x, y, z)	((x & (y | z)) | (y & z))
 #define ROTR(x, n)	((x >> n) | (x << (32 - n)))
 
+/* SHA256 round constants. */
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 /*
  * SHA256 block compression function.  The 256-bit state is transformed via
  * the 512-bit input block to produce a new state.
@@ -458,25 +494,6 @@ be32dec_vect(uint32_t *dst, const unsigned char *src, size_t len)
 static void
 SHA256_Transform(uint32_t * state, const unsigned char block[64])
 {
-	/* SHA256 round constants. */
-	static const uint32_t K[64] = {
-		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-		0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-		0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-		0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-		0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-		0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-	};
 	uint32_t W[64];
 	uint32_t S[8];
 	int i;
@@ -562,6 +579,158 @@ SHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+static void
+SHA256_Transform_blocks(uint32_t * state, const unsigned char *data, size_t n)
+{
+	while (n--) {
+		SHA256_Transform(state, data);
+		data += 64;
+	}
+}
+
+#ifdef SHA256_X86_SHA
+/*
+ * SHA256 using the x86 SHA extensions, four rounds per group.  The message
+ * schedule for the next group is computed while the current one is mixed.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+SHA256_Transform_x86(uint32_t * state, const unsigned char *data, size_t n)
+{
+	const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i STATE0, STATE1, ABEF_SAVE, CDGH_SAVE;
+	__m128i MSG, TMP, M[4];
+	int i;
+
+	TMP = _mm_loadu_si128((const __m128i *) &state[0]);
+	STATE1 = _mm_loadu_si128((const __m128i *) &state[4]);
+
+	TMP = _mm_shuffle_epi32(TMP, 0xB1);		/* CDAB */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);	/* EFGH */
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);	/* ABEF */
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);	/* CDGH */
+
+	while (n--) {
+		ABEF_SAVE = STATE0;
+		CDGH_SAVE = STATE1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4)
+				M[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *) (data + i * 16)), MASK);
+
+			MSG = _mm_add_epi32(M[i % 4],
+				_mm_loadu_si128((const __m128i *) &K[i * 4]));
+			STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+
+			if (i >= 3 && i < 15) {
+				TMP = _mm_alignr_epi8(M[i % 4], M[(i + 3) % 4], 4);
+				M[(i + 1) % 4] = _mm_add_epi32(M[(i + 1) % 4], TMP);
+				M[(i + 1) % 4] = _mm_sha256msg2_epu32(M[(i + 1) % 4],
+								      M[i % 4]);
+			}
+
+			MSG = _mm_shuffle_epi32(MSG, 0x0E);
+			STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+			if (i >= 1 && i < 13)
+				M[(i + 3) % 4] = _mm_sha256msg1_epu32(M[(i + 3) % 4],
+								      M[i % 4]);
+		}
+
+		STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+		STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+		data += 64;
+	}
+
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);		/* FEBA */
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);	/* DCHG */
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);	/* DCBA */
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);	/* ABEF */
+
+	_mm_storeu_si128((__m128i *) &state[0], STATE0);
+	_mm_storeu_si128((__m128i *) &state[4], STATE1);
+}
+
+static bool
+SHA256_have_x86(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+	    !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3))
+		return false;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return ebx & (1 << 29);
+}
+#endif
+
+#ifdef SHA256_ARM_SHA2
+/* SHA256 using the ARMv8 crypto extensions, four rounds per group. */
+static void
+SHA256_Transform_arm(uint32_t * state, const unsigned char *data, size_t n)
+{
+	uint32x4_t STATE0, STATE1, ABEF_SAVE, CDGH_SAVE;
+	uint32x4_t TMP, TMP2, M[4];
+	int i;
+
+	STATE0 = vld1q_u32(&state[0]);
+	STATE1 = vld1q_u32(&state[4]);
+
+	while (n--) {
+		ABEF_SAVE = STATE0;
+		CDGH_SAVE = STATE1;
+
+		for (i = 0; i < 4; i++)
+			M[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+		for (i = 0; i < 16; i++) {
+			TMP = vaddq_u32(M[i % 4], vld1q_u32(&K[i * 4]));
+			if (i < 12)
+				M[i % 4] = vsha256su0q_u32(M[i % 4], M[(i + 1) % 4]);
+
+			TMP2 = STATE0;
+			STATE0 = vsha256hq_u32(STATE0, STATE1, TMP);
+			STATE1 = vsha256h2q_u32(STATE1, TMP2, TMP);
+
+			if (i < 12)
+				M[i % 4] = vsha256su1q_u32(M[i % 4], M[(i + 2) % 4],
+							   M[(i + 3) % 4]);
+		}
+
+		STATE0 = vaddq_u32(STATE0, ABEF_SAVE);
+		STATE1 = vaddq_u32(STATE1, CDGH_SAVE);
+		data += 64;
+	}
+
+	vst1q_u32(&state[0], STATE0);
+	vst1q_u32(&state[4], STATE1);
+}
+#endif
+
+static void (*SHA256_blocks)(uint32_t *, const unsigned char *, size_t) =
+	SHA256_Transform_blocks;
+
+/* Pick the fastest block function supported by the CPU */
+static void
+SHA256_select(void)
+{
+#ifdef SHA256_X86_SHA
+	if (SHA256_have_x86())
+		SHA256_blocks = SHA256_Transform_x86;
+#endif
+#ifdef SHA256_ARM_SHA2
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+		SHA256_blocks = SHA256_Transform_arm;
+#endif
+}
+
 static unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -585,7 +754,7 @@ SHA256_Pad(SHA256_CTX * ctx)
 	} else {
 		/* Finish the current block and mix. */
 		memcpy(&ctx->buf[r], PAD, 64 - r);
-		SHA256_Transform(ctx->state, ctx->buf);
+		SHA256_blocks(ctx->state, ctx->buf, 1);
 
 		/* The start of the final block is all zeroes. */
 		memset(&ctx->buf[0], 0, 56);
@@ -595,7 +764,7 @@ SHA256_Pad(SHA256_CTX * ctx)
 	be64enc(&ctx->buf[56], ctx->count);
 
 	/* Mix in the final block. */
-	SHA256_Transform(ctx->state, ctx->buf);
+	SHA256_blocks(ctx->state, ctx->buf, 1);
 }
 
 /* SHA-256 initialization.  Begins a SHA-256 operation. */
@@ -642,16 +811,14 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
 
 	/* Finish the current block */
 	memcpy(&ctx->buf[r], src, 64 - r);
-	SHA256_Transform(ctx->state, ctx->buf);
+	SHA256_blocks(ctx->state, ctx->buf, 1);
 	src += 64 - r;
 	len -= 64 - r;
 
 	/* Perform complete blocks */
-	while (len >= 64) {
-		SHA256_Transform(ctx->state, src);
-		src += 64;
-		len -= 64;
-	}
+	SHA256_blocks(ctx->state, src, len / 64);
+	src += len & ~(size_t) 63;
+	len &= 63;
 
 	/* Copy left over data into buffer */
 	memcpy(ctx->buf, src, len);
@@ -674,30 +841,30 @@ SHA256_Final(unsigned char digest[static SHA256_DIGEST_LENGTH], SHA256_CTX *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
-static void *hash_buf(FILE *f, int *len)
-{
-	static char buf[1024];
+#define HASH_BUF_SIZE	(64 * 1024)
 
-	*len = fread(buf, 1, sizeof(buf), f);
+static void *hash_buf(FILE *f, void *buf, int *len)
+{
+	*len = fread(buf, 1, HASH_BUF_SIZE, f);
 
 	return *len > 0 ? buf : NULL;
 }
 
-static char *hash_string(unsigned char *buf, int len)
+static char *hash_string(unsigned char *buf, int len, char *str)
 {
-	static char str[SHA256_DIGEST_LENGTH * 2 + 1];
+	static const char hex[] = "0123456789abcdef";
 	int i;
 
-	if (len * 2 + 1 > sizeof(str))
-		return NULL;
-
-	for (i = 0; i < len; i++)
-		sprintf(&str[i * 2], "%02x", buf[i]);
+	for (i = 0; i < len; i++) {
+		str[i * 2] = hex[buf[i] >> 4];
+		str[i * 2 + 1] = hex[buf[i] & 0xf];
+	}
+	str[len * 2] = 0;
 
 	return str;
 }
 
-static const char *md5_hash(FILE *f)
+static const char *md5_hash(FILE *f, void *data, char *str)
 {
 	MD5_CTX ctx;
 	unsigned char val[MD5_DIGEST_LENGTH];
@@ -705,14 +872,14 @@ static const char *md5_hash(FILE *f)
 	int len;
 
 	MD5_begin(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
+	while ((buf = hash_buf(f, data, &len)) != NULL)
 		MD5_hash(buf, len, &ctx);
 	MD5_end(val, &ctx);
 
-	return hash_string(val, MD5_DIGEST_LENGTH);
+	return hash_string(val, MD5_DIGEST_LENGTH, str);
 }
 
-static const char *sha256_hash(FILE *f)
+static const char *sha256_hash(FILE *f, void *data, char *str)
 {
 	SHA256_CTX ctx;
 	unsigned char val[SHA256_DIGEST_LENGTH];
@@ -720,17 +887,17 @@ static const char *sha256_hash(FILE *f)
 	int len;
 
 	SHA256_Init(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
+	while ((buf = hash_buf(f, data, &len)) != NULL)
 		SHA256_Update(&ctx, buf, len);
 	SHA256_Final(val, &ctx);
 
-	return hash_string(val, SHA256_DIGEST_LENGTH);
+	return hash_string(val, SHA256_DIGEST_LENGTH, str);
 }
 
 
 struct hash_type {
 	const char *name;
-	const char *(*func)(FILE *f);
+	const char *(*func)(FILE *f, void *buf, char *str);
 	int len;
 };
 
@@ -739,6 +906,19 @@ struct hash_type types[] = {
 	{ "sha256", sha256_hash, SHA256_DIGEST_LENGTH },
 };
 
+struct hash_job {
+	const char *filename;
+	const char *error;
+	char str[SHA256_DIGEST_STRING_LENGTH];
+};
+
+struct hash_queue {
+	struct hash_type *type;
+	struct hash_job *jobs;
+	int n_jobs;
+	int next;
+};
+
 
 static int usage(const char *progname)
 {
@@ -748,6 +928,8 @@ static int usage(const char *progname)
 		"Options:\n"
 		"	-n		Print filename(s)\n"
 		"	-N		Suppress trailing newline\n"
+		"	-l <file>	Read the list of files to hash from <file> (- for stdin)\n"
+		"	-j <jobs>	Hash up to <jobs> files in parallel\n"
 		"\n"
 		"Supported hash types:", progname);
 
@@ -772,53 +954,157 @@ static struct hash_type *get_hash_type(const char *name)
 }
 
 
-static int hash_file(struct hash_type *t, const char *filename, bool add_filename,
-	bool no_newline)
+static void hash_file(struct hash_type *t, struct hash_job *job, void *buf)
 {
+	const char *filename = job->filename;
 	const char *str;
 
 	if (!filename || !strcmp(filename, "-")) {
-		str = t->func(stdin);
+		str = t->func(stdin, buf, job->str);
 	} else {
 		struct stat path_stat;
 		stat(filename, &path_stat);
 		if (S_ISDIR(path_stat.st_mode)) {
-			fprintf(stderr, "Failed to open '%s': Is a directory\n", filename);
-			return 1;
+			job->error = "Failed to open '%s': Is a directory\n";
+			return;
 		}
 
 		FILE *f = fopen(filename, "r");
 
 		if (!f) {
-			fprintf(stderr, "Failed to open '%s'\n", filename);
-			return 1;
+			job->error = "Failed to open '%s'\n";
+			return;
 		}
-		str = t->func(f);
+		str = t->func(f, buf, job->str);
 		fclose(f);
 	}
 
-	if (!str) {
-		fprintf(stderr, "Failed to generate hash\n");
+	if (!str)
+		job->error = "Failed to generate hash\n";
+}
+
+static int print_hash(struct hash_job *job, bool add_filename, bool no_newline)
+{
+	if (job->error) {
+		fprintf(stderr, job->error, job->filename);
 		return 1;
 	}
 
 	if (add_filename)
-		printf("%s %s%s", str, filename ? filename : "-",
+		printf("%s %s%s", job->str, job->filename ? job->filename : "-",
 			no_newline ? "" : "\n");
 	else
-		printf("%s%s", str, no_newline ? "" : "\n");
+		printf("%s%s", job->str, no_newline ? "" : "\n");
+	return 0;
+}
+
+static void *hash_worker(void *arg)
+{
+	struct hash_queue *q = arg;
+	void *buf;
+	int i;
+
+	buf = malloc(HASH_BUF_SIZE);
+	if (!buf)
+		return NULL;
+
+	while ((i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < q->n_jobs)
+		hash_file(q->type, &q->jobs[i], buf);
+
+	free(buf);
+	return NULL;
+}
+
+/* Hash all queued files using n_threads threads, output stays in order */
+static int hash_files(struct hash_queue *q, int n_threads, bool add_filename,
+	bool no_newline)
+{
+	pthread_t *threads;
+	int i, n = 0;
+
+	if (n_threads > q->n_jobs)
+		n_threads = q->n_jobs;
+
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	for (i = 1; i < n_threads; i++) {
+		if (pthread_create(&threads[n], NULL, hash_worker, q))
+			break;
+		n++;
+	}
+
+	hash_worker(q);
+
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (i = 0; i < q->n_jobs; i++) {
+		if (!q->jobs[i].error && !q->jobs[i].str[0])
+			q->jobs[i].error = "Failed to generate hash\n";
+
+		if (print_hash(&q->jobs[i], add_filename, no_newline))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int add_job(struct hash_queue *q, const char *filename)
+{
+	struct hash_job *jobs;
+
+	if (!(q->n_jobs % 256)) {
+		jobs = realloc(q->jobs, (q->n_jobs + 256) * sizeof(*jobs));
+		if (!jobs)
+			return -1;
+		q->jobs = jobs;
+	}
+
+	memset(&q->jobs[q->n_jobs], 0, sizeof(*jobs));
+	q->jobs[q->n_jobs++].filename = filename;
+	return 0;
+}
+
+static int read_list(struct hash_queue *q, const char *listfile)
+{
+	FILE *f = stdin;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	if (strcmp(listfile, "-") && !(f = fopen(listfile, "r"))) {
+		fprintf(stderr, "Failed to open '%s'\n", listfile);
+		return -1;
+	}
+
+	while ((len = getline(&line, &size, f)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = 0;
+
+		if (len && add_job(q, strdup(line)))
+			return -1;
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
 	return 0;
 }
 
 
 int main(int argc, char **argv)
 {
-	struct hash_type *t;
+	struct hash_queue q = {};
 	const char *progname = argv[0];
-	int i, ch;
+	const char *listfile = NULL;
+	int i, ch, n_threads = 1;
 	bool add_filename = false, no_newline = false;
 
-	while ((ch = getopt(argc, argv, "nN")) != -1) {
+	while ((ch = getopt(argc, argv, "nNj:l:")) != -1) {
 		switch (ch) {
 		case 'n':
 			add_filename = true;
@@ -826,6 +1112,14 @@ int main(int argc, char **argv)
 		case 'N':
 			no_newline = true;
 			break;
+		case 'j':
+			n_threads = atoi(optarg);
+			if (n_threads < 1)
+				return usage(progname);
+			break;
+		case 'l':
+			listfile = optarg;
+			break;
 		default:
 			return usage(progname);
 		}
@@ -837,18 +1131,21 @@ int main(int argc, char **argv)
 	if (argc < 1)
 		return usage(progname);
 
-	t = get_hash_type(argv[0]);
-	if (!t)
+	q.type = get_hash_type(argv[0]);
+	if (!q.type)
 		return usage(progname);
 
-	if (argc < 2)
-		return hash_file(t, NULL, add_filename, no_newline);
+	SHA256_select();
 
-	for (i = 0; i < argc - 1; i++) {
-		int ret = hash_file(t, argv[1 + i], add_filename, no_newline);
-		if (ret)
-			return ret;
-	}
+	for (i = 0; i < argc - 1; i++)
+		if (add_job(&q, argv[1 + i]))
+			return 1;
 
-	return 0;
+	if (listfile && read_list(&q, listfile))
+		return 1;
+
+	if (!q.n_jobs && add_job(&q, NULL))
+		return 1;
+
+	return hash_files(&q, n_threads, add_filename, no_newline);
 }
@@ -97,31 +97,33 @@ sub gen_kconfig_overrides() {
 	}
 }
 
-my %dep_check;
-sub __find_package_dep($$) {
+my %dep_closure;
+sub __find_package_deps($$) {
 	my $pkg = shift;
-	my $name = shift;
+	my $seen = shift;
 	my $deps = $pkg->{depends};
 
-	return 0 unless defined $deps;
+	return unless defined $deps;
 	foreach my $vpkg (@{$deps}) {
+		next unless $vpackage{$vpkg};
 		foreach my $dep (@{$vpackage{$vpkg}}) {
-			next if $dep_check{$dep->{name}};
-			$dep_check{$dep->{name}} = 1;
-			return 1 if $dep->{name} eq $name;
-			return 1 if (__find_package_dep($dep, $name) == 1);
+			next if $seen->{$dep->{name}};
+			$seen->{$dep->{name}} = 1;
+			__find_package_deps($dep, $seen);
 		}
 	}
-	return 0;
 }
 
-# wrapper to avoid infinite recursion
+# the set of all (indirect) dependencies is computed once per package
 sub find_package_dep($$) {
 	my $pkg = shift;
 	my $name = shift;
 
-	%dep_check = ();
-	return __find_package_dep($pkg, $name);
+	unless ($dep_closure{$pkg->{name}}) {
+		$dep_closure{$pkg->{name}} = {};
+		__find_package_deps($pkg, $dep_closure{$pkg->{name}});
+	}
+	return $dep_closure{$pkg->{name}}->{$name} ? 1 : 0;
 }
 
 sub package_depends($$) {
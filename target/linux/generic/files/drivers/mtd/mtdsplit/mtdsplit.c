@@ -12,18 +12,204 @@
 
 #define pr_fmt(fmt)	"mtdsplit: " fmt
 
+#include <linux/bitmap.h>
 #include <linux/export.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/magic.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <linux/byteorder/generic.h>
 
 #include "mtdsplit.h"
 
 #define UBI_EC_MAGIC			0x55424923	/* UBI# */
 
+/*
+ * Most parsers probe the start of every erase block of the same master
+ * device for their magic, one after another. Keep the first bytes of each
+ * erase block around so that every block is read only once for all of them.
+ *
+ * The cache is only used while nobody has the flash open, so it cannot miss
+ * a write, and it is dropped when its device is removed. The timeout only
+ * gives the memory back.
+ */
+#define MTDSPLIT_HDR_CACHE_LEN		256
+#define MTDSPLIT_HDR_CACHE_MAX		(256 * 1024)
+#define MTDSPLIT_HDR_CACHE_TIMEOUT	(2 * HZ)
+
+struct mtdsplit_hdr_cache {
+	struct mtd_info *mtd;
+	char name[32];
+	unsigned int blocks;
+	unsigned long *valid;
+	u8 *data;
+
+	unsigned int hits;
+	unsigned int misses;
+	u64 read_ns;
+};
+
+static struct mtdsplit_hdr_cache hdr_cache;
+static DEFINE_MUTEX(hdr_cache_lock);
+
+static void mtdsplit_hdr_cache_release(void)
+{
+	struct mtdsplit_hdr_cache *c = &hdr_cache;
+
+	if (!c->mtd)
+		return;
+
+	pr_debug("%s: %u header reads, %u from cache, %llu us reading flash\n",
+		 c->name, c->hits + c->misses, c->hits,
+		 div_u64(c->read_ns, NSEC_PER_USEC));
+
+	bitmap_free(c->valid);
+	vfree(c->data);
+	memset(c, 0, sizeof(*c));
+}
+
+static void mtdsplit_hdr_cache_expire(struct work_struct *work)
+{
+	mutex_lock(&hdr_cache_lock);
+	mtdsplit_hdr_cache_release();
+	mutex_unlock(&hdr_cache_lock);
+}
+
+static DECLARE_DELAYED_WORK(hdr_cache_work, mtdsplit_hdr_cache_expire);
+
+static void mtdsplit_notify_add(struct mtd_info *mtd)
+{
+}
+
+static void mtdsplit_notify_remove(struct mtd_info *mtd)
+{
+	mutex_lock(&hdr_cache_lock);
+	if (hdr_cache.mtd == mtd)
+		mtdsplit_hdr_cache_release();
+	mutex_unlock(&hdr_cache_lock);
+}
+
+static struct mtd_notifier mtdsplit_notifier = {
+	.add = mtdsplit_notify_add,
+	.remove = mtdsplit_notify_remove,
+};
+
+static bool mtdsplit_hdr_cache_setup(struct mtd_info *mtd)
+{
+	struct mtdsplit_hdr_cache *c = &hdr_cache;
+	u64 blocks;
+
+	/* Any user of the flash might write to it behind our back */
+	if (mtd_get_master(mtd)->usecount) {
+		mtdsplit_hdr_cache_release();
+		return false;
+	}
+
+	if (c->mtd == mtd)
+		return true;
+
+	mtdsplit_hdr_cache_release();
+
+	if (!mtd->erasesize || mtd->erasesize < MTDSPLIT_HDR_CACHE_LEN)
+		return false;
+
+	/* A partial erase block at the end is left to mtd_read() */
+	blocks = div_u64(mtd->size, mtd->erasesize);
+	if (blocks * MTDSPLIT_HDR_CACHE_LEN > MTDSPLIT_HDR_CACHE_MAX)
+		return false;
+
+	c->valid = bitmap_zalloc(blocks, GFP_KERNEL);
+	c->data = vmalloc(blocks * MTDSPLIT_HDR_CACHE_LEN);
+	if (!c->valid || !c->data) {
+		bitmap_free(c->valid);
+		vfree(c->data);
+		c->valid = NULL;
+		c->data = NULL;
+		return false;
+	}
+
+	c->mtd = mtd;
+	c->blocks = blocks;
+	strscpy(c->name, mtd->name, sizeof(c->name));
+
+	return true;
+}
+
+/**
+ * mtdsplit_read - read from the master device, going through the header cache
+ *
+ * Same semantics as mtd_read(). Reads that fit in the first
+ * MTDSPLIT_HDR_CACHE_LEN bytes of an erase block are served from a cache
+ * shared by all parsers, everything else is passed to mtd_read().
+ */
+int mtdsplit_read(struct mtd_info *mtd, loff_t from, size_t len,
+		  size_t *retlen, u_char *buf)
+{
+	struct mtdsplit_hdr_cache *c = &hdr_cache;
+	u32 block_off;
+	u64 block;
+	u8 *hdr;
+	size_t hdr_len;
+	ktime_t start;
+	int ret;
+
+	if (from < 0 || from >= mtd->size || !mtd->erasesize)
+		return mtd_read(mtd, from, len, retlen, buf);
+
+	block = div_u64_rem(from, mtd->erasesize, &block_off);
+	if (block_off + len > MTDSPLIT_HDR_CACHE_LEN)
+		return mtd_read(mtd, from, len, retlen, buf);
+
+	mutex_lock(&hdr_cache_lock);
+
+	if (!mtdsplit_hdr_cache_setup(mtd) || block >= c->blocks) {
+		mutex_unlock(&hdr_cache_lock);
+		return mtd_read(mtd, from, len, retlen, buf);
+	}
+
+	hdr = c->data + block * MTDSPLIT_HDR_CACHE_LEN;
+	if (test_bit(block, c->valid)) {
+		c->hits++;
+	} else {
+		c->misses++;
+
+		start = ktime_get();
+		ret = mtd_read(mtd, from - block_off, MTDSPLIT_HDR_CACHE_LEN,
+			       &hdr_len, hdr);
+		c->read_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		/* Leave anything unusual (bitflips, bad blocks) to mtd_read() */
+		if (ret || hdr_len != MTDSPLIT_HDR_CACHE_LEN) {
+			mutex_unlock(&hdr_cache_lock);
+			return mtd_read(mtd, from, len, retlen, buf);
+		}
+
+		set_bit(block, c->valid);
+	}
+
+	memcpy(buf, hdr + block_off, len);
+	*retlen = len;
+
+	mod_delayed_work(system_wq, &hdr_cache_work, MTDSPLIT_HDR_CACHE_TIMEOUT);
+	mutex_unlock(&hdr_cache_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(mtdsplit_read);
+
+static int __init mtdsplit_init(void)
+{
+	register_mtd_user(&mtdsplit_notifier);
+	return 0;
+}
+subsys_initcall_sync(mtdsplit_init);
+
 struct squashfs_super_block {
 	__le32 s_magic;
 	__le32 pad0[9];
@@ -38,7 +224,7 @@ int mtd_get_squashfs_len(struct mtd_info *master,
 	size_t retlen;
 	int err;
 
-	err = mtd_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
+	err = mtdsplit_read(master, offset, sizeof(sb), &retlen, (void *)&sb);
 	if (err || (retlen != sizeof(sb))) {
 		pr_alert("error occured while reading from \"%s\"\n",
 			 master->name);
@@ -79,8 +265,8 @@ int mtd_check_rootfs_magic(struct mtd_info *mtd, size_t offset,
 	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, sizeof(magic), &retlen,
-		       (unsigned char *) &magic);
+	ret = mtdsplit_read(mtd, offset, sizeof(magic), &retlen,
+			    (unsigned char *) &magic);
 	if (ret)
 		return ret;
 
@@ -117,7 +117,7 @@ static int mtdsplit_elf_read_mtd(struct mtd_info *mtd, size_t offset,
 	size_t retlen;
 	int ret;
 
-	ret = mtd_read(mtd, offset, len, &retlen, dst);
+	ret = mtdsplit_read(mtd, offset, len, &retlen, dst);
 	if (ret) {
 		pr_debug("read error in \"%s\"\n", mtd->name);
 		return ret;
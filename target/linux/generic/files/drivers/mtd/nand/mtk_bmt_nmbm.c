@@ -1,3 +1,4 @@
+#include <linux/bitmap.h>
 #include <linux/crc32.h>
 #include <linux/slab.h>
 #include "mtk_bmt.h"
@@ -89,6 +90,10 @@ struct nmbm_instance {
 	u32 block_state_changed;
 	u32 state_table_size;
 
+	/* Derived from block_state, one bit per block */
+	unsigned long *good_blocks;
+	unsigned long *bad_blocks;
+
 	int32_t *block_mapping;
 	u32 block_mapping_changed;
 	u32 mapping_table_size;
@@ -470,6 +475,16 @@ static bool nmbm_set_block_state(struct nmbm_instance *ni, uint32_t ba,
 	uv |= state << shift;
 	ni->block_state[unit] = uv;
 
+	if (state == BLOCK_ST_GOOD)
+		__set_bit(ba, ni->good_blocks);
+	else
+		__clear_bit(ba, ni->good_blocks);
+
+	if (state == BLOCK_ST_BAD)
+		__set_bit(ba, ni->bad_blocks);
+	else
+		__clear_bit(ba, ni->bad_blocks);
+
 	if (orig != state) {
 		ni->block_state_changed++;
 		return true;
@@ -478,6 +493,28 @@ static bool nmbm_set_block_state(struct nmbm_instance *ni, uint32_t ba,
 	return false;
 }
 
+/*
+ * nmbm_sync_block_bitmaps - Rebuild good/bad block bitmaps from state table
+ * @ni: NMBM instance structure
+ *
+ * Must be called whenever the block state table is replaced as a whole.
+ */
+static void nmbm_sync_block_bitmaps(struct nmbm_instance *ni)
+{
+	uint32_t ba, state;
+
+	bitmap_zero(ni->good_blocks, ni->block_count);
+	bitmap_zero(ni->bad_blocks, ni->block_count);
+
+	for (ba = 0; ba < ni->block_count; ba++) {
+		state = nmbm_get_block_state(ni, ba);
+		if (state == BLOCK_ST_GOOD)
+			__set_bit(ba, ni->good_blocks);
+		else if (state == BLOCK_ST_BAD)
+			__set_bit(ba, ni->bad_blocks);
+	}
+}
+
 /*
  * nmbm_block_walk_asc - Skip specified number of good blocks, ascending addr.
  * @ni: NMBM instance structure
@@ -504,10 +541,11 @@ static bool nmbm_block_walk_asc(struct nmbm_instance *ni, uint32_t ba,
 		limit = ni->block_count - 1;
 
 	while (ba < limit) {
-		if (nmbm_get_block_state(ni, ba) == BLOCK_ST_GOOD)
-			nblock--;
+		ba = find_next_bit(ni->good_blocks, limit, ba);
+		if (ba >= limit)
+			break;
 
-		if (nblock < 0) {
+		if (!nblock--) {
 			*nba = ba;
 			return true;
 		}
@@ -538,20 +576,23 @@ static bool nmbm_block_walk_desc(struct nmbm_instance *ni, uint32_t ba,
 				 uint32_t *nba, uint32_t count, uint32_t limit)
 {
 	int32_t nblock = count;
+	uint32_t next;
 
 	if (limit >= ni->block_count)
 		limit = ni->block_count - 1;
 
 	while (ba > limit) {
-		if (nmbm_get_block_state(ni, ba) == BLOCK_ST_GOOD)
-			nblock--;
+		/* Returns ba + 1 if there is no good block in [0, ba] */
+		next = find_last_bit(ni->good_blocks, ba + 1);
+		if (next > ba || next <= limit)
+			break;
 
-		if (nblock < 0) {
-			*nba = ba;
+		if (!nblock--) {
+			*nba = next;
 			return true;
 		}
 
-		ba--;
+		ba = next - 1;
 	}
 
 	return false;
@@ -616,13 +657,11 @@ static void nmbm_build_mapping_table(struct nmbm_instance *ni)
 {
 	uint32_t pb, lb;
 
-	for (pb = 0, lb = 0; pb < ni->mgmt_start_ba; pb++) {
-		if (nmbm_get_block_state(ni, pb) == BLOCK_ST_BAD)
-			continue;
+	lb = 0;
 
-		/* Always map to the next good block */
+	/* Always map to the next good block */
+	for_each_clear_bit(pb, ni->bad_blocks, ni->mgmt_start_ba)
 		ni->block_mapping[lb++] = pb;
-	}
 
 	ni->data_block_count = lb;
 
@@ -1819,6 +1858,7 @@ static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 		memcpy(ni->block_state,
 		       (uint8_t *)ifthdr + ifthdr->state_table_off,
 		       ni->state_table_size);
+		nmbm_sync_block_bitmaps(ni);
 		memcpy(ni->block_mapping,
 		       (uint8_t *)ifthdr + ifthdr->mapping_table_off,
 		       ni->mapping_table_size);
@@ -2081,7 +2121,7 @@ static bool nmbm_find_signature(struct nmbm_instance *ni,
 static size_t nmbm_calc_structure_size(void)
 {
 	uint32_t state_table_size, mapping_table_size, info_table_size;
-	uint32_t block_count;
+	uint32_t block_count, bitmap_size;
 
 	block_count = bmtd.total_blks;
 
@@ -2089,6 +2129,7 @@ static size_t nmbm_calc_structure_size(void)
 	state_table_size = ((block_count + NMBM_BITMAP_BLOCKS_PER_UNIT - 1) /
 		NMBM_BITMAP_BLOCKS_PER_UNIT) * NMBM_BITMAP_UNIT_SIZE;
 	mapping_table_size = block_count * sizeof(int32_t);
+	bitmap_size = BITS_TO_LONGS(block_count) * sizeof(unsigned long);
 
 	info_table_size = ALIGN(sizeof(struct nmbm_info_table_header),
 				     bmtd.pg_size);
@@ -2096,7 +2137,7 @@ static size_t nmbm_calc_structure_size(void)
 	info_table_size += ALIGN(mapping_table_size, bmtd.pg_size);
 
 	return info_table_size + state_table_size + mapping_table_size +
-		sizeof(struct nmbm_instance);
+		2 * bitmap_size + sizeof(struct nmbm_instance);
 }
 
 /*
@@ -2137,9 +2178,15 @@ static void nmbm_init_structure(struct nmbm_instance *ni)
 	ni->info_table_spare_blocks = nmbm_get_spare_block_count(
 		size2blk(ni, ni->info_table_size));
 
-	/* Assign memory to members */
+	/* Assign memory to members, bitmaps first to keep them long-aligned */
 	ptr = (uintptr_t)ni + sizeof(*ni);
 
+	ni->good_blocks = (void *)ptr;
+	ptr += BITS_TO_LONGS(ni->block_count) * sizeof(unsigned long);
+
+	ni->bad_blocks = (void *)ptr;
+	ptr += BITS_TO_LONGS(ni->block_count) * sizeof(unsigned long);
+
 	ni->info_table_cache = (void *)ptr;
 	ptr += ni->info_table_size;
 
@@ -2154,6 +2201,7 @@ static void nmbm_init_structure(struct nmbm_instance *ni)
 	/* Initialize block state table */
 	ni->block_state_changed = 0;
 	memset(ni->block_state, 0xff, ni->state_table_size);
+	nmbm_sync_block_bitmaps(ni);
 
 	/* Initialize block mapping table */
 	ni->block_mapping_changed = 0;
@@ -27,6 +27,9 @@
 #include <linux/version.h>
 #include <uapi/linux/mii.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/swconfig.h>
+
 #define SWCONFIG_DEVNAME	"switch%d"
 
 #include "swconfig_leds.c"
@@ -280,6 +283,9 @@ static const struct nla_policy switch_policy[SWITCH_ATTR_MAX+1] = {
 	[SWITCH_ATTR_OP_VALUE_STR] = { .type = NLA_NUL_STRING },
 	[SWITCH_ATTR_OP_VALUE_PORTS] = { .type = NLA_NESTED },
 	[SWITCH_ATTR_TYPE] = { .type = NLA_U32 },
+	[SWITCH_ATTR_OP_BATCH] = { .type = NLA_NESTED },
+	[SWITCH_ATTR_OP] = { .type = NLA_NESTED },
+	[SWITCH_ATTR_OP_CMD] = { .type = NLA_U32 },
 };
 
 static const struct nla_policy port_policy[SWITCH_PORT_ATTR_MAX+1] = {
@@ -339,6 +345,13 @@ swconfig_put_dev(struct switch_dev *dev)
 	mutex_unlock(&dev->sw_mutex);
 }
 
+static int
+swconfig_reply(struct sk_buff *msg, struct genl_info *info)
+{
+	trace_swconfig_msg(info->genlhdr->cmd, msg->len);
+	return genlmsg_reply(msg, info);
+}
+
 static int
 swconfig_dump_attr(struct swconfig_callback *cb, void *arg)
 {
@@ -399,7 +412,7 @@ swconfig_send_multipart(struct swconfig_callback *cb, void *arg)
 			if (cb->close(cb, arg) < 0)
 				goto error;
 		}
-		err = genlmsg_reply(cb->msg, info);
+		err = swconfig_reply(cb->msg, info);
 		cb->msg = NULL;
 		if (err < 0)
 			goto error;
@@ -483,7 +496,7 @@ swconfig_list_attrs(struct sk_buff *skb, struct genl_info *info)
 	if (!cb.msg)
 		return 0;
 
-	return genlmsg_reply(cb.msg, info);
+	return swconfig_reply(cb.msg, info);
 
 error:
 	if (cb.msg)
@@ -494,10 +507,9 @@ out:
 }
 
 static const struct switch_attr *
-swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
+swconfig_lookup_attr(struct switch_dev *dev, int cmd, struct nlattr **attrs,
 		struct switch_val *val)
 {
-	struct genlmsghdr *hdr = nlmsg_data(info->nlhdr);
 	const struct switch_attrlist *alist;
 	const struct switch_attr *attr = NULL;
 	unsigned int attr_id;
@@ -507,10 +519,10 @@ swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
 	unsigned long *def_active;
 	int n_def;
 
-	if (!info->attrs[SWITCH_ATTR_OP_ID])
+	if (!attrs[SWITCH_ATTR_OP_ID])
 		goto done;
 
-	switch (hdr->cmd) {
+	switch (cmd) {
 	case SWITCH_CMD_SET_GLOBAL:
 	case SWITCH_CMD_GET_GLOBAL:
 		alist = &dev->ops->attr_global;
@@ -524,9 +536,9 @@ swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
 		def_list = default_vlan;
 		def_active = &dev->def_vlan;
 		n_def = ARRAY_SIZE(default_vlan);
-		if (!info->attrs[SWITCH_ATTR_OP_VLAN])
+		if (!attrs[SWITCH_ATTR_OP_VLAN])
 			goto done;
-		val->port_vlan = nla_get_u32(info->attrs[SWITCH_ATTR_OP_VLAN]);
+		val->port_vlan = nla_get_u32(attrs[SWITCH_ATTR_OP_VLAN]);
 		if (val->port_vlan >= dev->vlans)
 			goto done;
 		break;
@@ -536,9 +548,9 @@ swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
 		def_list = default_port;
 		def_active = &dev->def_port;
 		n_def = ARRAY_SIZE(default_port);
-		if (!info->attrs[SWITCH_ATTR_OP_PORT])
+		if (!attrs[SWITCH_ATTR_OP_PORT])
 			goto done;
-		val->port_vlan = nla_get_u32(info->attrs[SWITCH_ATTR_OP_PORT]);
+		val->port_vlan = nla_get_u32(attrs[SWITCH_ATTR_OP_PORT]);
 		if (val->port_vlan >= dev->ports)
 			goto done;
 		break;
@@ -550,7 +562,7 @@ swconfig_lookup_attr(struct switch_dev *dev, struct genl_info *info,
 	if (!alist)
 		goto done;
 
-	attr_id = nla_get_u32(info->attrs[SWITCH_ATTR_OP_ID]);
+	attr_id = nla_get_u32(attrs[SWITCH_ATTR_OP_ID]);
 	if (attr_id >= SWITCH_ATTR_DEFAULTS_OFFSET) {
 		attr_id -= SWITCH_ATTR_DEFAULTS_OFFSET;
 		if (attr_id >= n_def)
@@ -623,79 +635,92 @@ swconfig_parse_link(struct sk_buff *msg, struct nlattr *nla,
 	return 0;
 }
 
+/* parse the new value for attr from attrs and pass it to the driver */
 static int
-swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
+swconfig_do_set(struct sk_buff *skb, struct switch_dev *dev,
+		const struct switch_attr *attr, struct nlattr **attrs,
+		struct switch_val *val)
 {
-	const struct switch_attr *attr;
-	struct switch_dev *dev;
-	struct switch_val val;
-	int err = -EINVAL;
-
-	if (!capable(CAP_NET_ADMIN))
-		return -EPERM;
-
-	dev = swconfig_get_dev(info);
-	if (!dev)
-		return -EINVAL;
-
-	memset(&val, 0, sizeof(val));
-	attr = swconfig_lookup_attr(dev, info, &val);
-	if (!attr || !attr->set)
-		goto error;
+	int err;
 
-	val.attr = attr;
+	val->attr = attr;
 	switch (attr->type) {
 	case SWITCH_TYPE_NOVAL:
 		break;
 	case SWITCH_TYPE_INT:
-		if (!info->attrs[SWITCH_ATTR_OP_VALUE_INT])
-			goto error;
-		val.value.i =
-			nla_get_u32(info->attrs[SWITCH_ATTR_OP_VALUE_INT]);
+		if (!attrs[SWITCH_ATTR_OP_VALUE_INT])
+			return -EINVAL;
+		val->value.i =
+			nla_get_u32(attrs[SWITCH_ATTR_OP_VALUE_INT]);
 		break;
 	case SWITCH_TYPE_STRING:
-		if (!info->attrs[SWITCH_ATTR_OP_VALUE_STR])
-			goto error;
-		val.value.s =
-			nla_data(info->attrs[SWITCH_ATTR_OP_VALUE_STR]);
+		if (!attrs[SWITCH_ATTR_OP_VALUE_STR])
+			return -EINVAL;
+		val->value.s =
+			nla_data(attrs[SWITCH_ATTR_OP_VALUE_STR]);
 		break;
 	case SWITCH_TYPE_PORTS:
-		val.value.ports = dev->portbuf;
+		val->value.ports = dev->portbuf;
 		memset(dev->portbuf, 0,
 			sizeof(struct switch_port) * dev->ports);
 
 		/* TODO: implement multipart? */
-		if (info->attrs[SWITCH_ATTR_OP_VALUE_PORTS]) {
+		if (attrs[SWITCH_ATTR_OP_VALUE_PORTS]) {
 			err = swconfig_parse_ports(skb,
-				info->attrs[SWITCH_ATTR_OP_VALUE_PORTS],
-				&val, dev->ports);
+				attrs[SWITCH_ATTR_OP_VALUE_PORTS],
+				val, dev->ports);
 			if (err < 0)
-				goto error;
+				return err;
 		} else {
-			val.len = 0;
-			err = 0;
+			val->len = 0;
 		}
 		break;
 	case SWITCH_TYPE_LINK:
-		val.value.link = &dev->linkbuf;
+		val->value.link = &dev->linkbuf;
 		memset(&dev->linkbuf, 0, sizeof(struct switch_port_link));
 
-		if (info->attrs[SWITCH_ATTR_OP_VALUE_LINK]) {
+		if (attrs[SWITCH_ATTR_OP_VALUE_LINK]) {
 			err = swconfig_parse_link(skb,
-						  info->attrs[SWITCH_ATTR_OP_VALUE_LINK],
-						  val.value.link);
+						  attrs[SWITCH_ATTR_OP_VALUE_LINK],
+						  val->value.link);
 			if (err < 0)
-				goto error;
+				return err;
 		} else {
-			val.len = 0;
-			err = 0;
+			val->len = 0;
 		}
 		break;
 	default:
-		goto error;
+		return -EINVAL;
 	}
 
-	err = attr->set(dev, attr, &val);
+	err = attr->set(dev, attr, val);
+	trace_swconfig_attr(dev, attr, val, true, err);
+
+	return err;
+}
+
+static int
+swconfig_set_attr(struct sk_buff *skb, struct genl_info *info)
+{
+	struct genlmsghdr *hdr = nlmsg_data(info->nlhdr);
+	const struct switch_attr *attr;
+	struct switch_dev *dev;
+	struct switch_val val;
+	int err = -EINVAL;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	dev = swconfig_get_dev(info);
+	if (!dev)
+		return -EINVAL;
+
+	memset(&val, 0, sizeof(val));
+	attr = swconfig_lookup_attr(dev, hdr->cmd, info->attrs, &val);
+	if (!attr || !attr->set)
+		goto error;
+
+	err = swconfig_do_set(skb, dev, attr, info->attrs, &val);
 error:
 	swconfig_put_dev(dev);
 	return err;
@@ -821,6 +846,27 @@ nla_put_failure:
 	return -1;
 }
 
+static int
+swconfig_do_get(struct switch_dev *dev, const struct switch_attr *attr,
+		struct switch_val *val)
+{
+	int err;
+
+	if (attr->type == SWITCH_TYPE_PORTS) {
+		val->value.ports = dev->portbuf;
+		memset(dev->portbuf, 0,
+			sizeof(struct switch_port) * dev->ports);
+	} else if (attr->type == SWITCH_TYPE_LINK) {
+		val->value.link = &dev->linkbuf;
+		memset(&dev->linkbuf, 0, sizeof(struct switch_port_link));
+	}
+
+	err = attr->get(dev, attr, val);
+	trace_swconfig_attr(dev, attr, val, false, err);
+
+	return err;
+}
+
 static int
 swconfig_get_attr(struct sk_buff *skb, struct genl_info *info)
 {
@@ -837,20 +883,11 @@ swconfig_get_attr(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 
 	memset(&val, 0, sizeof(val));
-	attr = swconfig_lookup_attr(dev, info, &val);
+	attr = swconfig_lookup_attr(dev, cmd, info->attrs, &val);
 	if (!attr || !attr->get)
 		goto error;
 
-	if (attr->type == SWITCH_TYPE_PORTS) {
-		val.value.ports = dev->portbuf;
-		memset(dev->portbuf, 0,
-			sizeof(struct switch_port) * dev->ports);
-	} else if (attr->type == SWITCH_TYPE_LINK) {
-		val.value.link = &dev->linkbuf;
-		memset(&dev->linkbuf, 0, sizeof(struct switch_port_link));
-	}
-
-	err = attr->get(dev, attr, &val);
+	err = swconfig_do_get(dev, attr, &val);
 	if (err)
 		goto error;
 
@@ -895,7 +932,7 @@ swconfig_get_attr(struct sk_buff *skb, struct genl_info *info)
 		goto nla_put_failure;
 
 	swconfig_put_dev(dev);
-	return genlmsg_reply(msg, info);
+	return swconfig_reply(msg, info);
 
 nla_put_failure:
 	if (msg)
@@ -907,6 +944,237 @@ error:
 	return err;
 }
 
+/*
+ * SWITCH_CMD_BATCH carries a list of SWITCH_ATTR_OP entries, each holding
+ * the attributes of a regular get or set request plus SWITCH_ATTR_OP_CMD.
+ * All operations are run in order under a single device lock. Results of
+ * get requests and errors of any request are returned as SWITCH_ATTR_OP
+ * entries tagged with the operation's index in the request.
+ */
+struct swconfig_batch {
+	struct genl_info *info;
+	struct sk_buff *msg;
+	struct nlattr *nest;
+	void *hdr;
+};
+
+static int
+swconfig_put_ports(struct sk_buff *msg, const struct switch_val *val)
+{
+	struct nlattr *n, *p;
+	int i;
+
+	n = nla_nest_start(msg, SWITCH_ATTR_OP_VALUE_PORTS);
+	if (!n)
+		return -EMSGSIZE;
+
+	for (i = 0; i < val->len; i++) {
+		const struct switch_port *port = &val->value.ports[i];
+
+		p = nla_nest_start(msg, SWITCH_ATTR_PORT);
+		if (!p)
+			return -EMSGSIZE;
+		if (nla_put_u32(msg, SWITCH_PORT_ID, port->id))
+			return -EMSGSIZE;
+		if ((port->flags & (1 << SWITCH_PORT_FLAG_TAGGED)) &&
+		    nla_put_flag(msg, SWITCH_PORT_FLAG_TAGGED))
+			return -EMSGSIZE;
+		nla_nest_end(msg, p);
+	}
+	nla_nest_end(msg, n);
+
+	return 0;
+}
+
+static int
+swconfig_batch_start(struct swconfig_batch *b)
+{
+	b->msg = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!b->msg)
+		return -ENOMEM;
+
+	b->hdr = genlmsg_put(b->msg, b->info->snd_portid, b->info->snd_seq,
+			&switch_fam, NLM_F_MULTI, SWITCH_CMD_BATCH);
+	if (!b->hdr)
+		goto error;
+
+	b->nest = nla_nest_start(b->msg, SWITCH_ATTR_OP_BATCH);
+	if (!b->nest)
+		goto error;
+
+	return 0;
+
+error:
+	nlmsg_free(b->msg);
+	b->msg = NULL;
+	return -EMSGSIZE;
+}
+
+static int
+swconfig_batch_flush(struct swconfig_batch *b)
+{
+	struct sk_buff *msg = b->msg;
+
+	if (!msg)
+		return 0;
+
+	b->msg = NULL;
+	nla_nest_end(msg, b->nest);
+	genlmsg_end(msg, b->hdr);
+	return swconfig_reply(msg, b->info);
+}
+
+static int
+swconfig_batch_put(struct swconfig_batch *b, u32 index, int result,
+		   const struct switch_attr *attr, const struct switch_val *val)
+{
+	struct nlattr *op;
+	int err;
+
+	if (!b->msg) {
+		err = swconfig_batch_start(b);
+		if (err)
+			return err;
+	}
+
+	op = nla_nest_start(b->msg, SWITCH_ATTR_OP);
+	if (!op)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(b->msg, SWITCH_ATTR_OP_INDEX, index))
+		goto nla_put_failure;
+
+	if (result) {
+		if (nla_put_u32(b->msg, SWITCH_ATTR_OP_ERROR, -result))
+			goto nla_put_failure;
+	} else {
+		switch (attr->type) {
+		case SWITCH_TYPE_INT:
+			err = nla_put_u32(b->msg, SWITCH_ATTR_OP_VALUE_INT,
+					  val->value.i);
+			break;
+		case SWITCH_TYPE_STRING:
+			err = nla_put_string(b->msg, SWITCH_ATTR_OP_VALUE_STR,
+					     val->value.s);
+			break;
+		case SWITCH_TYPE_PORTS:
+			err = swconfig_put_ports(b->msg, val);
+			break;
+		case SWITCH_TYPE_LINK:
+			err = swconfig_send_link(b->msg, b->info,
+						 SWITCH_ATTR_OP_VALUE_LINK,
+						 val->value.link);
+			break;
+		default:
+			err = 0;
+			break;
+		}
+		if (err)
+			goto nla_put_failure;
+	}
+
+	nla_nest_end(b->msg, op);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(b->msg, op);
+	return -EMSGSIZE;
+}
+
+static int
+swconfig_batch_op(struct sk_buff *skb, struct switch_dev *dev,
+		  struct nlattr *nla, struct switch_val *val, bool *get)
+{
+	struct nlattr *tb[SWITCH_ATTR_MAX + 1];
+	const struct switch_attr *attr;
+	int cmd;
+
+	*get = false;
+	memset(val, 0, sizeof(*val));
+	if (nla_parse_nested_deprecated(tb, SWITCH_ATTR_MAX, nla,
+			switch_policy, NULL))
+		return -EINVAL;
+
+	if (!tb[SWITCH_ATTR_OP_CMD])
+		return -EINVAL;
+
+	cmd = nla_get_u32(tb[SWITCH_ATTR_OP_CMD]);
+	switch (cmd) {
+	case SWITCH_CMD_SET_GLOBAL:
+	case SWITCH_CMD_SET_VLAN:
+	case SWITCH_CMD_SET_PORT:
+		if (!capable(CAP_NET_ADMIN))
+			return -EPERM;
+
+		attr = swconfig_lookup_attr(dev, cmd, tb, val);
+		if (!attr || !attr->set)
+			return -EINVAL;
+
+		return swconfig_do_set(skb, dev, attr, tb, val);
+	case SWITCH_CMD_GET_GLOBAL:
+	case SWITCH_CMD_GET_VLAN:
+	case SWITCH_CMD_GET_PORT:
+		*get = true;
+		attr = swconfig_lookup_attr(dev, cmd, tb, val);
+		if (!attr || !attr->get || attr->type == SWITCH_TYPE_NOVAL)
+			return -EINVAL;
+
+		return swconfig_do_get(dev, attr, val);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+swconfig_batch(struct sk_buff *skb, struct genl_info *info)
+{
+	struct swconfig_batch b = { .info = info };
+	struct switch_dev *dev;
+	struct switch_val val;
+	struct nlattr *nla;
+	u32 index = 0;
+	int err = 0;
+	int rem;
+
+	dev = swconfig_get_dev(info);
+	if (!dev)
+		return -EINVAL;
+
+	if (!info->attrs[SWITCH_ATTR_OP_BATCH])
+		goto out;
+
+	nla_for_each_nested(nla, info->attrs[SWITCH_ATTR_OP_BATCH], rem) {
+		bool get;
+		int ret;
+
+		if (nla_type(nla) != SWITCH_ATTR_OP)
+			continue;
+
+		ret = swconfig_batch_op(skb, dev, nla, &val, &get);
+		if (ret || get) {
+			err = swconfig_batch_put(&b, index, ret, val.attr, &val);
+			if (err == -EMSGSIZE && b.msg) {
+				/* result does not fit, continue in a new message */
+				err = swconfig_batch_flush(&b);
+				if (!err)
+					err = swconfig_batch_put(&b, index, ret,
+								 val.attr, &val);
+			}
+			if (err)
+				goto error;
+		}
+		index++;
+	}
+
+	err = swconfig_batch_flush(&b);
+error:
+	if (b.msg)
+		nlmsg_free(b.msg);
+out:
+	swconfig_put_dev(dev);
+	return err;
+}
+
 static int
 swconfig_send_switch(struct sk_buff *msg, u32 pid, u32 seq, int flags,
 		const struct switch_dev *dev)
@@ -978,6 +1246,7 @@ static int swconfig_dump_switches(struct sk_buff *skb,
 	}
 	swconfig_unlock();
 	cb->args[0] = idx;
+	trace_swconfig_msg(SWITCH_CMD_GET_SWITCH, skb->len);
 
 	return skb->len;
 }
@@ -1037,6 +1306,11 @@ static struct genl_ops swconfig_ops[] = {
 		.flags = GENL_ADMIN_PERM,
 		.doit = swconfig_set_attr,
 	},
+	{
+		.cmd = SWITCH_CMD_BATCH,
+		.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
+		.doit = swconfig_batch,
+	},
 	{
 		.cmd = SWITCH_CMD_GET_SWITCH,
 		.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
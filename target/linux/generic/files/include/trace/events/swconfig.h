@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM swconfig
+
+#if !defined(_TRACE_SWCONFIG_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_SWCONFIG_H
+
+#include <linux/switch.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(swconfig_attr,
+
+	TP_PROTO(const struct switch_dev *dev, const struct switch_attr *attr,
+		 const struct switch_val *val, bool set, int err),
+
+	TP_ARGS(dev, attr, val, set, err),
+
+	TP_STRUCT__entry(
+		__string(dev, dev->devname)
+		__string(attr, attr->name)
+		__field(unsigned int, port_vlan)
+		__field(bool, set)
+		__field(int, err)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev->devname);
+		__assign_str(attr, attr->name);
+		__entry->port_vlan = val->port_vlan;
+		__entry->set = set;
+		__entry->err = err;
+	),
+
+	TP_printk("%s: %s %s port/vlan=%u err=%d", __get_str(dev),
+		  __entry->set ? "set" : "get", __get_str(attr),
+		  __entry->port_vlan, __entry->err)
+);
+
+TRACE_EVENT(swconfig_msg,
+
+	TP_PROTO(int cmd, unsigned int len),
+
+	TP_ARGS(cmd, len),
+
+	TP_STRUCT__entry(
+		__field(int, cmd)
+		__field(unsigned int, len)
+	),
+
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->len = len;
+	),
+
+	TP_printk("cmd=%d len=%u", __entry->cmd, __entry->len)
+);
+
+#endif /* _TRACE_SWCONFIG_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
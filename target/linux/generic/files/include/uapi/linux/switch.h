@@ -54,6 +54,12 @@ enum {
 	SWITCH_ATTR_OP_DESCRIPTION,
 	/* port lists */
 	SWITCH_ATTR_PORT,
+	/* batched operations */
+	SWITCH_ATTR_OP_BATCH,
+	SWITCH_ATTR_OP,
+	SWITCH_ATTR_OP_CMD,
+	SWITCH_ATTR_OP_INDEX,
+	SWITCH_ATTR_OP_ERROR,
 	SWITCH_ATTR_MAX
 };
 
@@ -78,7 +84,8 @@ enum {
 	SWITCH_CMD_SET_PORT,
 	SWITCH_CMD_LIST_VLAN,
 	SWITCH_CMD_GET_VLAN,
-	SWITCH_CMD_SET_VLAN
+	SWITCH_CMD_SET_VLAN,
+	SWITCH_CMD_BATCH
 };
 
 /* data types */
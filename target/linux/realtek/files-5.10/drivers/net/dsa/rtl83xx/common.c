@@ -640,6 +640,7 @@ int rtl83xx_l2_nexthop_add(struct rtl838x_switch_priv *priv, struct rtl83xx_next
 	e.nh_vlan_target = false;
 
 	priv->r->write_l2_entry_using_hash(idx >> 2, idx & 0x3, &e);
+	rtl83xx_l2_shadow_update(priv, idx);
 
 	return 0;
 }
@@ -669,6 +670,7 @@ int rtl83xx_l2_nexthop_rm(struct rtl838x_switch_priv *priv, struct rtl83xx_nexth
 	e.rvid = nh->rvid;
 
 	priv->r->write_l2_entry_using_hash(key, i, &e);
+	rtl83xx_l2_shadow_update(priv, nh->l2_id);
 
 	return 0;
 }
@@ -1538,6 +1540,11 @@ static int __init rtl83xx_sw_probe(struct platform_device *pdev)
 	}
 	pr_debug("Chip version %c\n", priv->version);
 
+	priv->l2_shadow = devm_kcalloc(dev, priv->fib_entries + RTL83XX_L2_CAM_ENTRIES,
+				       sizeof(*priv->l2_shadow), GFP_KERNEL);
+	if (!priv->l2_shadow)
+		return -ENOMEM;
+
 	err = rtl83xx_mdio_probe(priv);
 	if (err) {
 		/* Probing fails the 1st time because of missing ethernet driver
@@ -1654,6 +1661,9 @@ static int __init rtl83xx_sw_probe(struct platform_device *pdev)
 		rtl930x_dbgfs_init(priv);
 	}
 
+	rtl83xx_l2_shadow_start(priv);
+	platform_set_drvdata(pdev, priv);
+
 	return 0;
 
 err_register_fib_nb:
@@ -1666,8 +1676,12 @@ err_register_nb:
 
 static int rtl83xx_sw_remove(struct platform_device *pdev)
 {
+	struct rtl838x_switch_priv *priv = platform_get_drvdata(pdev);
+
 	// TODO:
 	pr_debug("Removing platform driver for rtl83xx-sw\n");
+	if (priv)
+		rtl83xx_l2_shadow_stop(priv);
 	return 0;
 }
 
@@ -373,6 +373,77 @@ static const struct file_operations l2_table_fops = {
 	.release = single_release,
 };
 
+static bool l2_shadow_entry_equal(struct rtl838x_l2_entry *a, struct rtl838x_l2_entry *b)
+{
+	if (!a->valid || !b->valid)
+		return a->valid == b->valid;
+
+	/* The age of dynamic entries changes all the time, ignore it */
+	return a->type == b->type && ether_addr_equal(a->mac, b->mac)
+		&& a->vid == b->vid && a->rvid == b->rvid && a->port == b->port
+		&& a->is_static == b->is_static && a->next_hop == b->next_hop
+		&& a->mc_portmask_index == b->mc_portmask_index
+		&& a->mc_gip == b->mc_gip && a->mc_sip == b->mc_sip;
+}
+
+static void l2_shadow_print_entry(struct seq_file *m, struct rtl838x_switch_priv *priv,
+				  const char *name, struct rtl838x_l2_entry *e)
+{
+	seq_printf(m, "  %s: ", name);
+	if (e->valid)
+		l2_table_print_entry(m, priv, e);
+	else
+		seq_puts(m, "invalid\n");
+}
+
+/*
+ * Compares the shadow copy of the L2 table against the hardware and
+ * reports all entries that differ
+ */
+static int l2_shadow_show(struct seq_file *m, void *v)
+{
+	struct rtl838x_switch_priv *priv = m->private;
+	struct rtl838x_l2_entry e;
+	int i, n = priv->fib_entries + RTL83XX_L2_CAM_ENTRIES;
+	int mismatches = 0;
+
+	mutex_lock(&priv->reg_mutex);
+
+	for (i = 0; i < n; i++) {
+		rtl83xx_l2_shadow_read(priv, i, &e);
+
+		if (l2_shadow_entry_equal(&e, &priv->l2_shadow[i]))
+			continue;
+
+		mismatches++;
+		if (i < priv->fib_entries)
+			seq_printf(m, "Hash table bucket %d index %d differs\n", i >> 2, i & 0x3);
+		else
+			seq_printf(m, "CAM index %d differs\n", i - priv->fib_entries);
+		l2_shadow_print_entry(m, priv, "hardware", &e);
+		l2_shadow_print_entry(m, priv, "shadow", &priv->l2_shadow[i]);
+	}
+
+	mutex_unlock(&priv->reg_mutex);
+
+	seq_printf(m, "%d entries checked, %d mismatches\n", n, mismatches);
+
+	return 0;
+}
+
+static int l2_shadow_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, l2_shadow_show, inode->i_private);
+}
+
+static const struct file_operations l2_shadow_fops = {
+	.owner = THIS_MODULE,
+	.open = l2_shadow_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static ssize_t age_out_read(struct file *filp, char __user *buffer, size_t count,
 			     loff_t *ppos)
 {
@@ -713,6 +784,8 @@ void rtl838x_dbgfs_init(struct rtl838x_switch_priv *priv)
 
 	debugfs_create_file("l2_table", 0400, rtl838x_dir, priv, &l2_table_fops);
 
+	debugfs_create_file("l2_shadow", 0400, rtl838x_dir, priv, &l2_shadow_fops);
+
 	return;
 err:
 	rtl838x_dbgfs_cleanup(priv);
@@ -732,4 +805,6 @@ void rtl930x_dbgfs_init(struct rtl838x_switch_priv *priv)
 	debugfs_create_file("drop_counters", 0400, dbg_dir, priv, &drop_counter_fops);
 
 	debugfs_create_file("l2_table", 0400, dbg_dir, priv, &l2_table_fops);
+
+	debugfs_create_file("l2_shadow", 0400, dbg_dir, priv, &l2_shadow_fops);
 }
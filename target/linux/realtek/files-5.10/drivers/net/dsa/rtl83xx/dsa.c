@@ -1320,6 +1320,83 @@ void rtl83xx_port_stp_state_set(struct dsa_switch *ds, int port, u8 state)
 	mutex_unlock(&priv->reg_mutex);
 }
 
+/*
+ * The L2 hash table and the CAM are mirrored in priv->l2_shadow, so that FDB
+ * dumps do not have to read the entire table from the switch. Shadow entries
+ * are indexed like the hash table (bucket << 2 | slot), the CAM follows at
+ * offset fib_entries. Entries written by the driver are re-read right after
+ * the write, entries learned or aged out by the switch itself are picked up
+ * by a background reconciliation which re-reads a chunk of the table every
+ * RTL83XX_L2_SHADOW_INTERVAL. Must be called with reg_mutex held.
+ */
+void rtl83xx_l2_shadow_read(struct rtl838x_switch_priv *priv, int idx,
+			    struct rtl838x_l2_entry *e)
+{
+	if (idx < priv->fib_entries)
+		priv->r->read_l2_entry_using_hash(idx >> 2, idx & 0x3, e);
+	else
+		priv->r->read_cam(idx - priv->fib_entries, e);
+}
+
+void rtl83xx_l2_shadow_update(struct rtl838x_switch_priv *priv, int idx)
+{
+	rtl83xx_l2_shadow_read(priv, idx, &priv->l2_shadow[idx]);
+}
+
+static void rtl83xx_l2_shadow_flush_port(struct rtl838x_switch_priv *priv, int port,
+					 bool with_static)
+{
+	struct rtl838x_l2_entry *e;
+	int i;
+
+	for (i = 0; i < priv->fib_entries + RTL83XX_L2_CAM_ENTRIES; i++) {
+		e = &priv->l2_shadow[i];
+		if (!e->valid || e->port != port || e->type != L2_UNICAST)
+			continue;
+		if (e->is_static && !with_static)
+			continue;
+		e->valid = false;
+	}
+}
+
+static void rtl83xx_l2_shadow_work(struct work_struct *work)
+{
+	struct rtl838x_switch_priv *priv = container_of(to_delayed_work(work),
+					struct rtl838x_switch_priv, l2_shadow_work);
+	int n = priv->fib_entries + RTL83XX_L2_CAM_ENTRIES;
+	int i;
+
+	mutex_lock(&priv->reg_mutex);
+
+	for (i = 0; i < RTL83XX_L2_SHADOW_CHUNK; i++) {
+		rtl83xx_l2_shadow_update(priv, priv->l2_shadow_pos);
+		priv->l2_shadow_pos = (priv->l2_shadow_pos + 1) % n;
+	}
+
+	mutex_unlock(&priv->reg_mutex);
+
+	schedule_delayed_work(&priv->l2_shadow_work, RTL83XX_L2_SHADOW_INTERVAL);
+}
+
+void rtl83xx_l2_shadow_start(struct rtl838x_switch_priv *priv)
+{
+	int i;
+
+	mutex_lock(&priv->reg_mutex);
+	for (i = 0; i < priv->fib_entries + RTL83XX_L2_CAM_ENTRIES; i++)
+		rtl83xx_l2_shadow_update(priv, i);
+	priv->l2_shadow_pos = 0;
+	mutex_unlock(&priv->reg_mutex);
+
+	INIT_DELAYED_WORK(&priv->l2_shadow_work, rtl83xx_l2_shadow_work);
+	schedule_delayed_work(&priv->l2_shadow_work, RTL83XX_L2_SHADOW_INTERVAL);
+}
+
+void rtl83xx_l2_shadow_stop(struct rtl838x_switch_priv *priv)
+{
+	cancel_delayed_work_sync(&priv->l2_shadow_work);
+}
+
 void rtl83xx_fast_age(struct dsa_switch *ds, int port)
 {
 	struct rtl838x_switch_priv *priv = ds->priv;
@@ -1342,6 +1419,8 @@ void rtl83xx_fast_age(struct dsa_switch *ds, int port)
 
 	do { } while (sw_r32(priv->r->l2_tbl_flush_ctrl) & BIT(26 + s));
 
+	rtl83xx_l2_shadow_flush_port(priv, port, true);
+
 	mutex_unlock(&priv->reg_mutex);
 }
 
@@ -1357,6 +1436,8 @@ void rtl931x_fast_age(struct dsa_switch *ds, int port)
 
 	do { } while (sw_r32(RTL931X_L2_TBL_FLUSH_CTRL) & BIT (28));
 
+	rtl83xx_l2_shadow_flush_port(priv, port, false);
+
 	mutex_unlock(&priv->reg_mutex);
 }
 
@@ -1375,6 +1456,8 @@ void rtl930x_fast_age(struct dsa_switch *ds, int port)
 
 	do { } while (sw_r32(priv->r->l2_tbl_flush_ctrl) & BIT(30));
 
+	rtl83xx_l2_shadow_flush_port(priv, port, false);
+
 	mutex_unlock(&priv->reg_mutex);
 }
 
@@ -1661,6 +1744,7 @@ static int rtl83xx_port_fdb_add(struct dsa_switch *ds, int port,
 	if (idx >= 0) {
 		rtl83xx_setup_l2_uc_entry(&e, port, vid, mac);
 		priv->r->write_l2_entry_using_hash(idx >> 2, idx & 0x3, &e);
+		rtl83xx_l2_shadow_update(priv, idx);
 		goto out;
 	}
 
@@ -1670,6 +1754,7 @@ static int rtl83xx_port_fdb_add(struct dsa_switch *ds, int port,
 	if (idx >= 0) {
 		rtl83xx_setup_l2_uc_entry(&e, port, vid, mac);
 		priv->r->write_cam(idx, &e);
+		rtl83xx_l2_shadow_update(priv, priv->fib_entries + idx);
 		goto out;
 	}
 
@@ -1697,6 +1782,7 @@ static int rtl83xx_port_fdb_del(struct dsa_switch *ds, int port,
 		pr_debug("Found entry index %d, key %d and bucket %d\n", idx, idx >> 2, idx & 3);
 		e.valid = false;
 		priv->r->write_l2_entry_using_hash(idx >> 2, idx & 0x3, &e);
+		rtl83xx_l2_shadow_update(priv, idx);
 		goto out;
 	}
 
@@ -1706,6 +1792,7 @@ static int rtl83xx_port_fdb_del(struct dsa_switch *ds, int port,
 	if (idx >= 0) {
 		e.valid = false;
 		priv->r->write_cam(idx, &e);
+		rtl83xx_l2_shadow_update(priv, priv->fib_entries + idx);
 		goto out;
 	}
 	err = -ENOENT;
@@ -1717,30 +1804,30 @@ out:
 static int rtl83xx_port_fdb_dump(struct dsa_switch *ds, int port,
 				 dsa_fdb_dump_cb_t *cb, void *data)
 {
-	struct rtl838x_l2_entry e;
+	struct rtl838x_l2_entry *e;
 	struct rtl838x_switch_priv *priv = ds->priv;
 	int i;
 
 	mutex_lock(&priv->reg_mutex);
 
 	for (i = 0; i < priv->fib_entries; i++) {
-		priv->r->read_l2_entry_using_hash(i >> 2, i & 0x3, &e);
+		e = &priv->l2_shadow[i];
 
-		if (!e.valid)
+		if (!e->valid)
 			continue;
 
-		if (e.port == port || e.port == RTL930X_PORT_IGNORE)
-			cb(e.mac, e.vid, e.is_static, data);
+		if (e->port == port || e->port == RTL930X_PORT_IGNORE)
+			cb(e->mac, e->vid, e->is_static, data);
 	}
 
-	for (i = 0; i < 64; i++) {
-		priv->r->read_cam(i, &e);
+	for (i = 0; i < RTL83XX_L2_CAM_ENTRIES; i++) {
+		e = &priv->l2_shadow[priv->fib_entries + i];
 
-		if (!e.valid)
+		if (!e->valid)
 			continue;
 
-		if (e.port == port)
-			cb(e.mac, e.vid, e.is_static, data);
+		if (e->port == port)
+			cb(e->mac, e->vid, e->is_static, data);
 	}
 
 	mutex_unlock(&priv->reg_mutex);
@@ -1795,6 +1882,7 @@ static void rtl83xx_port_mdb_add(struct dsa_switch *ds, int port,
 			}
 			rtl83xx_setup_l2_mc_entry(&e, vid, mac, mc_group);
 			priv->r->write_l2_entry_using_hash(idx >> 2, idx & 0x3, &e);
+			rtl83xx_l2_shadow_update(priv, idx);
 		}
 		goto out;
 	}
@@ -1816,6 +1904,7 @@ static void rtl83xx_port_mdb_add(struct dsa_switch *ds, int port,
 			}
 			rtl83xx_setup_l2_mc_entry(&e, vid, mac, mc_group);
 			priv->r->write_cam(idx, &e);
+			rtl83xx_l2_shadow_update(priv, priv->fib_entries + idx);
 		}
 		goto out;
 	}
@@ -1855,6 +1944,7 @@ int rtl83xx_port_mdb_del(struct dsa_switch *ds, int port,
 		if (!portmask) {
 			e.valid = false;
 			priv->r->write_l2_entry_using_hash(idx >> 2, idx & 0x3, &e);
+			rtl83xx_l2_shadow_update(priv, idx);
 		}
 		goto out;
 	}
@@ -1867,6 +1957,7 @@ int rtl83xx_port_mdb_del(struct dsa_switch *ds, int port,
 		if (!portmask) {
 			e.valid = false;
 			priv->r->write_cam(idx, &e);
+			rtl83xx_l2_shadow_update(priv, priv->fib_entries + idx);
 		}
 		goto out;
 	}
@@ -1066,6 +1066,9 @@ struct rtl838x_switch_priv {
 	u64 irq_mask;
 	u32 fib_entries;
 	int l2_bucket_size;
+	struct rtl838x_l2_entry *l2_shadow;	// Copy of L2 hash table and CAM, see dsa.c
+	int l2_shadow_pos;
+	struct delayed_work l2_shadow_work;
 	struct dentry *dbgfs_dir;
 	int n_lags;
 	u64 lags_port_members[MAX_LAGS];
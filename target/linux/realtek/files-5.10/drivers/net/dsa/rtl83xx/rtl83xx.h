@@ -11,6 +11,10 @@
 #define RTL8390_VERSION_A 'A'
 #define RTL8380_VERSION_B 'B'
 
+#define RTL83XX_L2_CAM_ENTRIES		64
+#define RTL83XX_L2_SHADOW_CHUNK		512
+#define RTL83XX_L2_SHADOW_INTERVAL	HZ
+
 struct fdb_update_work {
 	struct work_struct work;
 	struct net_device *ndev;
@@ -79,6 +83,12 @@ int rtl83xx_packet_cntr_alloc(struct rtl838x_switch_priv *priv);
 
 int rtl83xx_port_is_under(const struct net_device * dev, struct rtl838x_switch_priv *priv);
 
+void rtl83xx_l2_shadow_read(struct rtl838x_switch_priv *priv, int idx,
+			    struct rtl838x_l2_entry *e);
+void rtl83xx_l2_shadow_update(struct rtl838x_switch_priv *priv, int idx);
+void rtl83xx_l2_shadow_start(struct rtl838x_switch_priv *priv);
+void rtl83xx_l2_shadow_stop(struct rtl838x_switch_priv *priv);
+
 int read_phy(u32 port, u32 page, u32 reg, u32 *val);
 int write_phy(u32 port, u32 page, u32 reg, u32 val);
 
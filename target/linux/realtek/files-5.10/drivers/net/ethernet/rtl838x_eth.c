@@ -17,6 +17,7 @@
 #include <linux/module.h>
 #include <linux/phylink.h>
 #include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
 #include <net/dsa.h>
 #include <net/switchdev.h>
 #include <asm/cacheflush.h>
@@ -52,6 +53,17 @@ extern struct rtl83xx_soc_info soc_info;
 
 #define RING_BUFFER	1600
 
+/*
+ * RX buffers are page fragments in cached memory. The ASIC writes the frame
+ * behind the headroom and the fragment is handed to the stack via build_skb().
+ * The headroom keeps the DMA start cache line aligned like the former ring
+ * buffers, no NET_IP_ALIGN offset is applied as the ASIC was only ever given
+ * aligned buffers
+ */
+#define RX_BUF_HEADROOM	NET_SKB_PAD
+#define RX_BUF_SIZE	(SKB_DATA_ALIGN(RX_BUF_HEADROOM + RING_BUFFER) \
+			 + SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
 struct p_hdr {
 	uint8_t		*buf;
 	uint16_t	reserved;
@@ -79,7 +91,6 @@ struct ring_b {
 	uint32_t	c_rx[MAX_RXRINGS];
 	uint32_t	c_tx[TXRINGS];
 	uint8_t		tx_space[TXRINGS * TXRINGLEN * RING_BUFFER];
-	uint8_t		*rx_space;
 };
 
 struct notify_block {
@@ -170,10 +181,21 @@ static void rtl93xx_header_vlan_set(struct p_hdr *h, int vlan)
 	h->cpu_tag[3] |= (vlan & 0xff) << 8;
 }
 
+struct rtl838x_rx_buf {
+	void		*data;
+	dma_addr_t	dma;
+};
+
 struct rtl838x_rx_q {
 	int id;
 	struct rtl838x_eth_priv *priv;
 	struct napi_struct napi;
+	spinlock_t lock;
+	struct rtl838x_rx_buf *bufs;
+	struct u64_stats_sync syncp;
+	u64 packets;
+	u64 polls;
+	u64 refill_failed;
 };
 
 struct rtl838x_eth_priv {
@@ -183,6 +205,7 @@ struct rtl838x_eth_priv {
 	spinlock_t	lock;
 	struct mii_bus	*mii_bus;
 	struct rtl838x_rx_q rx_qs[MAX_RXRINGS];
+	struct work_struct reset_work;
 	struct phylink *phylink;
 	struct phylink_config phylink_config;
 	u16 id;
@@ -329,6 +352,79 @@ bool rtl931x_decode_tag(struct p_hdr *h, struct dsa_tag *t)
 	return t->l2_offloaded;
 }
 
+/*
+ * Hands RX ring slot idx of ring r back to the ASIC, using the buffer
+ * currently attached to the slot
+ */
+static void rtl838x_rx_slot_reset(struct rtl838x_eth_priv *priv, int r, int idx)
+{
+	struct ring_b *ring = priv->membase;
+	struct p_hdr *h = &ring->rx_header[r][idx];
+
+	memset(h, 0, sizeof(struct p_hdr));
+	h->buf = (u8 *)KSEG1ADDR(priv->rx_qs[r].bufs[idx].dma);
+	h->size = RING_BUFFER;
+	/* make sure the header is visible to the ASIC */
+	mb();
+
+	ring->rx_r[r][idx] = KSEG1ADDR(h) | 0x1 | (idx == (priv->rxringlen - 1) ? WRAP : 0);
+}
+
+static int rtl838x_rx_buf_alloc(struct rtl838x_eth_priv *priv, struct rtl838x_rx_buf *buf,
+				bool napi)
+{
+	struct device *dev = &priv->pdev->dev;
+	void *data;
+
+	data = napi ? napi_alloc_frag(RX_BUF_SIZE) : netdev_alloc_frag(RX_BUF_SIZE);
+	if (!data)
+		return -ENOMEM;
+
+	buf->dma = dma_map_single(dev, data + RX_BUF_HEADROOM, RING_BUFFER, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dev, buf->dma)) {
+		skb_free_frag(data);
+		return -ENOMEM;
+	}
+	buf->data = data;
+
+	return 0;
+}
+
+static void rtl838x_rx_bufs_free(struct rtl838x_eth_priv *priv)
+{
+	struct rtl838x_rx_buf *buf;
+	int i, j;
+
+	for (i = 0; i < priv->rxrings; i++) {
+		for (j = 0; j < priv->rxringlen; j++) {
+			buf = &priv->rx_qs[i].bufs[j];
+			if (!buf->data)
+				continue;
+			dma_unmap_single(&priv->pdev->dev, buf->dma, RING_BUFFER, DMA_FROM_DEVICE);
+			skb_free_frag(buf->data);
+			buf->data = NULL;
+		}
+	}
+}
+
+static int rtl838x_rx_bufs_alloc(struct rtl838x_eth_priv *priv)
+{
+	int i, j;
+
+	for (i = 0; i < priv->rxrings; i++) {
+		for (j = 0; j < priv->rxringlen; j++) {
+			if (priv->rx_qs[i].bufs[j].data)
+				continue;
+			if (rtl838x_rx_buf_alloc(priv, &priv->rx_qs[i].bufs[j], false)) {
+				rtl838x_rx_bufs_free(priv);
+				return -ENOMEM;
+			}
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Discard the RX ring-buffers, called as part of the net-ISR
  * when the buffer runs over
@@ -337,29 +433,20 @@ static void rtl838x_rb_cleanup(struct rtl838x_eth_priv *priv, int status)
 {
 	int r;
 	u32	*last;
-	struct p_hdr *h;
 	struct ring_b *ring = priv->membase;
 
 	for (r = 0; r < priv->rxrings; r++) {
 		pr_debug("In %s working on r: %d\n", __func__, r);
+		spin_lock(&priv->rx_qs[r].lock);
 		last = (u32 *)KSEG1ADDR(sw_r32(priv->r->dma_if_rx_cur + r * 4));
 		do {
 			if ((ring->rx_r[r][ring->c_rx[r]] & 0x1))
 				break;
 			pr_debug("Got something: %d\n", ring->c_rx[r]);
-			h = &ring->rx_header[r][ring->c_rx[r]];
-			memset(h, 0, sizeof(struct p_hdr));
-			h->buf = (u8 *)KSEG1ADDR(ring->rx_space
-					+ r * priv->rxringlen * RING_BUFFER
-					+ ring->c_rx[r] * RING_BUFFER);
-			h->size = RING_BUFFER;
-			/* make sure the header is visible to the ASIC */
-			mb();
-
-			ring->rx_r[r][ring->c_rx[r]] = KSEG1ADDR(h) | 0x1
-				| (ring->c_rx[r] == (priv->rxringlen - 1) ? WRAP : 0x1);
+			rtl838x_rx_slot_reset(priv, r, ring->c_rx[r]);
 			ring->c_rx[r] = (ring->c_rx[r] + 1) % priv->rxringlen;
 		} while (&ring->rx_r[r][ring->c_rx[r]] != last);
+		spin_unlock(&priv->rx_qs[r].lock);
 	}
 }
 
@@ -824,18 +911,10 @@ static void rtl838x_setup_ring_buffer(struct rtl838x_eth_priv *priv, struct ring
 
 	struct p_hdr *h;
 
+	/* All rings owned by switch, last one wraps */
 	for (i = 0; i < priv->rxrings; i++) {
-		for (j = 0; j < priv->rxringlen; j++) {
-			h = &ring->rx_header[i][j];
-			memset(h, 0, sizeof(struct p_hdr));
-			h->buf = (u8 *)KSEG1ADDR(ring->rx_space
-					+ i * priv->rxringlen * RING_BUFFER
-					+ j * RING_BUFFER);
-			h->size = RING_BUFFER;
-			/* All rings owned by switch, last one wraps */
-			ring->rx_r[i][j] = KSEG1ADDR(h) | 1 
-					   | (j == (priv->rxringlen - 1) ? WRAP : 0);
-		}
+		for (j = 0; j < priv->rxringlen; j++)
+			rtl838x_rx_slot_reset(priv, i, j);
 		ring->c_rx[i] = 0;
 	}
 
@@ -880,11 +959,17 @@ static int rtl838x_eth_open(struct net_device *ndev)
 	unsigned long flags;
 	struct rtl838x_eth_priv *priv = netdev_priv(ndev);
 	struct ring_b *ring = priv->membase;
-	int i;
+	int i, err;
 
 	pr_debug("%s called: RX rings %d(length %d), TX rings %d(length %d)\n",
 		__func__, priv->rxrings, priv->rxringlen, TXRINGS, TXRINGLEN);
 
+	err = rtl838x_rx_bufs_alloc(priv);
+	if (err) {
+		netdev_err(ndev, "cannot allocate RX buffers\n");
+		return err;
+	}
+
 	spin_lock_irqsave(&priv->lock, flags);
 	rtl838x_hw_reset(priv);
 	rtl838x_setup_ring_buffer(priv, ring);
@@ -1027,6 +1112,8 @@ static int rtl838x_eth_stop(struct net_device *ndev)
 
 	netif_tx_stop_all_queues(ndev);
 
+	rtl838x_rx_bufs_free(priv);
+
 	return 0;
 }
 
@@ -1113,12 +1200,25 @@ static void rtl931x_eth_set_multicast_list(struct net_device *ndev)
 	}
 }
 
-static void rtl838x_eth_tx_timeout(struct net_device *ndev, unsigned int txqueue)
+/*
+ * Reinitializes the DMA engine after a TX timeout. The RX rings are only
+ * protected by their own locks while polling, so NAPI is disabled on all
+ * of them for the reset, which is why this runs from a work queue
+ */
+static void rtl838x_eth_reset_work(struct work_struct *work)
 {
+	struct rtl838x_eth_priv *priv = container_of(work, struct rtl838x_eth_priv, reset_work);
+	struct net_device *ndev = priv->netdev;
 	unsigned long flags;
-	struct rtl838x_eth_priv *priv = netdev_priv(ndev);
+	int i;
+
+	rtnl_lock();
+	if (!netif_running(ndev))
+		goto out;
+
+	for (i = 0; i < priv->rxrings; i++)
+		napi_disable(&priv->rx_qs[i].napi);
 
-	pr_warn("%s\n", __func__);
 	spin_lock_irqsave(&priv->lock, flags);
 	rtl838x_hw_stop(priv);
 	rtl838x_hw_ring_setup(priv);
@@ -1126,6 +1226,19 @@ static void rtl838x_eth_tx_timeout(struct net_device *ndev, unsigned int txqueue
 	netif_trans_update(ndev);
 	netif_start_queue(ndev);
 	spin_unlock_irqrestore(&priv->lock, flags);
+
+	for (i = 0; i < priv->rxrings; i++)
+		napi_enable(&priv->rx_qs[i].napi);
+out:
+	rtnl_unlock();
+}
+
+static void rtl838x_eth_tx_timeout(struct net_device *ndev, unsigned int txqueue)
+{
+	struct rtl838x_eth_priv *priv = netdev_priv(ndev);
+
+	pr_warn("%s\n", __func__);
+	schedule_work(&priv->reset_work);
 }
 
 static int rtl838x_eth_tx(struct sk_buff *skb, struct net_device *dev)
@@ -1250,12 +1363,13 @@ u16 rtl93xx_pick_tx_queue(struct net_device *dev, struct sk_buff *skb,
 static int rtl838x_hw_receive(struct net_device *dev, int r, int budget)
 {
 	struct rtl838x_eth_priv *priv = netdev_priv(dev);
+	struct rtl838x_rx_q *rx_q = &priv->rx_qs[r];
 	struct ring_b *ring = priv->membase;
+	struct rtl838x_rx_buf *buf, new_buf;
 	struct sk_buff *skb;
 	LIST_HEAD(rx_list);
 	unsigned long flags;
-	int i, len, work_done = 0;
-	u8 *data, *skb_data;
+	int i, len, work_done = 0, refill_failed = 0;
 	unsigned int val;
 	u32	*last;
 	struct p_hdr *h;
@@ -1263,7 +1377,7 @@ static int rtl838x_hw_receive(struct net_device *dev, int r, int budget)
 	struct dsa_tag tag;
 
 	pr_debug("---------------------------------------------------------- RX - %d\n", r);
-	spin_lock_irqsave(&priv->lock, flags);
+	spin_lock_irqsave(&rx_q->lock, flags);
 	last = (u32 *)KSEG1ADDR(sw_r32(priv->r->dma_if_rx_cur + r * 4));
 
 	do {
@@ -1276,7 +1390,7 @@ static int rtl838x_hw_receive(struct net_device *dev, int r, int budget)
 		}
 
 		h = &ring->rx_header[r][ring->c_rx[r]];
-		data = (u8 *)KSEG1ADDR(h->buf);
+		buf = &rx_q->bufs[ring->c_rx[r]];
 		len = h->len;
 		if (!len)
 			break;
@@ -1287,73 +1401,87 @@ static int rtl838x_hw_receive(struct net_device *dev, int r, int budget)
 		if (dsa)
 			len += 4;
 
-		skb = netdev_alloc_skb(dev, len + 4);
-		skb_reserve(skb, NET_IP_ALIGN);
-
-		if (likely(skb)) {
-			/* BUG: Prevent bug on RTL838x SoCs*/
-			if (priv->family_id == RTL8380_FAMILY_ID) {
-				sw_w32(0xffffffff, priv->r->dma_if_rx_ring_size(0));
-				for (i = 0; i < priv->rxrings; i++) {
-					/* Update each ring cnt */
-					val = sw_r32(priv->r->dma_if_rx_ring_cntr(i));
-					sw_w32(val, priv->r->dma_if_rx_ring_cntr(i));
-				}
-			}
+		/*
+		 * The frame is passed up in the buffer it was received in, the slot
+		 * gets a new buffer. If none can be allocated, the frame is dropped
+		 * and the old buffer stays in the ring
+		 */
+		if (unlikely(rtl838x_rx_buf_alloc(priv, &new_buf, true))) {
+			refill_failed++;
+			if (net_ratelimit())
+				dev_warn(&dev->dev, "low on memory - packet dropped\n");
+			dev->stats.rx_dropped++;
+			goto release;
+		}
 
-			skb_data = skb_put(skb, len);
-			/* Make sure data is visible */
-			mb();
-			memcpy(skb->data, (u8 *)KSEG1ADDR(data), len);
-			/* Overwrite CRC with cpu_tag */
-			if (dsa) {
-				priv->r->decode_tag(h, &tag);
-				skb->data[len-4] = 0x80;
-				skb->data[len-3] = tag.port;
-				skb->data[len-2] = 0x10;
-				skb->data[len-1] = 0x00;
-				if (tag.l2_offloaded)
-					skb->data[len-3] |= 0x40;
+		dma_unmap_single(&priv->pdev->dev, buf->dma, RING_BUFFER, DMA_FROM_DEVICE);
+		skb = build_skb(buf->data, RX_BUF_SIZE);
+		if (unlikely(!skb)) {
+			skb_free_frag(buf->data);
+			*buf = new_buf;
+			dev->stats.rx_dropped++;
+			goto release;
+		}
+		*buf = new_buf;
+		skb_reserve(skb, RX_BUF_HEADROOM);
+
+		/* BUG: Prevent bug on RTL838x SoCs*/
+		if (priv->family_id == RTL8380_FAMILY_ID) {
+			sw_w32(0xffffffff, priv->r->dma_if_rx_ring_size(0));
+			for (i = 0; i < priv->rxrings; i++) {
+				/* Update each ring cnt */
+				val = sw_r32(priv->r->dma_if_rx_ring_cntr(i));
+				sw_w32(val, priv->r->dma_if_rx_ring_cntr(i));
 			}
+		}
 
-			if (tag.queue >= 0)
-				pr_debug("Queue: %d, len: %d, reason %d port %d\n",
-					 tag.queue, len, tag.reason, tag.port);
+		skb_put(skb, len);
+		/* Overwrite CRC with cpu_tag */
+		if (dsa) {
+			priv->r->decode_tag(h, &tag);
+			skb->data[len-4] = 0x80;
+			skb->data[len-3] = tag.port;
+			skb->data[len-2] = 0x10;
+			skb->data[len-1] = 0x00;
+			if (tag.l2_offloaded)
+				skb->data[len-3] |= 0x40;
+		}
 
-			skb->protocol = eth_type_trans(skb, dev);
-			if (dev->features & NETIF_F_RXCSUM) {
-				if (tag.crc_error)
-					skb_checksum_none_assert(skb);
-				else
-					skb->ip_summed = CHECKSUM_UNNECESSARY;
-			}
-			dev->stats.rx_packets++;
-			dev->stats.rx_bytes += len;
+		if (tag.queue >= 0)
+			pr_debug("Queue: %d, len: %d, reason %d port %d\n",
+				 tag.queue, len, tag.reason, tag.port);
 
-			list_add_tail(&skb->list, &rx_list);
-		} else {
-			if (net_ratelimit())
-				dev_warn(&dev->dev, "low on memory - packet dropped\n");
-			dev->stats.rx_dropped++;
+		skb->protocol = eth_type_trans(skb, dev);
+		if (dev->features & NETIF_F_RXCSUM) {
+			if (tag.crc_error)
+				skb_checksum_none_assert(skb);
+			else
+				skb->ip_summed = CHECKSUM_UNNECESSARY;
 		}
+		dev->stats.rx_packets++;
+		dev->stats.rx_bytes += len;
 
-		/* Reset header structure */
-		memset(h, 0, sizeof(struct p_hdr));
-		h->buf = data;
-		h->size = RING_BUFFER;
+		list_add_tail(&skb->list, &rx_list);
 
-		ring->rx_r[r][ring->c_rx[r]] = KSEG1ADDR(h) | 0x1 
-			| (ring->c_rx[r] == (priv->rxringlen - 1) ? WRAP : 0x1);
+release:
+		rtl838x_rx_slot_reset(priv, r, ring->c_rx[r]);
 		ring->c_rx[r] = (ring->c_rx[r] + 1) % priv->rxringlen;
 		last = (u32 *)KSEG1ADDR(sw_r32(priv->r->dma_if_rx_cur + r * 4));
 	} while (&ring->rx_r[r][ring->c_rx[r]] != last && work_done < budget);
 
-	netif_receive_skb_list(&rx_list);
-
-	// Update counters
+	/* Update counters, the counter registers are shared between rings */
+	spin_lock(&priv->lock);
 	priv->r->update_cntr(r, 0);
+	spin_unlock(&priv->lock);
 
-	spin_unlock_irqrestore(&priv->lock, flags);
+	spin_unlock_irqrestore(&rx_q->lock, flags);
+
+	u64_stats_update_begin(&rx_q->syncp);
+	rx_q->packets += work_done;
+	rx_q->refill_failed += refill_failed;
+	u64_stats_update_end(&rx_q->syncp);
+
+	netif_receive_skb_list(&rx_list);
 
 	return work_done;
 }
@@ -1373,6 +1501,10 @@ static int rtl838x_poll_rx(struct napi_struct *napi, int budget)
 		work_done += work;
 	}
 
+	u64_stats_update_begin(&rx_q->syncp);
+	rx_q->polls++;
+	u64_stats_update_end(&rx_q->syncp);
+
 	if (work_done < budget) {
 		napi_complete_done(napi, work_done);
 
@@ -2334,9 +2466,66 @@ static const struct phylink_mac_ops rtl838x_phylink_ops = {
 	.mac_link_up = rtl838x_mac_link_up,
 };
 
+static const char rtl838x_rx_q_stat_names[][ETH_GSTRING_LEN] = {
+	"packets",
+	"polls",
+	"refill_failed",
+};
+
+#define RX_Q_STATS	ARRAY_SIZE(rtl838x_rx_q_stat_names)
+
+static void rtl838x_get_strings(struct net_device *dev, u32 stringset, u8 *data)
+{
+	struct rtl838x_eth_priv *priv = netdev_priv(dev);
+	int i, j;
+
+	if (stringset != ETH_SS_STATS)
+		return;
+
+	for (i = 0; i < priv->rxrings; i++) {
+		for (j = 0; j < RX_Q_STATS; j++) {
+			snprintf(data, ETH_GSTRING_LEN, "rx%d_%s", i, rtl838x_rx_q_stat_names[j]);
+			data += ETH_GSTRING_LEN;
+		}
+	}
+}
+
+static int rtl838x_get_sset_count(struct net_device *dev, int sset)
+{
+	struct rtl838x_eth_priv *priv = netdev_priv(dev);
+
+	if (sset != ETH_SS_STATS)
+		return -EOPNOTSUPP;
+
+	return priv->rxrings * RX_Q_STATS;
+}
+
+static void rtl838x_get_ethtool_stats(struct net_device *dev,
+				      struct ethtool_stats *stats, u64 *data)
+{
+	struct rtl838x_eth_priv *priv = netdev_priv(dev);
+	struct rtl838x_rx_q *rx_q;
+	unsigned int start;
+	int i;
+
+	for (i = 0; i < priv->rxrings; i++) {
+		rx_q = &priv->rx_qs[i];
+		do {
+			start = u64_stats_fetch_begin_irq(&rx_q->syncp);
+			data[0] = rx_q->packets;
+			data[1] = rx_q->polls;
+			data[2] = rx_q->refill_failed;
+		} while (u64_stats_fetch_retry_irq(&rx_q->syncp, start));
+		data += RX_Q_STATS;
+	}
+}
+
 static const struct ethtool_ops rtl838x_ethtool_ops = {
 	.get_link_ksettings     = rtl838x_get_link_ksettings,
 	.set_link_ksettings     = rtl838x_set_link_ksettings,
+	.get_strings		= rtl838x_get_strings,
+	.get_sset_count		= rtl838x_get_sset_count,
+	.get_ethtool_stats	= rtl838x_get_ethtool_stats,
 };
 
 static int __init rtl838x_eth_probe(struct platform_device *pdev)
@@ -2348,7 +2537,6 @@ static int __init rtl838x_eth_probe(struct platform_device *pdev)
 	phy_interface_t phy_mode;
 	struct phylink *phylink;
 	int err = 0, i, rxrings, rxringlen;
-	struct ring_b *ring;
 
 	pr_info("Probing RTL838X eth device pdev: %x, dev: %x\n",
 		(u32)pdev, (u32)(&(pdev->dev)));
@@ -2391,9 +2579,9 @@ static int __init rtl838x_eth_probe(struct platform_device *pdev)
 		goto err_free;
 	}
 
-	/* Allocate buffer memory */
-	priv->membase = dmam_alloc_coherent(&pdev->dev, rxrings * rxringlen * RING_BUFFER
-				+ sizeof(struct ring_b) + sizeof(struct notify_b),
+	/* Allocate buffer memory, RX buffers are allocated separately when opening */
+	priv->membase = dmam_alloc_coherent(&pdev->dev,
+				sizeof(struct ring_b) + sizeof(struct notify_b),
 				(void *)&dev->mem_start, GFP_KERNEL);
 	if (!priv->membase) {
 		dev_err(&pdev->dev, "cannot allocate DMA buffer\n");
@@ -2401,11 +2589,19 @@ static int __init rtl838x_eth_probe(struct platform_device *pdev)
 		goto err_free;
 	}
 
-	// Allocate ring-buffer space at the end of the allocated memory
-	ring = priv->membase;
-	ring->rx_space = priv->membase + sizeof(struct ring_b) + sizeof(struct notify_b);
+	for (i = 0; i < rxrings; i++) {
+		priv->rx_qs[i].bufs = devm_kcalloc(&pdev->dev, rxringlen,
+						   sizeof(struct rtl838x_rx_buf), GFP_KERNEL);
+		if (!priv->rx_qs[i].bufs) {
+			err = -ENOMEM;
+			goto err_free;
+		}
+		spin_lock_init(&priv->rx_qs[i].lock);
+		u64_stats_init(&priv->rx_qs[i].syncp);
+	}
 
 	spin_lock_init(&priv->lock);
+	INIT_WORK(&priv->reset_work, rtl838x_eth_reset_work);
 
 	dev->ethtool_ops = &rtl838x_ethtool_ops;
 	dev->min_mtu = ETH_ZLEN;
@@ -2551,6 +2747,7 @@ static int rtl838x_eth_remove(struct platform_device *pdev)
 
 	if (dev) {
 		pr_info("Removing platform driver for rtl838x-eth\n");
+		cancel_work_sync(&priv->reset_work);
 		rtl838x_mdio_remove(priv);
 		rtl838x_hw_stop(priv);
 